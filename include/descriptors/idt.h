@@ -27,6 +27,13 @@
 
 #define IRQ_PIT      32
 #define IRQ_KEYBOARD 33
+#define IRQ_COM1     36
+
+// Handlers per PIC line, PCI devices may share one
+#define IRQ_MAX_SHARED 4
+
+#define SYSCALL_VECTOR 0x80
+#define YIELD_VECTOR   0x81
 
 typedef struct {
 	uint16_t    isr_low;      // The lower 16 bits of the ISR's address
@@ -48,10 +55,15 @@ extern idt_entry_t idt[IDT_MAX_DESCRIPTORS]; // Create an array of IDT entries;
 extern idtr_t idtr;
 
 extern void syscall_stub(void);
+extern void yield_stub(void);
 
 void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags);
 void idt_init(void);
 
+typedef void (*irq_handler_t)(void);
+
+// Calls handler for every interrupt on PIC line irq (0-15) and unmasks it
+int irq_register(uint8_t irq, irq_handler_t handler);
 uint64_t irq_handler(uint64_t irq, uint64_t current_rsp);
 
 #endif
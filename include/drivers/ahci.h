@@ -0,0 +1,109 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include <pci.h>
+
+#define AHCI_PROG_IF        0x01  // SATA controller speaking AHCI 1.x
+#define AHCI_ABAR           5     // BAR holding the HBA registers
+#define AHCI_ABAR_SIZE      0x1100
+
+// HBA registers
+#define AHCI_CAP            0x00
+#define AHCI_GHC            0x04
+#define AHCI_IS             0x08
+#define AHCI_PI             0x0C
+
+#define AHCI_CAP_NCS(cap)   ((((cap) >> 8) & 0x1F) + 1)  // Command slots per port
+#define AHCI_CAP_SNCQ       (1u << 30)
+#define AHCI_CAP_S64A       (1u << 31)
+
+#define AHCI_GHC_IE         (1u << 1)
+#define AHCI_GHC_AE         (1u << 31)
+
+// Port registers, 0x80 bytes per port
+#define AHCI_PORT(n)        (0x100 + (n) * 0x80)
+#define AHCI_PxCLB          0x00
+#define AHCI_PxCLBU         0x04
+#define AHCI_PxFB           0x08
+#define AHCI_PxFBU          0x0C
+#define AHCI_PxIS           0x10
+#define AHCI_PxIE           0x14
+#define AHCI_PxCMD          0x18
+#define AHCI_PxTFD          0x20
+#define AHCI_PxSIG          0x24
+#define AHCI_PxSSTS         0x28
+#define AHCI_PxSCTL         0x2C
+#define AHCI_PxSERR         0x30
+#define AHCI_PxSACT         0x34
+#define AHCI_PxCI           0x38
+
+#define AHCI_PxCMD_ST       (1u << 0)
+#define AHCI_PxCMD_FRE      (1u << 4)
+#define AHCI_PxCMD_FR       (1u << 14)
+#define AHCI_PxCMD_CR       (1u << 15)
+
+#define AHCI_PxIS_DHRS      (1u << 0)   // D2H register FIS: non-queued command done
+#define AHCI_PxIS_PSS       (1u << 1)   // PIO setup FIS
+#define AHCI_PxIS_SDBS      (1u << 3)   // Set device bits FIS: NCQ commands done
+#define AHCI_PxIS_IFS       (1u << 27)
+#define AHCI_PxIS_HBDS      (1u << 28)
+#define AHCI_PxIS_HBFS      (1u << 29)
+#define AHCI_PxIS_TFES      (1u << 30)
+#define AHCI_PxIS_ERROR     (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_SSTS_DET(s)    ((s) & 0xF)
+#define AHCI_SSTS_IPM(s)    (((s) >> 8) & 0xF)
+#define AHCI_DET_PRESENT    3     // Device detected, PHY up
+#define AHCI_IPM_ACTIVE     1
+#define AHCI_SCTL_COMRESET  1
+#define AHCI_SIG_ATA        0x00000101
+
+#define AHCI_FIS_REG_H2D    0x27
+#define AHCI_FIS_COMMAND    0x80  // Byte 1 of a register FIS: command, not control
+
+#define AHCI_MAX_PORTS      32
+#define AHCI_MAX_SLOTS      32
+#define AHCI_TIMEOUT_NS     5000000000ULL
+
+// Each slot owns a physically contiguous bounce buffer, so one PRD covers
+// a whole command. Longer requests are split across slots and queued.
+#define AHCI_SLOT_PAGES     4
+#define AHCI_SLOT_SECTORS   (AHCI_SLOT_PAGES * 4096 / 512)
+
+// Command list entry. Bits of flags: 0-4 FIS length in dwords, 6 write.
+typedef struct {
+    uint16_t flags;
+    uint16_t prdtl;             // PRD entries in the command table
+    volatile uint32_t prdbc;    // Bytes transferred, written by the HBA
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__((packed)) ahci_cmd_header_t;
+
+#define AHCI_CMD_FIS_LEN    5     // Register H2D FIS, in dwords
+#define AHCI_CMD_WRITE      (1u << 6)
+
+typedef struct {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;               // Byte count minus one, must be odd
+} __attribute__((packed)) ahci_prd_t;
+
+// Command tables are 128-byte aligned, one every AHCI_CMD_TABLE_SIZE bytes
+typedef struct {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    ahci_prd_t prdt[1];
+} __attribute__((packed)) ahci_cmd_table_t;
+
+#define AHCI_CMD_TABLE_SIZE 256
+#define AHCI_CMD_LIST_SIZE  1024  // 32 headers, followed by the 256-byte FIS area
+
+// Finds the first AHCI controller and registers a block device for every
+// SATA disk on it. Returns the number of disks.
+int ahci_init(void);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <block.h>
+
+// Buffers cache one page of a disk, 8 sectors aligned to an 8-sector
+// boundary. The cache only grows up to BCACHE_MAX_PAGES, then recycles the
+// least recently used buffer.
+#define BCACHE_BLOCK_SECTORS 8
+#define BCACHE_BLOCK_SIZE    (BCACHE_BLOCK_SECTORS * BLOCK_SECTOR_SIZE)
+#define BCACHE_MAX_PAGES     1024   // 4MiB
+#define BCACHE_HASH_SIZE     256
+
+// Read-ahead window in blocks. It opens when a read starts where the
+// previous one on the same disk ended, doubles on every further sequential
+// read and closes on a random one.
+#define BCACHE_RA_MIN        4
+#define BCACHE_RA_MAX        32
+#define BCACHE_RUN_MAX       64     // Blocks fetched by one device read
+
+// Counters in blocks, layout must match userspace/openidp.h
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;        // Blocks fetched ahead of the reader
+    uint64_t readahead_hits;   // ... that were read later
+    uint64_t evictions;
+    uint64_t dev_reads;        // Device read commands issued
+    uint64_t dev_writes;
+    uint64_t pages;            // Pages held by the cache
+    uint64_t max_pages;
+} bcache_stats_t;
+
+// Same contract as block_ops_t. Writes go through to the device before the
+// cached copy is updated.
+int bcache_read(block_device_t* dev, uint64_t lba, uint32_t count, uint8_t* buf);
+int bcache_write(block_device_t* dev, uint64_t lba, uint32_t count, const uint8_t* buf);
+int bcache_flush(block_device_t* dev);
+
+void bcache_get_stats(bcache_stats_t* out);
+
+#endif
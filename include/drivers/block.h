@@ -0,0 +1,36 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <com1.h>
+
+#define BLOCK_SECTOR_SIZE  512
+#define BLOCK_MAX_DEVICES  8
+
+struct block_device;
+
+// Driver entry points. Each returns 0 on success, -1 on a device error.
+// They may sleep, and may be called by several tasks at once.
+typedef struct {
+    int (*read)(struct block_device* dev, uint64_t lba, uint32_t count, uint8_t* buf);
+    int (*write)(struct block_device* dev, uint64_t lba, uint32_t count, const uint8_t* buf);
+    int (*flush)(struct block_device* dev);
+} block_ops_t;
+
+typedef struct block_device {
+    const char* name;
+    uint64_t sectors;
+    const block_ops_t* ops;
+    void* priv;              // Driver state
+    int id;                  // Registration order, set by block_register
+} block_device_t;
+
+// Probes the disk drivers, fastest interface first. FatFs drive N is the
+// N-th registered device.
+void block_init(void);
+
+int block_register(block_device_t* dev);
+block_device_t* block_get(int index);
+
+#endif
@@ -2,17 +2,24 @@
 #define COM1_H
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <io.h>
 
 #define SERIAL_COM1_BASE  0x3F8
 
 #define SERIAL_DATA       0   // Transmit / Receive buffer
 #define SERIAL_IER        1   // Interrupt Enable Register
-#define SERIAL_FCR        2   // FIFO Control Register
+#define SERIAL_FCR        2   // FIFO Control Register (write)
+#define SERIAL_IIR        2   // Interrupt Identification Register (read)
 #define SERIAL_LCR        3   // Line Control Register
 #define SERIAL_MCR        4   // Modem Control Register
 #define SERIAL_LSR        5   // Line Status Register
 
+#define IER_THRE          0x02   // Transmit holding register empty
+
+#define LSR_THRE          0x20   // Transmit FIFO empty
+
 #define LCR_DLAB          0x80   // Enable Divisor Latch Access
 #define LCR_8_BITS        0x03   // 8 data bits
 #define LCR_1_STOP        0x00
@@ -27,6 +34,9 @@
 #define MCR_RTS           0x02
 #define MCR_OUT2          0x08   // Needed for IRQs
 
+#define SERIAL_FIFO_SIZE  16     // 16550 transmit FIFO depth
+#define SERIAL_LOG_SIZE   16384  // Kernel log ring, power of two
+
 #define SERIAL_BAUD       38400
 #define SERIAL_DIVISOR    (115200 / SERIAL_BAUD)
 
@@ -34,6 +44,11 @@
 #define SERIAL_DLH        ((SERIAL_DIVISOR >> 8) & 0xFF)
 
 void serial_init(void);
+void serial_enable_irq(void);
+void serial_irq_handler(void);
+void serial_panic(void);
+uint64_t serial_log_read(char* dst, uint64_t max);
+
 void serial_write_char(char c);
 void serial_write_string(const char* str);
 void serial_printf(const char* fmt, ...);
@@ -7,6 +7,7 @@
 #define ATA_PRIMARY_IO      0x1F0
 #define ATA_PRIMARY_CTRL    0x3F6
 #define ATA_MASTER          0xE0
+#define ATA_DEVICE_LBA      0x40  // Device register: LBA addressing
 
 #define ATA_REG_DATA        0x00
 #define ATA_REG_ERROR       0x01
@@ -18,16 +19,88 @@
 #define ATA_REG_COMMAND     0x07
 #define ATA_REG_STATUS      0x07
 
-#define ATA_CMD_READ_PIO    0x20
-#define ATA_CMD_WRITE_PIO   0x30
-#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CTRL_NIEN       0x02  // Device control: no interrupts (polled PIO)
+
+#define ATA_CMD_READ_PIO        0x20
+#define ATA_CMD_READ_PIO_EXT    0x24
+#define ATA_CMD_WRITE_PIO       0x30
+#define ATA_CMD_WRITE_PIO_EXT   0x34
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_MULTIPLE       0xC4
+#define ATA_CMD_READ_MULTIPLE_EXT   0x29
+#define ATA_CMD_WRITE_MULTIPLE      0xC5
+#define ATA_CMD_WRITE_MULTIPLE_EXT  0x39
+#define ATA_CMD_SET_MULTIPLE    0xC6
+#define ATA_CMD_CACHE_FLUSH     0xE7
+#define ATA_CMD_CACHE_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_FPDMA_QUEUED   0x60  // NCQ, SATA only
+#define ATA_CMD_WRITE_FPDMA_QUEUED  0x61
+
 #define ATA_SR_BSY          0x80
+#define ATA_SR_DF           0x20  // Device fault
 #define ATA_SR_DRQ          0x08
-#define ATA_SR_ERR 0x01  // Indicates an error occurred
+#define ATA_SR_ERR          0x01  // Indicates an error occurred
+
+// IDENTIFY DEVICE words
+#define ATA_ID_MAX_MULTIPLE   47   // Low byte: most sectors per READ/WRITE MULTIPLE block
+#define ATA_ID_CAPABILITIES   49   // Bit 8: DMA supported
+#define ATA_ID_LBA28_SECTORS  60   // Words 60-61
+#define ATA_ID_QUEUE_DEPTH    75   // Bits 0-4: NCQ depth minus one
+#define ATA_ID_SATA_CAPS      76   // Bit 8: native command queuing
+#define ATA_ID_COMMAND_SETS   83   // Bit 10: 48-bit addressing
+#define ATA_ID_LBA48_SECTORS  100  // Words 100-103
+
+// Bus master IDE registers (PCI BAR4), primary channel
+#define ATA_BM_CMD          0x00
+#define ATA_BM_STATUS       0x02
+#define ATA_BM_PRDT         0x04
+
+#define ATA_BM_CMD_START    0x01
+#define ATA_BM_CMD_READ     0x08  // Direction: device to memory
+#define ATA_BM_SR_ACTIVE    0x01
+#define ATA_BM_SR_ERR       0x02
+#define ATA_BM_SR_IRQ       0x04
+#define ATA_BM_PROG_IF      0x80  // PCI prog_if bit: controller can bus master
+
+#define ATA_IRQ             14    // Primary channel in compatibility mode
+
+// Physical Region Descriptor. Buffers must sit below 4GiB and not cross
+// a 64KiB boundary, which single pages never do.
+typedef struct {
+    uint32_t phys;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+#define ATA_PRD_EOT         0x8000
+
+// DMA goes through a bounce buffer of separate pages, one PRD each
+#define ATA_DMA_PAGES       16
+#define ATA_DMA_TIMEOUT_NS  5000000000ULL
+
+#define ATA_SECTOR_SIZE     512
+#define ATA_LBA28_LIMIT     0x10000000ULL
+#define ATA_MAX_TRANSFER    256    // Sectors per command (a count of 0 means 256 in LBA28)
+
+typedef struct {
+    int present;
+    int lba48;
+    int dma;                // Bus master DMA with IRQ completion
+    uint32_t multiple;      // Sectors per DRQ block, 1 without READ/WRITE MULTIPLE
+    uint64_t sectors;
+} ata_device_t;
 
-static void ata_wait();
+// Identifies the primary master. Returns 0 if a usable drive is there.
+int ata_init(void);
+const ata_device_t* ata_device(void);
 
-void ata_read_sector(uint32_t lba, uint8_t* buf);
-void ata_write_sector(uint32_t lba, const uint8_t* buf);
+// Return 0 on success, -1 on a drive error or timeout
+int ata_read(uint64_t lba, uint32_t count, uint8_t* buf);
+int ata_write(uint64_t lba, uint32_t count, const uint8_t* buf);
+int ata_flush(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -39,8 +39,9 @@
 #define FF_FS_RPATH       0
 
 /* Memory and sync */
-#define FF_FS_LOCK        0
-#define FF_FS_REENTRANT   0
+#define FF_FS_LOCK        128  /* Open files and dirs, keeps f_read's unlocked window safe */
+#define FF_FS_REENTRANT   1  /* Disk I/O sleeps, see ffsystem.c */
+#define FF_FS_TIMEOUT     1000
 
 #define FF_NORTC_MON   1    /* January */
 #define FF_NORTC_MDAY  1    /* 1st */
@@ -0,0 +1,30 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <stdint.h>
+#include <fatfs/ff.h>
+
+// Dentry-style cache in front of follow_path(). Maps a normalized path to the
+// DIR state the walk ended in (containing directory, entry location, name)
+// plus a copy of the 32-byte directory entry, so repeated lookups skip the
+// walk and f_stat() is answered without touching the disk. Failed lookups are
+// cached as negative entries.
+#define PATHCACHE_SIZE      128   // Direct-mapped slots
+#define PATHCACHE_PATH_MAX  128   // Longer paths are not cached
+#define PATHCACHE_DIRENT    32    // Size of a FAT directory entry
+
+typedef struct {
+    uint32_t gen;                 // Valid only while equal to the cache generation
+    WORD fs_id;                   // Mount ID of the volume
+    uint32_t hash;
+    FRESULT res;                  // FR_OK, FR_NO_FILE or FR_NO_PATH
+    DIR dir;                      // follow_path() result, dir pointer excluded
+    BYTE dirent[PATHCACHE_DIRENT];
+    char path[PATHCACHE_PATH_MAX];
+} pathcache_entry_t;
+
+const pathcache_entry_t* pathcache_lookup(FATFS* fs, const TCHAR* path);
+void pathcache_insert(FATFS* fs, const TCHAR* path, const DIR* dp, FRESULT res);
+void pathcache_invalidate(void);
+
+#endif
@@ -9,6 +9,7 @@
 #include <io.h>
 #include <pic.h>
 #include <com1.h>
+#include <task.h>
 
 #define KEY_MOD_SHIFT  0x0100
 #define KEY_MOD_CTRL   0x0200
@@ -22,5 +23,7 @@
 void keyboard_init(void);
 void keyboard_handler(void);
 uint16_t keyboard_read_key(void);
+int keyboard_has_key(void);
+wait_queue_t* keyboard_wait_queue(void);
 
 #endif
\ No newline at end of file
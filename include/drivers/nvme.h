@@ -0,0 +1,99 @@
+#ifndef NVME_H
+#define NVME_H
+
+#include <stdint.h>
+#include <pci.h>
+
+#define NVME_PROG_IF        0x02
+#define NVME_BAR            0
+
+// Set to 1 to create the I/O completion queue without an interrupt and
+// have waiting tasks poll it between yields
+#define NVME_POLLED         0
+
+// Controller registers (BAR0)
+#define NVME_CAP            0x00  // 64-bit
+#define NVME_CC             0x14
+#define NVME_CSTS           0x1C
+#define NVME_AQA            0x24
+#define NVME_ASQ            0x28  // 64-bit
+#define NVME_ACQ            0x30  // 64-bit
+#define NVME_DOORBELLS      0x1000
+
+#define NVME_CAP_MQES(cap)   ((uint32_t)((cap) & 0xFFFF) + 1)   // Max queue entries
+#define NVME_CAP_TO(cap)     ((uint32_t)((cap) >> 24) & 0xFF)   // Ready timeout, 500ms units
+#define NVME_CAP_DSTRD(cap)  ((uint32_t)((cap) >> 32) & 0xF)    // Doorbell stride, 4 << n bytes
+#define NVME_CAP_MPSMIN(cap) ((uint32_t)((cap) >> 48) & 0xF)    // Smallest page, 4KiB << n
+
+#define NVME_CC_EN          (1u << 0)
+#define NVME_CC_IOSQES      (6u << 16)  // 64-byte submission entries
+#define NVME_CC_IOCQES      (4u << 20)  // 16-byte completion entries
+#define NVME_CSTS_RDY       (1u << 0)
+#define NVME_CSTS_CFS       (1u << 1)
+
+// Admin commands
+#define NVME_ADMIN_CREATE_SQ    0x01
+#define NVME_ADMIN_CREATE_CQ    0x05
+#define NVME_ADMIN_IDENTIFY     0x06
+#define NVME_ADMIN_SET_FEATURES 0x09
+
+#define NVME_CNS_NAMESPACE      0x00
+#define NVME_CNS_CONTROLLER     0x01
+#define NVME_FEAT_NUM_QUEUES    0x07
+
+#define NVME_QUEUE_PC           (1u << 0)   // Physically contiguous
+#define NVME_QUEUE_IEN          (1u << 1)   // Completion queue raises interrupts
+
+// NVM commands
+#define NVME_CMD_FLUSH      0x00
+#define NVME_CMD_WRITE      0x01
+#define NVME_CMD_READ       0x02
+
+// Identify data
+#define NVME_ID_CTRL_MDTS   77    // Max transfer, 2^n pages, 0 means no limit
+#define NVME_ID_CTRL_VWC    525   // Bit 0: volatile write cache
+#define NVME_ID_NS_NSZE     0     // Namespace size in blocks
+#define NVME_ID_NS_FLBAS    26    // Bits 0-3: LBA format in use
+#define NVME_ID_NS_LBAF     128   // LBA formats, 4 bytes each, bits 16-23: log2 block size
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t cid;
+    uint32_t nsid;
+    uint64_t reserved;
+    uint64_t mptr;
+    uint64_t prp1;
+    uint64_t prp2;
+    uint32_t cdw10;
+    uint32_t cdw11;
+    uint32_t cdw12;
+    uint32_t cdw13;
+    uint32_t cdw14;
+    uint32_t cdw15;
+} __attribute__((packed)) nvme_cmd_t;
+
+typedef struct {
+    uint32_t result;
+    uint32_t reserved;
+    uint16_t sq_head;
+    uint16_t sq_id;
+    uint16_t cid;
+    volatile uint16_t status;   // Bit 0: phase tag
+} __attribute__((packed)) nvme_cqe_t;
+
+#define NVME_ADMIN_ENTRIES  16
+#define NVME_IO_ENTRIES     64    // Per queue, lowered to what the controller allows
+#define NVME_NSID           1
+
+// Commands in flight per I/O queue. Each slot owns bounce pages and a PRP
+// list page, so one command moves up to NVME_SLOT_PAGES pages.
+#define NVME_MAX_SLOTS      32
+#define NVME_SLOT_PAGES     8
+#define NVME_TIMEOUT_NS     5000000000ULL
+
+// Finds the first NVMe controller and registers namespace 1. Returns the
+// number of disks (0 or 1).
+int nvme_init(void);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <io.h>
+#include <com1.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space offsets
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_CLASS_REVISION 0x08  // class << 24 | subclass << 16 | prog_if << 8 | revision
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR(n)         (0x10 + 4 * (n))
+#define PCI_CAPABILITY_LIST 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_STATUS_CAP_LIST     0x0010
+#define PCI_CAP_VENDOR          0x09
+
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+#define PCI_COMMAND_INTX_OFF    0x0400
+
+#define PCI_BAR_IO          0x1
+#define PCI_BAR_MEM_64      0x4
+
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_SUBCLASS_SATA   0x06
+#define PCI_SUBCLASS_NVM    0x08
+
+#define PCI_MAX_DEVICES     64
+
+typedef struct {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint8_t irq_line;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+} pci_device_t;
+
+// Scans every bus once and remembers the functions it finds
+void pci_init(void);
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset);
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset);
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value);
+
+// Finds the index-th function of a class. Returns 0 and fills *out if found.
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t* out);
+int pci_find_device(uint16_t vendor, uint16_t device, int index, pci_device_t* out);
+
+// Config space offset of a capability, 0 if there is none (or no more)
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t cap_id, uint8_t prev);
+
+// Address decoded by a BAR (I/O port or physical memory), 0 if unused
+uint64_t pci_bar_address(const pci_device_t* dev, int bar);
+void pci_enable_bus_master(const pci_device_t* dev);
+
+#endif
@@ -6,5 +6,6 @@
 
 void pit_init(uint32_t frequency);
 uint64_t pit_handler(uint64_t current_rsp);
+uint64_t pit_calibrate_tsc(void);
 
 #endif
\ No newline at end of file
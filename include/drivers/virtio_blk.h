@@ -0,0 +1,123 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <pci.h>
+
+#define VIRTIO_VENDOR           0x1AF4
+#define VIRTIO_DEV_BLK_LEGACY   0x1001  // Transitional, also has the modern interface
+#define VIRTIO_DEV_BLK          0x1042
+
+// Vendor capability (virtio_pci_cap) locating each structure in a BAR
+#define VIRTIO_CAP_CFG_TYPE     3
+#define VIRTIO_CAP_BAR          4
+#define VIRTIO_CAP_OFFSET       8
+#define VIRTIO_CAP_LENGTH       12
+#define VIRTIO_CAP_NOTIFY_MULT  16      // Notify capability only
+
+#define VIRTIO_PCI_CAP_COMMON   1
+#define VIRTIO_PCI_CAP_NOTIFY   2
+#define VIRTIO_PCI_CAP_ISR      3
+#define VIRTIO_PCI_CAP_DEVICE   4
+
+// Common configuration structure
+#define VIRTIO_COMMON_DFSELECT  0x00
+#define VIRTIO_COMMON_DF        0x04
+#define VIRTIO_COMMON_GFSELECT  0x08
+#define VIRTIO_COMMON_GF        0x0C
+#define VIRTIO_COMMON_MSIX      0x10
+#define VIRTIO_COMMON_STATUS    0x14
+#define VIRTIO_COMMON_Q_SELECT  0x16
+#define VIRTIO_COMMON_Q_SIZE    0x18
+#define VIRTIO_COMMON_Q_MSIX    0x1A
+#define VIRTIO_COMMON_Q_ENABLE  0x1C
+#define VIRTIO_COMMON_Q_NOFF    0x1E
+#define VIRTIO_COMMON_Q_DESC    0x20
+#define VIRTIO_COMMON_Q_AVAIL   0x28
+#define VIRTIO_COMMON_Q_USED    0x30
+
+#define VIRTIO_MSI_NO_VECTOR    0xFFFF
+
+#define VIRTIO_STATUS_ACK       0x01
+#define VIRTIO_STATUS_DRIVER    0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED    0x80
+
+#define VIRTIO_ISR_QUEUE        0x01
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX    2
+#define VIRTIO_BLK_F_RO         5
+#define VIRTIO_BLK_F_FLUSH      9
+#define VIRTIO_F_INDIRECT_DESC  28
+#define VIRTIO_F_EVENT_IDX      29
+#define VIRTIO_F_VERSION_1      32
+
+// Device configuration
+#define VIRTIO_BLK_CFG_CAPACITY 0x00    // 512-byte sectors
+#define VIRTIO_BLK_CFG_SEG_MAX  0x0C
+
+#define VIRTIO_BLK_T_IN         0
+#define VIRTIO_BLK_T_OUT        1
+#define VIRTIO_BLK_T_FLUSH      4
+#define VIRTIO_BLK_S_OK         0
+
+/* Split virtqueue */
+
+#define VIRTQ_DESC_F_NEXT       1
+#define VIRTQ_DESC_F_WRITE      2       // Device writes the buffer
+#define VIRTQ_DESC_F_INDIRECT   4
+
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+#define VIRTQ_USED_F_NO_NOTIFY  1
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed)) virtq_desc_t;
+
+typedef struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];            // Followed by used_event with EVENT_IDX
+} __attribute__((packed)) virtq_avail_t;
+
+typedef struct {
+    uint32_t id;                // Head descriptor of the finished chain
+    uint32_t len;
+} __attribute__((packed)) virtq_used_elem_t;
+
+typedef struct {
+    volatile uint16_t flags;
+    volatile uint16_t idx;
+    virtq_used_elem_t ring[];   // Followed by avail_event with EVENT_IDX
+} __attribute__((packed)) virtq_used_t;
+
+// Request header, the first buffer of every request
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed)) virtio_blk_req_t;
+
+// The whole ring (size 128 at most) fits in one page: descriptors first,
+// then the available ring, then the used ring
+#define VIRTQ_MAX_SIZE          128
+#define VIRTQ_AVAIL_OFFSET      2048
+#define VIRTQ_USED_OFFSET       2560
+
+// Requests in flight. Each request slot has a bounce page per data segment,
+// so a request moves up to VIRTIO_BLK_SEGS pages through one descriptor.
+#define VIRTIO_BLK_MAX_REQS     32
+#define VIRTIO_BLK_SEGS         8
+#define VIRTIO_BLK_META_SIZE    256     // Header, status and indirect table per slot
+#define VIRTIO_BLK_TIMEOUT_NS   5000000000ULL
+#define VIRTIO_BLK_MAX_DEVS     4
+
+// Finds virtio block devices and registers them. Returns how many.
+int virtio_blk_init(void);
+
+#endif
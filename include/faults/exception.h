@@ -4,11 +4,12 @@
 #include <stdint.h>
 #include <com1.h>
 #include <pagefault.h>
+#include <uaccess.h>
 
 #define ERR_VECTOR_GPF 13
 #define ERR_VECTOR_PAGEFAULT 14
 
-void exception_handler(uint64_t vector, uint64_t error, uint64_t rip);
+void exception_handler(uint64_t vector, uint64_t error, uint64_t* rip_ptr);
 
 #endif
 
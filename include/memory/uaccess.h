@@ -0,0 +1,27 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+// Lowest non-canonical address; user pointers must end below it
+#define USER_SPACE_END 0x0000800000000000ULL
+
+// All return 0 on success or -EFAULT if any byte of the user range is
+// outside user space or unmapped. Faults are caught through the exception
+// table, so bad pointers never crash the kernel.
+int copy_to_user(void* user_dst, const void* src, size_t size);
+int copy_from_user(void* dst, const void* user_src, size_t size);
+
+// Returns the string length (without the NUL), -EFAULT, or -ENAMETOOLONG if
+// no NUL was found within max bytes. dst is always NUL terminated.
+int64_t strncpy_from_user(char* dst, const char* user_src, size_t max);
+
+int access_ok(const void* user_ptr, size_t size);
+
+// Called by the page fault handler. Redirects *rip to the fixup and
+// returns 1 if the faulting instruction is a registered user access.
+int uaccess_fixup(uint64_t* rip);
+
+#endif
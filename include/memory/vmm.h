@@ -29,6 +29,11 @@
 
 #define PAGE_ALIGN_MASK 0x000FFFFFFFFFF000ULL
 
+// Device registers are mapped uncached below the kernel image. The window
+// shares the kernel image's PML4 entry, which every process copies.
+#define VMM_MMIO_BASE 0xFFFFFFFF00000000ULL
+#define VMM_MMIO_SIZE 0x40000000ULL
+
 uint64_t read_cr3(void);
 void write_cr3(uint64_t val);
 uint64_t* vmm_create_pml4(void);
@@ -37,6 +42,7 @@ void vmm_map_page(uint64_t* pml4, uint64_t virt, uint64_t phys, uint64_t flags);
 void vmm_unmap_page(uint64_t* pml4, uint64_t virt);
 
 uint64_t vmm_get_mapping(uint64_t* pml4, uint64_t virt);
+void* vmm_map_mmio(uint64_t phys, size_t size);
 void vmm_switch_pml4(uint64_t* pml4);
 uint64_t* vmm_create_process_pml4(uint64_t* master_kernel_pml4);
 
@@ -0,0 +1,70 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <fatfs/ff.h>
+#include <kheap.h>
+#include <kstring.h>
+#include <wait.h>
+
+#define MAX_FDS        32
+#define FD_FIRST_FREE  3     // 0-2 are left for stdin/stdout/stderr
+
+#define FILE_TYPE_FILE 1
+#define FILE_TYPE_DIR  2
+#define FILE_TYPE_PIPE 3
+
+// Open flags, must match userspace/openidp.h
+#define O_RDONLY  0x0
+#define O_WRONLY  0x1
+#define O_RDWR    0x2
+#define O_ACCMODE 0x3
+#define O_CREAT   0x40
+#define O_TRUNC   0x200
+#define O_APPEND  0x400
+#define O_DIRECTORY 0x10000
+
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+// An open file. Shared by every descriptor that refers to it.
+typedef struct file {
+    int type;
+    uint32_t refs;
+    uint32_t flags;
+
+    // Serializes the threads sharing this file around the FatFs object,
+    // whose volume lock is dropped while file data is read
+    mutex_t lock;
+
+    union {
+        FIL fil;    // FILE_TYPE_FILE
+        DIR dir;    // FILE_TYPE_DIR
+        struct pipe* pipe; // FILE_TYPE_PIPE, O_RDONLY or O_WRONLY end
+    };
+
+    // Directory cursor: an entry already read from disk that did not fit
+    // into the caller's buffer, returned first by the next getdents
+    FILINFO pending;
+    int has_pending;
+} file_t;
+
+// Descriptor table, shared by the threads of a process
+typedef struct {
+    uint32_t users;
+    file_t* fds[MAX_FDS];
+} fd_table_t;
+
+fd_table_t* fd_table_create(void);
+void fd_table_put(fd_table_t* table);
+
+int fd_install(fd_table_t* table, file_t* file);
+file_t* fd_get(fd_table_t* table, int fd);
+int fd_close(fd_table_t* table, int fd);
+
+file_t* file_open(const char* path, uint32_t flags, int* err);
+void file_put(file_t* file);
+
+#endif
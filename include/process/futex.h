@@ -0,0 +1,14 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+#include <task.h>
+
+// Futexes are keyed by physical address, so threads of one process and
+// processes sharing memory (sys_share_mem) can wait on the same word.
+#define FUTEX_HASH_BUCKETS 64
+
+int futex_wait(uint64_t uaddr, uint32_t expected);
+int futex_wake(uint64_t uaddr, uint32_t count);
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef KDATA_H
+#define KDATA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <com1.h>
+#include <kstring.h>
+
+// Read-only pages the kernel maps into every process (vDSO style).
+// The time page is shared by all processes, the process page is private.
+#define USER_KDATA_BASE    0x600000000ULL
+#define USER_KDATA_TIME    (USER_KDATA_BASE)
+#define USER_KDATA_PROC    (USER_KDATA_BASE + PAGE_SIZE)
+
+#define KDATA_TSC_SHIFT    32
+
+// Layout must match userspace/openidp.h
+// Readers retry while seq is odd or changed during the read (seqlock).
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t tick_hz;
+
+    uint64_t tsc_hz;
+    uint64_t tsc_mult;   // ns = (tsc_delta * tsc_mult) >> KDATA_TSC_SHIFT
+
+    uint64_t tsc_base;   // TSC value sampled at the last tick
+    uint64_t ns_base;    // Monotonic nanoseconds at tsc_base
+    uint64_t ticks;      // PIT ticks since boot
+} kdata_time_t;
+
+typedef struct {
+    uint64_t pid;
+} kdata_proc_t;
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void kdata_init(uint32_t tick_hz);
+void kdata_tick(void);
+
+uint64_t kdata_tsc_hz(void);
+uint64_t kdata_tsc_to_ns(uint64_t tsc_delta);
+uint64_t kdata_ticks(void);
+uint32_t kdata_tick_hz(void);
+
+kdata_proc_t* kdata_map_process(uint64_t* pml4_virt, uint64_t pid);
+void kdata_unmap_process(uint64_t* pml4_virt, kdata_proc_t* proc_page);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include <stdint.h>
+#include <task.h>
+#include <file.h>
+
+// Byte stream between processes, backed by contiguous pages. Readers sleep
+// while it is empty and writers while it is full; each side wakes the other
+// after moving data. Reads return 0 once every write end is closed, writes
+// fail with -EPIPE once every read end is.
+#define PIPE_PAGES 4
+#define PIPE_SIZE  (PIPE_PAGES * PAGE_SIZE)
+
+typedef struct pipe {
+    uint8_t* buf;             // HHDM address of the pages
+    uint32_t head;            // Bytes ever written
+    uint32_t tail;            // Bytes ever read
+    uint32_t readers;         // Open read ends
+    uint32_t writers;         // Open write ends
+    wait_queue_t read_wq;     // Readers waiting for data
+    wait_queue_t write_wq;    // Writers waiting for room
+} pipe_t;
+
+int pipe_create(file_t** read_end, file_t** write_end);
+void pipe_release(pipe_t* pipe, int write_end);
+
+int64_t pipe_read(pipe_t* pipe, void* user_buf, uint64_t len);
+int64_t pipe_write(pipe_t* pipe, const void* user_buf, uint64_t len);
+
+static inline uint32_t pipe_bytes(pipe_t* pipe) {
+    return pipe->head - pipe->tail;
+}
+
+#endif
@@ -10,11 +10,34 @@
 #include <kelf.h>
 #include <fatfs/ff.h>
 #include <graphics.h>
+#include <kdata.h>
+#include <file.h>
+#include <wait.h>
 
 #define USER_STACK_SIZE (16 * 1024 * 1024)  // 16MB
 #define USER_STACK_TOP 0x700000000  // Start of user stack region
 #define USER_FB_BASE 0x800000000ULL
 
+#define KERNEL_STACK_SIZE (4096 * 4)
+
+// argv is copied onto the top page of the new user stack
+#define EXEC_MAX_ARGS      32
+#define EXEC_MAX_ARGS_SIZE 2048
+
+// Extra thread stacks are carved out below the main stack, each one
+// separated from the next by an unmapped guard page
+#define THREAD_STACK_SIZE (256 * 1024)
+#define THREAD_STACK_GAP  4096
+#define THREAD_STACK_TOP  (USER_STACK_TOP - USER_STACK_SIZE - THREAD_STACK_GAP)
+
+// Pages shared with another process or the kernel (channels, sys_share_mem,
+// rings) are mapped in a window of their own above the framebuffer, apart
+// from the heap the break grows
+#define USER_SHARE_BASE 0x1000000000ULL
+#define USER_SHARE_SIZE 0x1000000000ULL  // 64GiB
+
+#define MSR_FS_BASE 0xC0000100
+
 #define PTE_PRESENT 1
 #define PAGE_ADDR_MASK 0x000FFFFFFFFFF000
 #define HH_START 0xFFFF800000000000
@@ -39,34 +62,154 @@ typedef struct {
     uint64_t data3;
 } message_t;
 
+#define TASK_NAME_LEN 32
+
+// PIDs encode a table slot in the low bits and the slot's reuse generation
+// above it, so a stale PID never resolves to a newer task in the same slot.
+#define PID_SLOT_BITS 10
+#define MAX_TASKS     (1 << PID_SLOT_BITS)
+#define PID_SLOT(pid) ((pid) & (MAX_TASKS - 1))
+
+typedef enum {
+    TASK_RUNNING = 0,
+    TASK_BLOCKED,
+    TASK_ZOMBIE
+} task_state_t;
+
+// Stack of an exited thread, left mapped for the next thread of the process
+typedef struct free_stack {
+    uint64_t top;
+    struct free_stack* next;
+} free_stack_t;
+
+// Unmapped range of the shared mapping window, kept sorted by address
+typedef struct share_range {
+    uint64_t base;
+    uint64_t size;
+    struct share_range* next;
+} share_range_t;
+
+// Memory state shared by all threads of a process
+typedef struct address_space {
+    uint64_t cr3;
+    uint64_t program_break;
+    uint64_t thread_stack_next;  // Top of the next unused thread stack
+    free_stack_t* free_stacks;   // Handed out before carving a new one
+    uint64_t share_next;         // Start of the never used part of the share window
+    share_range_t* share_free;   // Unmapped ranges below share_next
+    uint64_t users;              // Number of tasks running in this space
+    kdata_proc_t* kdata_page;    // Read-only per-process page (pid etc.)
+} address_space_t;
+
+struct task;
+struct io_ring;
+struct trace_stats;
+
 typedef struct task {
     uint64_t  rsp;          
     uint64_t  cr3;
     uint64_t  pid;
     uint64_t  kernel_stack;
     struct task* next;      
+    struct task* prev;
+
+    task_state_t state;
+    char name[TASK_NAME_LEN];
+
+    // CPU accounting (TSC cycles)
+    uint64_t runtime_tsc;
+    uint64_t switched_in_tsc;
+    uint64_t nr_voluntary;   // Switches away because the task gave up the CPU
+    uint64_t nr_involuntary; // Switches away because the timeslice ran out
 
     uint64_t is_wm;
-    uint64_t program_break;
+
+    address_space_t* mm;     // NULL for kernel tasks
+    uint64_t tgid;           // PID of the process this thread belongs to
+    uint64_t fs_base;        // User TLS pointer
+    uint64_t thread_stack;   // Top of the create_user_thread stack, 0 for main threads
+
+    struct task* wait_next;  // Link while sleeping on a wait queue
+    uint64_t futex_key;      // Physical address waited on in futex_wait
+
+    // Timed wakeups (timer.c)
+    uint64_t wake_tick;
+    struct task* timer_next;
+    int timer_armed;
+
+    // Process tree. Tasks without a parent are freed as soon as they exit,
+    // the others stay zombies holding exit_code until task_waitpid().
+    struct task* parent;
+    struct task* children;
+    struct task* sibling;
+    wait_queue_t child_exit;   // Parent sleeps here in task_waitpid()
+    int exit_code;
+    int released;              // Freed by the reaper, only the struct is left
+
+    fd_table_t* files;         // Open files, shared with sibling threads
+    struct io_ring* ring;      // Submission/completion rings (sys_ring.c)
+    struct trace_stats* trace; // Syscall counters, allocated on first traced call
 
     message_t msgs[MSG_QUEUE_SIZE];
     int msg_head;
     int msg_tail;
     int msg_count;
     int waiting_for_msg;
+    uint64_t doorbells;        // Rung channels, one bit per channel id (sys_channel.c)
+    wait_queue_t event_wq;     // Sleeps here for messages or a deadline
+    int key_waiting;           // Sleeps on the keyboard queue instead, see ipc_notify()
+
+    // Synchronous call/reply (sys_ipc_call / sys_ipc_reply_wait)
+    wait_queue_t ipc_reply_wq; // Callers sleep here until this task replies
+    uint64_t ipc_call_to;      // PID the task is blocked calling, 0 if none
+    message_t ipc_reply;
+    int ipc_replied;
 } task_t;
 
 void scheduler_init(void);
 uint64_t scheduler_schedule(uint64_t current_rsp);
+uint64_t scheduler_yield_handler(uint64_t current_rsp);
+void scheduler_yield(void);
+void scheduler_hand_off(task_t* task);
+
+void wait_queue_sleep(wait_queue_t* wq);
+int wait_queue_sleep_until(wait_queue_t* wq, uint64_t wake_tick);
+task_t* wait_queue_wake_one(wait_queue_t* wq);
+int wait_queue_wake_task(wait_queue_t* wq, task_t* task);
+int wait_queue_wake_all(wait_queue_t* wq);
+void task_wake(task_t* task);
+
+void mutex_lock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
 
-void create_kernel_task(void (*entry_point)());
+task_t* create_kernel_task(void (*entry_point)());
 int create_user_process_from_file(const char* filename, int argc, char** argv, int is_wm);
-void task_exit(void);
+int create_user_thread(uint64_t entry, uint64_t arg, uint64_t tls);
+uint64_t share_va_alloc(address_space_t* mm, uint64_t size);
+void share_va_free(address_space_t* mm, uint64_t base, uint64_t size);
+void task_exit(int code);
+int task_waitpid(int64_t pid, int* exit_code_out);
 
 int sys_ipc_send(int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3);
 int sys_ipc_recv(message_t* out_msg);
+int sys_ipc_call(int dest_pid, message_t* user_msg);
+int sys_ipc_reply_wait(int reply_pid, message_t* user_msg);
+void ipc_notify(task_t* task);
+int ipc_peek_message(task_t* task, message_t* out);
+void ipc_pop_message(task_t* task);
+
+typedef struct {
+    uint64_t pid;
+    char name[TASK_NAME_LEN];
+    uint32_t state;
+    uint32_t is_current;
+    uint64_t runtime_ns;
+    uint64_t nr_voluntary;
+    uint64_t nr_involuntary;
+} task_stats_t;
+
+int task_collect_stats(task_stats_t* out, uint64_t max);
 
-void copy_to_user_mem(uint64_t* user_pml4, uint64_t vaddr, void* data, uint64_t size);
 task_t* get_task_by_pid(uint64_t pid);
 
 #endif
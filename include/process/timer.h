@@ -0,0 +1,15 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+#include <task.h>
+
+// Tick-granularity wakeups, driven by the PIT. A task is armed at most once.
+void timer_tick(void);
+void timer_arm(task_t* task, uint64_t wake_tick);
+void timer_cancel(task_t* task);
+
+uint64_t timer_ns_to_ticks(uint64_t ns);
+void timer_sleep_ticks(uint64_t ticks);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+struct task;
+
+// Intrusive FIFO of blocked tasks, linked through task->wait_next
+typedef struct {
+    struct task* head;
+    struct task* tail;
+} wait_queue_t;
+
+// Sleeping lock for code that may block while holding it (disk I/O)
+typedef struct {
+    int locked;
+    wait_queue_t wq;
+} mutex_t;
+
+#endif
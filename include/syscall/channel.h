@@ -0,0 +1,51 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stdint.h>
+#include <task.h>
+
+// Message channels between two processes. A channel is one block of pages
+// mapped into both endpoints: a header page holding a chan_ring_t per
+// direction, followed by the two data areas. Messages are length-prefixed
+// and copied by userspace; the kernel only sets the memory up and rings
+// doorbells, which arrive as MSG_CHAN_DOORBELL messages (data1 = channel id)
+// ahead of the regular message queue so they are never dropped.
+// Layout must match userspace/libc/chan.h
+
+#define CHAN_MAX          64                 // One doorbell bit per channel
+#define CHAN_MIN_DATA     PAGE_SIZE          // Per direction
+#define CHAN_MAX_DATA     (64 * PAGE_SIZE)
+
+#define MSG_CHAN_DOORBELL 700
+
+typedef struct {
+    volatile uint32_t head;   // Written by the producer
+    volatile uint32_t tail;   // Written by the consumer
+    uint32_t size;            // Data bytes, a power of two
+    uint32_t data_off;        // Offset of the data area from the channel base
+    volatile uint32_t closed; // Set by the kernel when the producer goes away
+    volatile uint32_t waiting; // Producer sleeps for room, the consumer rings it
+    uint32_t reserved[10];
+} chan_ring_t;
+
+// What each endpoint learns from sys_chan_create / sys_chan_accept
+typedef struct chan_info {
+    uint64_t id;
+    uint64_t base;            // User address of the header page
+    uint64_t peer_pid;
+    uint32_t tx;              // Index of the ring this endpoint produces into
+    uint32_t size;            // Data bytes per direction
+} chan_info_t;
+
+typedef struct {
+    int used;
+    uint64_t pids[2];         // Process IDs, 0 once that side has closed
+    uint64_t user_base[2];
+    void* pages;              // HHDM address of the channel pages
+    uint64_t nr_pages;
+} channel_t;
+
+uint64_t chan_peer_pid(uint64_t id, uint64_t pid);
+void chan_task_exit(task_t* task);
+
+#endif
@@ -7,6 +7,9 @@
 #include <kstring.h>
 #include <graphics.h>
 #include <keyboard.h>
+#include <uaccess.h>
+#include <trace.h>
+#include <bcache.h>
 
 // Syscall Numbers
 #define SYS_WRITE 0
@@ -22,6 +25,37 @@
 #define SYS_UNMAP 14
 #define SYS_STAT 15
 #define SYS_DIR_READ 16
+#define SYS_TASK_STATS 17
+#define SYS_THREAD_CREATE 18
+#define SYS_FUTEX_WAIT 19
+#define SYS_FUTEX_WAKE 20
+#define SYS_WAITPID 21
+#define SYS_RING_SETUP 22
+#define SYS_RING_ENTER 23
+#define SYS_TRACE_CTL 24
+#define SYS_TRACE_READ 25
+#define SYS_OPEN 26
+#define SYS_READ 27
+#define SYS_PREAD 28
+#define SYS_SEEK 29
+#define SYS_CLOSE 30
+#define SYS_GETDENTS 31
+#define SYS_LOG_READ 32
+#define SYS_CHAN_CREATE 33
+#define SYS_CHAN_ACCEPT 34
+#define SYS_CHAN_NOTIFY 35
+#define SYS_CHAN_CLOSE 36
+#define SYS_PIPE 37
+#define SYS_EXEC_FDS 38
+#define SYS_FD_WRITE 39
+#define SYS_FSTAT 40
+#define SYS_IPC_CALL 41
+#define SYS_IPC_REPLY_WAIT 42
+#define SYS_WAIT_EVENTS 43
+#define SYS_BLOCK_STATS 44
+
+// Longest path (including the NUL) accepted from userspace
+#define SYSCALL_PATH_MAX 256
 
 void syscall_init(void);
 uint64_t syscall_dispatcher(registers_t* regs);
@@ -32,6 +66,9 @@ struct kstat {
     uint32_t flags; // 1 = Directory, 0 = File
 };
 
+#define KSTAT_DIR  1
+#define KSTAT_PIPE 2   // Only reported by sys_fstat
+
 struct kdirent {
     char name[128];   
     uint64_t size;    
@@ -42,6 +79,16 @@ int64_t sys_file_read(const char* path, void* user_buf, uint64_t max_len);
 int sys_stat(const char* user_path, struct kstat* user_stat_out);
 int sys_read_dir_entry(const char* path, uint64_t index, struct kdirent* user_out);
 
+int sys_open(const char* user_path, uint32_t flags);
+int64_t sys_read(int fd, void* user_buf, uint64_t len);
+int64_t sys_fd_write(int fd, const void* user_buf, uint64_t len);
+int sys_fstat(int fd, struct kstat* user_stat_out);
+int sys_pipe(int* user_fds);
+int64_t sys_pread(int fd, void* user_buf, uint64_t len, uint64_t offset);
+int64_t sys_seek(int fd, int64_t offset, int whence);
+int sys_close(int fd);
+int64_t sys_getdents(int fd, struct kdirent* user_buf, uint64_t size);
+
 /* Framebuffer syscalls */
 struct fb_info {
     uint64_t fb_addr;
@@ -56,6 +103,16 @@ int sys_get_fb_info(struct fb_info* user_out);
 /* I/O syscalls */
 void sys_write(int fd, const char* buf);
 uint64_t sys_read_key();
+int64_t sys_log_read(char* user_buf, uint64_t len);
+int sys_block_stats(bcache_stats_t* user_out);
+
+// sys_wait_events mask bits, must match userspace/openidp.h
+#define EVENT_IPC   0x1   // A message or doorbell is queued
+#define EVENT_KEY   0x2   // sys_read_key has input
+#define EVENT_TIMER 0x4   // timeout_ns has passed
+#define EVENT_ALL   (EVENT_IPC | EVENT_KEY | EVENT_TIMER)
+
+int64_t sys_wait_events(uint32_t mask, uint64_t timeout_ns);
 
 /* Memory syscalls */
 void* sys_sbrk(intptr_t inc);
@@ -64,8 +121,31 @@ int sys_unmap(void* vaddr_ptr, size_t size);
 
 /* Process/task syscalls */
 int sys_exec(const char* path, int argc, char** argv);
+int sys_exec_fds(const char* path, int argc, char** argv, const int* fd_map);
 void sys_exit(int code);
+int sys_waitpid(int pid, int* status_out);
 int sys_ipc_send(int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3);
 int sys_ipc_recv(message_t* out_msg);
+int sys_task_stats(task_stats_t* user_out, uint64_t max);
+
+/* Ring syscalls */
+uint64_t sys_ring_setup(void);
+int sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags);
+
+/* Channel syscalls */
+struct chan_info;
+int64_t sys_chan_create(int peer_pid, uint64_t size, struct chan_info* user_info);
+int64_t sys_chan_accept(uint64_t id, struct chan_info* user_info);
+int64_t sys_chan_notify(uint64_t id);
+int64_t sys_chan_close(uint64_t id);
+
+/* Trace syscalls */
+int sys_trace_ctl(uint64_t cmd, uint64_t arg0, uint64_t arg1);
+int sys_trace_read(trace_record_t* user_out, uint64_t max, uint64_t timeout_ms);
+
+/* Thread syscalls */
+int sys_thread_create(uint64_t entry, uint64_t arg, uint64_t tls);
+int sys_futex_wait(uint32_t* uaddr, uint32_t expected);
+int sys_futex_wake(uint32_t* uaddr, uint32_t count);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <task.h>
+
+// Submission/completion rings shared with userspace (io_uring style).
+// Userspace produces SQEs at sq_tail, the kernel consumes them at sq_head
+// and posts CQEs at cq_tail for userspace to consume at cq_head.
+// Layout must match userspace/libc/ring.h
+
+#define RING_SQ_ENTRIES 32
+#define RING_CQ_ENTRIES 64
+#define RING_PAGES      2
+#define RING_MAX_PENDING 32
+
+#define RING_OP_NOP       0
+#define RING_OP_IPC_SEND  1  // arg0=dest_pid, arg1=type, arg2..arg4=data1..data3
+#define RING_OP_IPC_RECV  2  // completes when a message arrives, message in cqe->msg
+#define RING_OP_FILE_READ 3  // arg0=path, arg1=buf, arg2=max_len
+#define RING_OP_STAT      4  // arg0=path, arg1=struct kstat*
+#define RING_OP_DIR_READ  5  // arg0=path, arg1=index, arg2=struct kdirent*
+#define RING_OP_SLEEP     6  // arg0=nanoseconds
+
+#define RING_CQE_MSG      (1 << 0)  // cqe->msg holds a message
+
+#define RING_ENTER_WAIT   (1 << 0)  // Block until min_complete completions
+
+typedef struct {
+    uint32_t opcode;
+    uint32_t flags;
+    uint64_t user_data;   // Copied to the matching CQE
+    uint64_t arg[5];
+    uint64_t reserved;
+} ring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t res;
+    uint32_t flags;
+    uint32_t reserved;
+    message_t msg;
+    uint64_t pad;
+} ring_cqe_t;
+
+typedef struct {
+    volatile uint32_t sq_head;  // Written by the kernel
+    volatile uint32_t sq_tail;  // Written by userspace
+    uint32_t sq_entries;
+    uint32_t sq_off;            // Offset of the SQE array from the ring base
+
+    volatile uint32_t cq_head;  // Written by userspace
+    volatile uint32_t cq_tail;  // Written by the kernel
+    uint32_t cq_entries;
+    uint32_t cq_off;
+
+    uint32_t nr_pending;        // Submitted but not yet completed
+    uint32_t reserved[7];
+} ring_hdr_t;
+
+typedef struct {
+    ring_sqe_t sqe;
+    uint64_t wake_tick;         // RING_OP_SLEEP deadline
+} ring_pending_t;
+
+typedef struct io_ring {
+    uint64_t user_base;
+    void* pages;                // HHDM address of the RING_PAGES pages
+
+    ring_hdr_t* hdr;
+    ring_sqe_t* sq;
+    ring_cqe_t* cq;
+
+    ring_pending_t pending[RING_MAX_PENDING];
+    uint32_t nr_pending;
+
+    wait_queue_t wq;            // Owner sleeps here in ring_enter()
+} io_ring_t;
+
+void ring_destroy(task_t* task);
+void ring_notify(task_t* task);
+
+#endif
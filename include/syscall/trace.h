@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <task.h>
+
+// Syscall tracing. TRACE_STATS keeps per-task counters and log2 latency
+// histograms, TRACE_LOG streams one record per syscall into a ring that
+// SYS_TRACE_READ drains. Both are off by default and cost one branch then.
+// Layouts must match userspace/openidp.h
+
+#define TRACE_STATS (1 << 0)
+#define TRACE_LOG   (1 << 1)
+
+#define TRACE_MAX_SYSCALLS  64
+#define TRACE_HIST_BUCKETS  32    // Bucket n counts latencies in [2^n, 2^(n+1)) ns
+#define TRACE_RING_SIZE     1024
+
+// SYS_TRACE_CTL commands
+#define TRACE_CTL_SET_FLAGS 0   // arg0 = TRACE_* flags, returns the old flags
+#define TRACE_CTL_SET_PID   1   // arg0 = only log this pid (0 = all)
+#define TRACE_CTL_GET_STATS 2   // arg0 = pid (0 = system wide), arg1 = trace_stats_t*
+#define TRACE_CTL_RESET     3   // Clears all counters and the log
+#define TRACE_CTL_DROPPED   4   // Returns how many records a full log dropped
+#define TRACE_CTL_ON_EXEC   5   // arg0 = TRACE_* flags to turn on for the caller's next child (0 = disarm)
+
+typedef struct trace_stats {
+    uint64_t count[TRACE_MAX_SYSCALLS];
+    uint64_t total_ns[TRACE_MAX_SYSCALLS];
+    uint64_t max_ns[TRACE_MAX_SYSCALLS];
+    uint32_t hist[TRACE_MAX_SYSCALLS][TRACE_HIST_BUCKETS];
+} trace_stats_t;
+
+typedef struct {
+    uint64_t timestamp_ns;  // Monotonic time at syscall entry
+    uint64_t duration_ns;
+    uint32_t pid;
+    uint32_t nr;
+    uint64_t args[3];       // RDI, RSI, RDX
+    int64_t ret;
+    uint64_t reserved;
+} trace_record_t;
+
+extern uint32_t trace_flags;
+
+void trace_syscall(registers_t* regs, uint64_t nr, uint64_t ret, uint64_t tsc_start, uint64_t tsc_end);
+void trace_task_free(task_t* task);
+void trace_exec(task_t* parent, uint64_t child_pid);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef ERRNO_H
+#define ERRNO_H
+
+// Kernel error numbers, returned negated (-EFAULT) from syscalls.
+// Values follow Linux so they read familiarly in traces.
+#define ENOENT        2
+#define EBADF         9
+#define ECHILD       10
+#define EAGAIN       11
+#define ENOMEM       12
+#define EFAULT       14
+#define EBUSY        16
+#define EINVAL       22
+#define EMFILE       24
+#define EPIPE        32
+#define ENAMETOOLONG 36
+#define ENOSYS       38
+
+#endif
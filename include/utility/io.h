@@ -9,4 +9,10 @@ uint8_t inb(uint16_t port);
 void outw(uint16_t port, uint16_t value);
 uint16_t inw(uint16_t port);
 
+void outl(uint16_t port, uint32_t value);
+uint32_t inl(uint16_t port);
+
+void insw(uint16_t port, void* buf, uint64_t count);
+void outsw(uint16_t port, const void* buf, uint64_t count);
+
 #endif
\ No newline at end of file
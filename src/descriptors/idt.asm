@@ -4,27 +4,15 @@ global irq_stub_32
 
 %macro isr_err_stub 1
 isr_stub_%+%1:
-    cli
-    mov rdi, %1            ; vector
-    mov rsi, [rsp]         ; error code
-    mov rdx, [rsp+8]       ; RIP
-    extern exception_handler
-    call exception_handler
-    add rsp, 8             ; pop error code
-    iretq
+    push %1                ; vector (CPU already pushed the error code)
+    jmp isr_common
 %endmacro
 
 %macro isr_no_err_stub 1
 isr_stub_%+%1:
-    cli
     push 0                 ; fake error code to unify layout
-    mov rdi, %1            ; vector
-    mov rsi, [rsp]         ; error code (0)
-    mov rdx, [rsp+8]       ; RIP
-    extern exception_handler
-    call exception_handler
-    add rsp, 8             ; pop fake error
-    iretq
+    push %1                ; vector
+    jmp isr_common
 %endmacro
 
 %macro irq_stub 1
@@ -82,6 +70,40 @@ irq_stub_%+%1:
 
 section .text
     extern exception_handler
+
+; Shared exception path. Scratch registers are saved so a fault that the
+; handler recovers from (uaccess fixups) can resume the interrupted code.
+isr_common:
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    mov rdi, [rsp+72]      ; vector
+    mov rsi, [rsp+80]      ; error code
+    lea rdx, [rsp+88]      ; pointer to the saved RIP, handlers may redirect it
+
+    cld
+    call exception_handler
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    add rsp, 16            ; pop vector and error code
+    iretq
+
     isr_no_err_stub 0
     isr_no_err_stub 1
     isr_no_err_stub 2
@@ -197,6 +219,53 @@ syscall_stub:
     ; 6. Return to user space
     iretq
 
+extern scheduler_yield_handler
+
+; Software interrupt used by the kernel to give up the CPU (scheduler_yield).
+; Same frame as irq_stub, but no PIC to acknowledge.
+global yield_stub
+yield_stub:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    mov rdi, rsp         ; Argument 1: Current Stack Pointer
+
+    cld
+    call scheduler_yield_handler
+
+    mov rsp, rax         ; Switch to the next task's stack
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+
+    iretq
+
 section .data
     global isr_stub_table
     isr_stub_table:
@@ -5,6 +5,7 @@ idt_entry_t idt[IDT_MAX_DESCRIPTORS];
 idtr_t idtr;
 
 static bool vectors[IDT_MAX_DESCRIPTORS];
+static irq_handler_t irq_handlers[IRQ_COUNT][IRQ_MAX_SHARED];
 extern void* isr_stub_table[];
 
 void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags);
@@ -31,6 +32,8 @@ void idt_init() {
     lidt(&idtr);
 
     pic_enable_irq(0); // PIT
+    irq_register(IRQ_COM1 - ISR_COUNT, serial_irq_handler);
+    serial_enable_irq();
 
     sti();
     serial_printf("IDT initialized.\n");
@@ -48,17 +51,33 @@ void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags) {
     descriptor->reserved       = 0;
 }
 
+int irq_register(uint8_t irq, irq_handler_t handler) {
+    if (irq >= IRQ_COUNT) return -1;
+
+    for (int i = 0; i < IRQ_MAX_SHARED; i++) {
+        if (irq_handlers[irq][i]) continue;
+
+        irq_handlers[irq][i] = handler;
+        pic_enable_irq(irq);
+        return 0;
+    }
+    return -1;
+}
+
 uint64_t irq_handler(uint64_t irq, uint64_t current_rsp) {
     uint64_t new_rsp = current_rsp;
 
     if (irq == IRQ_PIT) { 
         new_rsp = pit_handler(current_rsp);
-    } else if (irq == IRQ_KEYBOARD) {
-        keyboard_handler();
+    } else if (irq < ISR_COUNT + IRQ_COUNT) {
+        irq_handler_t* handlers = irq_handlers[irq - ISR_COUNT];
+        for (int i = 0; i < IRQ_MAX_SHARED && handlers[i]; i++) {
+            handlers[i]();
+        }
     }
     
-    // Acknowledge PIC
-    if (irq >= 8) outb(0xA0, 0x20);
+    // Acknowledge PIC (the slave handles lines 8-15)
+    if (irq >= ISR_COUNT + 8) outb(0xA0, 0x20);
     outb(0x20, 0x20);
 
     return new_rsp; // Goes into RAX and idt.asm puts it in RSP
@@ -77,5 +96,6 @@ static void setup_irqs() {
         vectors[ISR_COUNT + i] = true;
     }
 
-    idt_set_descriptor(0x80, syscall_stub, IDT_USER_INTERRUPT);
+    idt_set_descriptor(SYSCALL_VECTOR, syscall_stub, IDT_USER_INTERRUPT);
+    idt_set_descriptor(YIELD_VECTOR, yield_stub, IDT_INTERRUPT_GATE);
 }
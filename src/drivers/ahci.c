@@ -0,0 +1,552 @@
+#include <stdint.h>
+#include <io.h>
+#include <com1.h>
+#include <pci.h>
+#include <idt.h>
+#include <vmm.h>
+#include <task.h>
+#include <timer.h>
+#include <kstring.h>
+#include <block.h>
+#include <ahci.h>
+#include <fatfs/ata.h>
+
+// Register polls before giving up on the HBA
+#define AHCI_SPIN_LIMIT 1000000
+
+#define SLOT(n) (1u << (n))
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+// One SATA disk. Slot state changes with interrupts off, from the issuing
+// task or from the completion interrupt.
+typedef struct {
+    block_device_t blk;
+    char name[8];
+    int index;                      // Port number on the HBA
+    volatile uint8_t* regs;
+
+    ahci_cmd_header_t* cmd_list;
+    uint8_t* tables;
+    uint8_t* bounce[AHCI_MAX_SLOTS];
+
+    int ncq;
+    uint32_t nr_slots;              // Slots in use: the NCQ depth, or 1
+
+    uint32_t allocated;             // Slots owned by a request
+    volatile uint32_t issued;       // Slots handed to the HBA and not yet complete
+    volatile uint32_t failed;       // Slots that completed with an error
+    int exclusive;                  // A non-queued command owns the port
+    wait_queue_t done_wq;           // Woken when issued slots complete
+    wait_queue_t slot_wq;           // Woken when slots are released
+} ahci_port_t;
+
+static volatile uint8_t* abar = NULL;
+static uint32_t hba_cap;
+static int irq_ok = 0;
+
+static ahci_port_t ports[AHCI_MAX_PORTS];
+static int nr_ports = 0;
+
+/* Helpers */
+
+static inline uint32_t hba_read(uint32_t reg) {
+    return *(volatile uint32_t*)(abar + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(abar + reg) = value;
+}
+
+static inline uint32_t port_read(ahci_port_t* p, uint32_t reg) {
+    return *(volatile uint32_t*)(p->regs + reg);
+}
+
+static inline void port_write(ahci_port_t* p, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(p->regs + reg) = value;
+}
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+// Tasks sleep until the completion interrupt. Before the scheduler runs,
+// in the root task, and without a usable IRQ line the HBA is polled.
+static int can_sleep(void) {
+    return irq_ok && current_task && current_task->pid != 0;
+}
+
+static int dma_ok(void* virt) {
+    return (hba_cap & AHCI_CAP_S64A) || virt_to_phys(virt) < 0x100000000ULL;
+}
+
+static int wait_clear(ahci_port_t* p, uint32_t reg, uint32_t bits) {
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if (!(port_read(p, reg) & bits)) return 0;
+    }
+    return -1;
+}
+
+static ahci_cmd_table_t* slot_table(ahci_port_t* p, int slot) {
+    return (ahci_cmd_table_t*)(p->tables + slot * AHCI_CMD_TABLE_SIZE);
+}
+
+/* Port control */
+
+static void port_stop(ahci_port_t* p) {
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_CR);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_FRE);
+    wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_FR);
+}
+
+static void port_start(ahci_port_t* p) {
+    wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_CR);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_FRE);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+}
+
+// COMRESET, for a drive stuck busy after an error
+static void port_reset(ahci_port_t* p) {
+    uint32_t sctl = port_read(p, AHCI_PxSCTL) & ~0xFu;
+    port_write(p, AHCI_PxSCTL, sctl | AHCI_SCTL_COMRESET);
+    for (int i = 0; i < 2000; i++) inb(0x80); // At least 1ms
+    port_write(p, AHCI_PxSCTL, sctl);
+
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if (AHCI_SSTS_DET(port_read(p, AHCI_PxSSTS)) == AHCI_DET_PRESENT) break;
+    }
+}
+
+// An error or timeout aborts every outstanding command (NCQ has no way to
+// fail just one), then the command engine is restarted
+static void port_recover(ahci_port_t* p) {
+    p->failed |= p->issued;
+    p->issued = 0;
+
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) & ~AHCI_PxCMD_ST);
+    wait_clear(p, AHCI_PxCMD, AHCI_PxCMD_CR);
+
+    if (port_read(p, AHCI_PxTFD) & (ATA_SR_BSY | ATA_SR_DRQ)) port_reset(p);
+
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_write(p, AHCI_PxCMD, port_read(p, AHCI_PxCMD) | AHCI_PxCMD_ST);
+
+    wait_queue_wake_all(&p->done_wq);
+}
+
+/* Completion */
+
+// Runs with interrupts off, from the IRQ handler or the polling loop. A
+// slot is done once the HBA cleared it from both CI and SActive.
+static void port_complete(ahci_port_t* p) {
+    uint32_t is = port_read(p, AHCI_PxIS);
+    port_write(p, AHCI_PxIS, is);
+
+    if (is & AHCI_PxIS_ERROR) {
+        serial_printf("AHCI: port %d error, IS 0x%x TFD 0x%x\n",
+                      p->index, is, port_read(p, AHCI_PxTFD));
+        port_recover(p);
+        return;
+    }
+
+    uint32_t busy = port_read(p, AHCI_PxCI) | port_read(p, AHCI_PxSACT);
+    uint32_t done = p->issued & ~busy;
+    if (done) {
+        p->issued &= ~done;
+        wait_queue_wake_all(&p->done_wq);
+    }
+}
+
+static void ahci_irq_handler(void) {
+    uint32_t is = hba_read(AHCI_IS);
+    if (!is) return; // Another device on the shared line
+
+    for (int i = 0; i < nr_ports; i++) {
+        if (is & SLOT(ports[i].index)) port_complete(&ports[i]);
+    }
+    hba_write(AHCI_IS, is);
+}
+
+// Returns 0 once every slot in mask completed without an error
+static int port_wait(ahci_port_t* p, uint32_t mask) {
+    if (can_sleep()) {
+        uint64_t deadline = kdata_ticks() + timer_ns_to_ticks(AHCI_TIMEOUT_NS);
+        int timed_out = 0;
+        while ((p->issued & mask) && !timed_out) {
+            timed_out = wait_queue_sleep_until(&p->done_wq, deadline);
+        }
+    } else {
+        for (int i = 0; i < AHCI_SPIN_LIMIT * 10 && (p->issued & mask); i++) {
+            port_complete(p);
+        }
+    }
+
+    if (p->issued & mask) {
+        serial_printf("AHCI: port %d timeout, CI 0x%x SACT 0x%x\n", p->index,
+                      port_read(p, AHCI_PxCI), port_read(p, AHCI_PxSACT));
+        port_recover(p);
+    }
+    return (p->failed & mask) ? -1 : 0;
+}
+
+/* Slots */
+
+// Called with interrupts off. Without may_wait, returns -1 instead of
+// blocking when every slot is taken.
+static int slot_alloc(ahci_port_t* p, int may_wait) {
+    while (1) {
+        uint32_t all = p->nr_slots == 32 ? 0xFFFFFFFF : SLOT(p->nr_slots) - 1;
+        uint32_t free = ~p->allocated & all;
+
+        if (!p->exclusive && free) {
+            int slot = __builtin_ctz(free);
+            p->allocated |= SLOT(slot);
+            return slot;
+        }
+
+        if (!may_wait) return -1;
+        if (current_task && current_task->pid != 0) wait_queue_sleep(&p->slot_wq);
+        else if (current_task) scheduler_yield();
+        else return -1; // Nobody else can be holding slots before the scheduler
+    }
+}
+
+static void slot_free(ahci_port_t* p, uint32_t mask) {
+    p->allocated &= ~mask;
+    wait_queue_wake_all(&p->slot_wq);
+}
+
+// Waits for the queue to drain and takes the whole port, for commands that
+// cannot be mixed with NCQ ones. Returns slot 0.
+static int port_take(ahci_port_t* p) {
+    while (p->exclusive) {
+        if (current_task && current_task->pid != 0) wait_queue_sleep(&p->slot_wq);
+        else scheduler_yield();
+    }
+    p->exclusive = 1;
+
+    while (p->allocated) {
+        if (current_task && current_task->pid != 0) wait_queue_sleep(&p->slot_wq);
+        else scheduler_yield();
+    }
+    p->allocated = SLOT(0);
+    return 0;
+}
+
+static void port_release(ahci_port_t* p) {
+    p->exclusive = 0;
+    slot_free(p, SLOT(0));
+}
+
+/* Commands */
+
+static void build_command(ahci_port_t* p, int slot, uint8_t command,
+                          uint64_t lba, uint32_t count, uint32_t bytes, int write) {
+    ahci_cmd_header_t* hdr = &p->cmd_list[slot];
+    ahci_cmd_table_t* table = slot_table(p, slot);
+    memset(table, 0, sizeof(ahci_cmd_table_t));
+
+    uint8_t* fis = table->cfis;
+    fis[0] = AHCI_FIS_REG_H2D;
+    fis[1] = AHCI_FIS_COMMAND;
+    fis[2] = command;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = command == ATA_CMD_IDENTIFY ? 0 : ATA_DEVICE_LBA;
+    fis[8] = (lba >> 24) & 0xFF;
+    fis[9] = (lba >> 32) & 0xFF;
+    fis[10] = (lba >> 40) & 0xFF;
+
+    if (command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+        // Sector count moves to the features field, the count field holds the tag
+        fis[3] = count & 0xFF;
+        fis[11] = (count >> 8) & 0xFF;
+        fis[12] = slot << 3;
+    } else {
+        fis[12] = count & 0xFF;
+        fis[13] = (count >> 8) & 0xFF;
+    }
+
+    hdr->prdtl = 0;
+    if (bytes) {
+        uint64_t phys = virt_to_phys(p->bounce[slot]);
+        table->prdt[0].dba = (uint32_t)phys;
+        table->prdt[0].dbau = (uint32_t)(phys >> 32);
+        table->prdt[0].dbc = bytes - 1;
+        hdr->prdtl = 1;
+    }
+
+    hdr->flags = AHCI_CMD_FIS_LEN | (write ? AHCI_CMD_WRITE : 0);
+    hdr->prdbc = 0;
+}
+
+// Called with interrupts off
+static void issue(ahci_port_t* p, int slot, int queued) {
+    p->failed &= ~SLOT(slot);
+    p->issued |= SLOT(slot);
+
+    asm volatile("" ::: "memory"); // Command table before the doorbell
+    if (queued) port_write(p, AHCI_PxSACT, SLOT(slot));
+    port_write(p, AHCI_PxCI, SLOT(slot));
+}
+
+// Runs a non-queued command through slot 0 and waits for it
+static int exec_single(ahci_port_t* p, uint8_t command, uint32_t bytes) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    int slot = port_take(p);
+    build_command(p, slot, command, 0, 0, bytes, 0);
+    issue(p, slot, 0);
+    int ret = port_wait(p, SLOT(slot));
+    port_release(p);
+
+    if (flags & 0x200) asm volatile("sti");
+    return ret;
+}
+
+// Splits the request into slot-sized commands and queues as many as there
+// are free slots before waiting for them. A request never sleeps for a slot
+// while it holds others, so requests cannot starve each other of slots.
+static int ahci_rw(ahci_port_t* p, uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (lba + count > p->blk.sectors) return -1;
+
+    uint8_t command;
+    if (p->ncq) command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    else command = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    int ret = 0;
+    while (count > 0 && ret == 0) {
+        int slots[AHCI_MAX_SLOTS];
+        uint32_t lens[AHCI_MAX_SLOTS];
+        uint32_t mask = 0;
+        int n = 0;
+        uint8_t* batch_buf = buf;
+
+        while (count > 0) {
+            int slot = slot_alloc(p, n == 0);
+            if (slot < 0) break;
+
+            uint32_t chunk = count < AHCI_SLOT_SECTORS ? count : AHCI_SLOT_SECTORS;
+            uint32_t bytes = chunk * BLOCK_SECTOR_SIZE;
+            if (write) memcpy(p->bounce[slot], buf, bytes);
+
+            build_command(p, slot, command, lba, chunk, bytes, write);
+            issue(p, slot, p->ncq);
+
+            slots[n] = slot;
+            lens[n++] = bytes;
+            mask |= SLOT(slot);
+
+            lba += chunk;
+            buf += bytes;
+            count -= chunk;
+        }
+        if (n == 0) {
+            ret = -1;
+            break;
+        }
+
+        ret = port_wait(p, mask);
+        if (ret == 0 && !write) {
+            for (int i = 0; i < n; i++) {
+                memcpy(batch_buf, p->bounce[slots[i]], lens[i]);
+                batch_buf += lens[i];
+            }
+        }
+        slot_free(p, mask);
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return ret;
+}
+
+/* Block device */
+
+static int ahci_block_read(block_device_t* blk, uint64_t lba, uint32_t count, uint8_t* buf) {
+    return ahci_rw((ahci_port_t*)blk->priv, lba, count, buf, 0);
+}
+
+static int ahci_block_write(block_device_t* blk, uint64_t lba, uint32_t count, const uint8_t* buf) {
+    return ahci_rw((ahci_port_t*)blk->priv, lba, count, (uint8_t*)buf, 1);
+}
+
+// Lets the queue drain first, FLUSH CACHE is not a queued command
+static int ahci_block_flush(block_device_t* blk) {
+    return exec_single((ahci_port_t*)blk->priv, ATA_CMD_CACHE_FLUSH_EXT, 0);
+}
+
+static const block_ops_t ahci_block_ops = {
+    .read = ahci_block_read,
+    .write = ahci_block_write,
+    .flush = ahci_block_flush,
+};
+
+/* Initialization */
+
+static void port_free(ahci_port_t* p) {
+    if (p->cmd_list) pmm_free_page(p->cmd_list);
+    if (p->tables) pmm_free_pages(p->tables, AHCI_MAX_SLOTS * AHCI_CMD_TABLE_SIZE / PAGE_SIZE);
+    for (int i = 0; i < AHCI_MAX_SLOTS; i++) {
+        if (p->bounce[i]) pmm_free_pages(p->bounce[i], AHCI_SLOT_PAGES);
+    }
+    memset(p, 0, sizeof(ahci_port_t));
+}
+
+// Gives the port its command list, FIS area and command tables, and starts
+// the command engine. The HBA only takes 32-bit addresses without S64A.
+static int port_setup(ahci_port_t* p) {
+    port_stop(p);
+
+    p->cmd_list = (ahci_cmd_header_t*)pmm_alloc_page();
+    p->tables = (uint8_t*)pmm_alloc_pages(AHCI_MAX_SLOTS * AHCI_CMD_TABLE_SIZE / PAGE_SIZE);
+    p->bounce[0] = (uint8_t*)pmm_alloc_pages(AHCI_SLOT_PAGES);
+    if (!p->cmd_list || !p->tables || !p->bounce[0]) return -1;
+    if (!dma_ok(p->cmd_list) || !dma_ok(p->tables) || !dma_ok(p->bounce[0])) return -1;
+
+    memset(p->cmd_list, 0, PAGE_SIZE);
+    memset(p->tables, 0, AHCI_MAX_SLOTS * AHCI_CMD_TABLE_SIZE);
+
+    for (int i = 0; i < AHCI_MAX_SLOTS; i++) {
+        uint64_t phys = virt_to_phys(slot_table(p, i));
+        p->cmd_list[i].ctba = (uint32_t)phys;
+        p->cmd_list[i].ctbau = (uint32_t)(phys >> 32);
+    }
+
+    uint64_t clb = virt_to_phys(p->cmd_list);
+    uint64_t fb = clb + AHCI_CMD_LIST_SIZE;
+    port_write(p, AHCI_PxCLB, (uint32_t)clb);
+    port_write(p, AHCI_PxCLBU, (uint32_t)(clb >> 32));
+    port_write(p, AHCI_PxFB, (uint32_t)fb);
+    port_write(p, AHCI_PxFBU, (uint32_t)(fb >> 32));
+
+    port_write(p, AHCI_PxSERR, 0xFFFFFFFF);
+    port_write(p, AHCI_PxIS, 0xFFFFFFFF);
+    port_start(p);
+
+    port_write(p, AHCI_PxIE, AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERROR);
+    return 0;
+}
+
+// Identifies the disk, picks the queue depth and gives every slot a bounce
+// buffer. Slots that cannot get one are left out of the queue.
+static int port_identify(ahci_port_t* p) {
+    p->nr_slots = 1;
+    if (exec_single(p, ATA_CMD_IDENTIFY, 512) != 0) return -1;
+
+    const uint16_t* id = (const uint16_t*)p->bounce[0];
+
+    p->blk.sectors = id[ATA_ID_LBA28_SECTORS] | ((uint64_t)id[ATA_ID_LBA28_SECTORS + 1] << 16);
+    if ((id[ATA_ID_COMMAND_SETS] >> 10) & 1) {
+        uint64_t sectors48 = 0;
+        for (int i = 3; i >= 0; i--) sectors48 = (sectors48 << 16) | id[ATA_ID_LBA48_SECTORS + i];
+        if (sectors48) p->blk.sectors = sectors48;
+    }
+
+    uint32_t depth = 1;
+    p->ncq = (hba_cap & AHCI_CAP_SNCQ) && (id[ATA_ID_SATA_CAPS] & (1 << 8));
+    if (p->ncq) {
+        depth = (id[ATA_ID_QUEUE_DEPTH] & 0x1F) + 1;
+        if (depth > AHCI_CAP_NCS(hba_cap)) depth = AHCI_CAP_NCS(hba_cap);
+    }
+
+    for (uint32_t i = 1; i < depth; i++) {
+        p->bounce[i] = (uint8_t*)pmm_alloc_pages(AHCI_SLOT_PAGES);
+        if (!p->bounce[i] || !dma_ok(p->bounce[i])) {
+            if (p->bounce[i]) pmm_free_pages(p->bounce[i], AHCI_SLOT_PAGES);
+            p->bounce[i] = NULL;
+            depth = i;
+            break;
+        }
+    }
+    p->nr_slots = depth;
+    return 0;
+}
+
+static void port_probe(int index) {
+    if (nr_ports == AHCI_MAX_PORTS) return;
+
+    ahci_port_t* p = &ports[nr_ports];
+    memset(p, 0, sizeof(ahci_port_t));
+    p->index = index;
+    p->regs = abar + AHCI_PORT(index);
+
+    uint32_t ssts = port_read(p, AHCI_PxSSTS);
+    if (AHCI_SSTS_DET(ssts) != AHCI_DET_PRESENT || AHCI_SSTS_IPM(ssts) != AHCI_IPM_ACTIVE) return;
+
+    // ATAPI, port multipliers and the like
+    if (port_read(p, AHCI_PxSIG) != AHCI_SIG_ATA) {
+        serial_printf("AHCI: port %d is not a SATA disk\n", index);
+        return;
+    }
+
+    if (port_setup(p) != 0) {
+        serial_printf("AHCI: port %d: no DMA-able memory\n", index);
+        port_stop(p);
+        port_free(p);
+        return;
+    }
+    if (port_identify(p) != 0) {
+        serial_printf("AHCI: port %d: IDENTIFY failed\n", index);
+        port_stop(p);
+        port_free(p);
+        return;
+    }
+
+    memcpy(p->name, "ahci0", 6);
+    p->name[4] += nr_ports;
+    p->blk.name = p->name;
+    p->blk.ops = &ahci_block_ops;
+    p->blk.priv = p;
+    nr_ports++;
+
+    serial_printf("AHCI: port %d, %u MiB, %s, %u slots\n", index,
+                  (uint32_t)(p->blk.sectors / 2048), p->ncq ? "NCQ" : "no NCQ", p->nr_slots);
+}
+
+int ahci_init(void) {
+    pci_device_t pci;
+    int found = 0;
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, i, &pci) == 0; i++) {
+        if (pci.prog_if == AHCI_PROG_IF) {
+            found = 1;
+            break;
+        }
+    }
+    if (!found) return 0;
+
+    uint64_t bar = pci_bar_address(&pci, AHCI_ABAR);
+    if (!bar) return 0;
+
+    abar = (volatile uint8_t*)vmm_map_mmio(bar, AHCI_ABAR_SIZE);
+    if (!abar) return 0;
+    pci_enable_bus_master(&pci);
+
+    hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_AE);
+    hba_cap = hba_read(AHCI_CAP);
+
+    uint32_t implemented = hba_read(AHCI_PI);
+    for (int i = 0; i < AHCI_MAX_PORTS; i++) {
+        if (implemented & SLOT(i)) port_probe(i);
+    }
+    if (nr_ports == 0) return 0;
+
+    // Completions are polled if the interrupt cannot be routed
+    if (pci.irq_line < 16 && irq_register(pci.irq_line, ahci_irq_handler) == 0) {
+        hba_write(AHCI_IS, 0xFFFFFFFF);
+        hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_IE);
+        irq_ok = 1;
+    } else {
+        serial_printf("AHCI: no usable IRQ line, polling for completions\n");
+    }
+
+    for (int i = 0; i < nr_ports; i++) block_register(&ports[i].blk);
+    return nr_ports;
+}
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <pmm.h>
+#include <kheap.h>
+#include <task.h>
+#include <kstring.h>
+#include <block.h>
+#include <bcache.h>
+
+#define BUF_FREE      0
+#define BUF_LOADING   1   // A device read is filling it, readers sleep on load_wq
+#define BUF_VALID     2
+
+#define BUF_READAHEAD (1 << 0)   // Fetched ahead of the reader and not read since
+#define BUF_STALE     (1 << 1)   // Written while loading, dropped once the load ends
+
+typedef struct buf {
+    int dev;
+    uint64_t block;
+    uint8_t state;
+    uint8_t flags;
+    uint8_t* data;           // One page
+    struct buf* hash_next;   // Also links the free list
+    struct buf* lru_prev;    // Towards the most recently used end
+    struct buf* lru_next;
+} buf_t;
+
+typedef struct {
+    uint64_t next_lba;       // Where the next read starts if access is sequential
+    uint32_t window;         // Read-ahead in blocks, 0 while access looks random
+} ra_state_t;
+
+// All state below is only touched with interrupts disabled. Device I/O runs
+// with them restored, the buffers it fills are LOADING and cannot be
+// recycled in the meantime.
+static buf_t bufs[BCACHE_MAX_PAGES];
+static uint32_t nr_bufs = 0;     // Headers that own a page, allocated on demand
+static buf_t* hash[BCACHE_HASH_SIZE];
+static buf_t* lru_head = NULL;   // Most recently used
+static buf_t* lru_tail = NULL;
+static buf_t* free_list = NULL;
+static ra_state_t ra[BLOCK_MAX_DEVICES];
+static wait_queue_t load_wq;
+static bcache_stats_t stats;
+
+extern task_t* current_task;
+
+static uint32_t hash_of(int dev, uint64_t block) {
+    return (uint32_t)(((block * 0x9E3779B97F4A7C15ULL) >> 40) + (uint64_t)dev) % BCACHE_HASH_SIZE;
+}
+
+static buf_t* lookup(int dev, uint64_t block) {
+    for (buf_t* b = hash[hash_of(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block) return b;
+    }
+    return NULL;
+}
+
+static void hash_remove(buf_t* b) {
+    buf_t** link = &hash[hash_of(b->dev, b->block)];
+    while (*link != b) link = &(*link)->hash_next;
+    *link = b->hash_next;
+    b->hash_next = NULL;
+}
+
+static void lru_remove(buf_t* b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(buf_t* b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b;
+    else lru_tail = b;
+    lru_head = b;
+}
+
+static void lru_touch(buf_t* b) {
+    if (lru_head == b) return;
+    lru_remove(b);
+    lru_push_front(b);
+}
+
+// Recycles the least recently used buffer. Buffers still loading are skipped.
+static buf_t* evict(void) {
+    for (buf_t* b = lru_tail; b; b = b->lru_prev) {
+        if (b->state != BUF_VALID) continue;
+
+        hash_remove(b);
+        lru_remove(b);
+        stats.evictions++;
+        return b;
+    }
+    return NULL;
+}
+
+// Returns a LOADING buffer for the block, or NULL when the budget is spent
+// and every buffer is busy
+static buf_t* buf_alloc(int dev, uint64_t block) {
+    buf_t* b = free_list;
+    if (b) {
+        free_list = b->hash_next;
+    } else if (nr_bufs < BCACHE_MAX_PAGES) {
+        uint8_t* page = (uint8_t*)pmm_alloc_page();
+        if (page) {
+            b = &bufs[nr_bufs++];
+            b->data = page;
+        }
+    }
+    if (!b) b = evict();
+    if (!b) return NULL;
+
+    b->dev = dev;
+    b->block = block;
+    b->state = BUF_LOADING;
+    b->flags = 0;
+
+    uint32_t h = hash_of(dev, block);
+    b->hash_next = hash[h];
+    hash[h] = b;
+    lru_push_front(b);
+    return b;
+}
+
+static void buf_drop(buf_t* b) {
+    hash_remove(b);
+    lru_remove(b);
+    b->state = BUF_FREE;
+    b->hash_next = free_list;
+    free_list = b;
+}
+
+// Called and returns with interrupts disabled
+static void wait_for_load(void) {
+    if (current_task && current_task->pid != 0) wait_queue_sleep(&load_wq);
+    else if (current_task) scheduler_yield();
+}
+
+// Reads a run of consecutive blocks with one device command when a staging
+// buffer can be had, one command per block otherwise
+static int fetch_run(block_device_t* dev, buf_t** run, uint32_t nr) {
+    uint64_t lba = run[0]->block * BCACHE_BLOCK_SECTORS;
+
+    uint8_t* staging = nr > 1 ? (uint8_t*)kmalloc(nr * BCACHE_BLOCK_SIZE) : NULL;
+    if (!staging) {
+        for (uint32_t i = 0; i < nr; i++) {
+            if (dev->ops->read(dev, lba + i * BCACHE_BLOCK_SECTORS, BCACHE_BLOCK_SECTORS, run[i]->data)) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    int ret = dev->ops->read(dev, lba, nr * BCACHE_BLOCK_SECTORS, staging);
+    if (ret == 0) {
+        for (uint32_t i = 0; i < nr; i++) {
+            memcpy(run[i]->data, staging + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+        }
+    }
+
+    kfree(staging);
+    return ret;
+}
+
+int bcache_read(block_device_t* dev, uint64_t lba, uint32_t count, uint8_t* buf) {
+    uint64_t cached_blocks = dev->sectors / BCACHE_BLOCK_SECTORS;
+    uint64_t last_block = (lba + count - 1) / BCACHE_BLOCK_SECTORS;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    // Nothing ends at sector 0, so a zeroed state never looks sequential
+    ra_state_t* r = &ra[dev->id];
+    if (lba != 0 && lba == r->next_lba) {
+        r->window = r->window ? r->window * 2 : BCACHE_RA_MIN;
+        if (r->window > BCACHE_RA_MAX) r->window = BCACHE_RA_MAX;
+    } else {
+        r->window = 0;
+    }
+    r->next_lba = lba + count;
+    uint32_t window = r->window;
+
+    if (flags & 0x200) asm volatile("sti");
+
+    while (count > 0) {
+        uint64_t block = lba / BCACHE_BLOCK_SECTORS;
+        uint32_t off = lba % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - off;
+        if (n > count) n = count;
+
+        // The sectors past the last whole block are never cached
+        if (block >= cached_blocks) return dev->ops->read(dev, lba, count, buf);
+
+        asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+        buf_t* b = lookup(dev->id, block);
+        if (b && b->state == BUF_LOADING) {
+            wait_for_load();
+            if (flags & 0x200) asm volatile("sti");
+            continue;
+        }
+
+        if (b) {
+            memcpy(buf, b->data + off * BLOCK_SECTOR_SIZE, n * BLOCK_SECTOR_SIZE);
+            lru_touch(b);
+            stats.hits++;
+            if (b->flags & BUF_READAHEAD) {
+                b->flags &= ~BUF_READAHEAD;
+                stats.readahead_hits++;
+            }
+            if (flags & 0x200) asm volatile("sti");
+
+            lba += n;
+            count -= n;
+            buf += n * BLOCK_SECTOR_SIZE;
+            continue;
+        }
+
+        // Miss: claim the blocks up to the next cached one, covering the
+        // rest of the request and the read-ahead window
+        uint64_t want = last_block - block + 1 + window;
+        if (want > BCACHE_RUN_MAX) want = BCACHE_RUN_MAX;
+        if (want > cached_blocks - block) want = cached_blocks - block;
+
+        buf_t* run[BCACHE_RUN_MAX];
+        uint32_t nr = 0;
+        while (nr < want) {
+            if (nr > 0 && lookup(dev->id, block + nr)) break;
+
+            buf_t* nb = buf_alloc(dev->id, block + nr);
+            if (!nb) break;
+
+            if (block + nr > last_block) {
+                nb->flags |= BUF_READAHEAD;
+                stats.readahead++;
+            } else {
+                stats.misses++;
+            }
+            run[nr++] = nb;
+        }
+        stats.dev_reads++;
+
+        if (nr == 0) {
+            // Every buffer is loading, go around the cache
+            stats.misses++;
+            if (flags & 0x200) asm volatile("sti");
+
+            if (dev->ops->read(dev, lba, n, buf)) return -1;
+            lba += n;
+            count -= n;
+            buf += n * BLOCK_SECTOR_SIZE;
+            continue;
+        }
+
+        if (flags & 0x200) asm volatile("sti");
+        int ret = fetch_run(dev, run, nr);
+        asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+        for (uint32_t i = 0; i < nr; i++) {
+            if (ret || (run[i]->flags & BUF_STALE)) buf_drop(run[i]);
+            else run[i]->state = BUF_VALID;
+        }
+        wait_queue_wake_all(&load_wq);
+
+        if (ret) {
+            if (flags & 0x200) asm volatile("sti");
+            return -1;
+        }
+
+        // Copy out while the new buffers cannot be recycled. A block written
+        // during the load was dropped and is fetched again by the next pass.
+        for (uint32_t i = 0; i < nr && count > 0 && run[i]->state == BUF_VALID; i++) {
+            off = lba % BCACHE_BLOCK_SECTORS;
+            n = BCACHE_BLOCK_SECTORS - off;
+            if (n > count) n = count;
+
+            memcpy(buf, run[i]->data + off * BLOCK_SECTOR_SIZE, n * BLOCK_SECTOR_SIZE);
+            lba += n;
+            count -= n;
+            buf += n * BLOCK_SECTOR_SIZE;
+        }
+
+        if (flags & 0x200) asm volatile("sti");
+    }
+
+    return 0;
+}
+
+int bcache_write(block_device_t* dev, uint64_t lba, uint32_t count, const uint8_t* buf) {
+    int ret = dev->ops->write(dev, lba, count, buf);
+    uint64_t cached_blocks = dev->sectors / BCACHE_BLOCK_SECTORS;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+    stats.dev_writes++;
+    if (flags & 0x200) asm volatile("sti");
+
+    while (count > 0) {
+        uint64_t block = lba / BCACHE_BLOCK_SECTORS;
+        uint32_t off = lba % BCACHE_BLOCK_SECTORS;
+        uint32_t n = BCACHE_BLOCK_SECTORS - off;
+        if (n > count) n = count;
+        if (block >= cached_blocks) break;
+
+        asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+        // On a failed write the disk contents are unknown, forget them
+        buf_t* b = lookup(dev->id, block);
+        if (b && b->state == BUF_LOADING) {
+            b->flags |= BUF_STALE;
+        } else if (b && ret) {
+            buf_drop(b);
+        } else if (b) {
+            memcpy(b->data + off * BLOCK_SECTOR_SIZE, buf, n * BLOCK_SECTOR_SIZE);
+            lru_touch(b);
+        } else if (!ret && n == BCACHE_BLOCK_SECTORS) {
+            b = buf_alloc(dev->id, block);
+            if (b) {
+                memcpy(b->data, buf, BCACHE_BLOCK_SIZE);
+                b->state = BUF_VALID;
+            }
+        }
+
+        if (flags & 0x200) asm volatile("sti");
+
+        lba += n;
+        count -= n;
+        buf += n * BLOCK_SECTOR_SIZE;
+    }
+
+    return ret;
+}
+
+// Nothing is held back by the cache, only the drive's write cache needs it
+int bcache_flush(block_device_t* dev) {
+    return dev->ops->flush(dev);
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    *out = stats;
+    out->pages = nr_bufs;
+    out->max_pages = BCACHE_MAX_PAGES;
+
+    if (flags & 0x200) asm volatile("sti");
+}
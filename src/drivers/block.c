@@ -0,0 +1,32 @@
+#include <block.h>
+#include <ahci.h>
+#include <virtio_blk.h>
+#include <nvme.h>
+#include <fatfs/ata.h>
+
+static block_device_t* devices[BLOCK_MAX_DEVICES];
+static int nr_devices = 0;
+
+void block_init(void) {
+    virtio_blk_init();
+    nvme_init();
+    ahci_init();
+    ata_init();
+
+    if (nr_devices == 0) serial_printf("BLOCK: no disks found\n");
+}
+
+int block_register(block_device_t* dev) {
+    if (nr_devices == BLOCK_MAX_DEVICES) return -1;
+
+    dev->id = nr_devices;
+    devices[nr_devices] = dev;
+    serial_printf("BLOCK: disk %d is %s, %u MiB\n", nr_devices, dev->name,
+                  (uint32_t)(dev->sectors / (1024 * 1024 / BLOCK_SECTOR_SIZE)));
+    return nr_devices++;
+}
+
+block_device_t* block_get(int index) {
+    if (index < 0 || index >= nr_devices) return NULL;
+    return devices[index];
+}
@@ -1,5 +1,64 @@
 #include <com1.h>
 
+// Everything written to the serial port also lands in this ring. The THRE
+// interrupt drains it into the 16550 FIFO, and SYS_LOG_READ exposes the most
+// recent SERIAL_LOG_SIZE bytes to userspace (dmesg).
+static char log_buf[SERIAL_LOG_SIZE];
+static uint64_t log_head = 0;   // Bytes ever logged
+static uint64_t tx_tail = 0;    // Bytes handed to the UART
+
+static bool irq_mode = false;   // THRE interrupt drains the ring
+static bool tx_active = false;  // THRE interrupt currently enabled
+
+static int serial_transmit_empty(void) {
+    return inb(SERIAL_COM1_BASE + SERIAL_LSR) & LSR_THRE;
+}
+
+// Refill the FIFO from the ring. The caller has checked THRE.
+static void tx_fill_fifo(void) {
+    for (int i = 0; i < SERIAL_FIFO_SIZE && tx_tail != log_head; i++) {
+        outb(SERIAL_COM1_BASE + SERIAL_DATA, log_buf[tx_tail % SERIAL_LOG_SIZE]);
+        tx_tail++;
+    }
+}
+
+// Busy-wait until everything in the ring has reached the UART.
+static void tx_flush_sync(void) {
+    while (tx_tail != log_head) {
+        while (!serial_transmit_empty());
+        tx_fill_fifo();
+    }
+}
+
+// Interrupts must be disabled by the caller.
+static void log_putc(char c) {
+    // Never overwrite bytes the UART has not sent yet; a producer faster
+    // than the line rate waits for one FIFO's worth of room instead.
+    if (log_head - tx_tail >= SERIAL_LOG_SIZE) {
+        while (!serial_transmit_empty());
+        tx_fill_fifo();
+    }
+
+    log_buf[log_head % SERIAL_LOG_SIZE] = c;
+    log_head++;
+}
+
+// Start the transmitter after a batch of log_putc() calls.
+static void log_kick(void) {
+    if (!irq_mode) {
+        tx_flush_sync();
+        return;
+    }
+
+    if (tx_active) return;
+
+    if (serial_transmit_empty()) tx_fill_fifo();
+    if (tx_tail == log_head) return;
+
+    tx_active = true;
+    outb(SERIAL_COM1_BASE + SERIAL_IER, IER_THRE);
+}
+
 void serial_init(void) {
     outb(SERIAL_COM1_BASE + SERIAL_IER, 0x00); // Disable interrupts
 
@@ -19,8 +78,59 @@ void serial_init(void) {
     serial_printf("Serial output ready on COM1.\n");
 }
 
-static int serial_transmit_empty(void) {
-    return inb(SERIAL_COM1_BASE + 5) & 0x20;
+// Called once the IDT is loaded and IRQ 4 is unmasked. Until then output is
+// written synchronously.
+void serial_enable_irq(void) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    irq_mode = true;
+    log_kick();
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+void serial_irq_handler(void) {
+    // Reading IIR acknowledges a pending THRE interrupt
+    inb(SERIAL_COM1_BASE + SERIAL_IIR);
+
+    if (!tx_active || !serial_transmit_empty()) return;
+
+    tx_fill_fifo();
+
+    if (tx_tail == log_head) {
+        tx_active = false;
+        outb(SERIAL_COM1_BASE + SERIAL_IER, 0x00);
+    }
+}
+
+// Switch back to synchronous output and push out whatever is still queued.
+// Used on fatal paths that halt with interrupts disabled.
+void serial_panic(void) {
+    asm volatile("cli");
+
+    irq_mode = false;
+    tx_active = false;
+    outb(SERIAL_COM1_BASE + SERIAL_IER, 0x00);
+
+    tx_flush_sync();
+}
+
+// Copy the newest (up to max) bytes of the log into dst.
+uint64_t serial_log_read(char* dst, uint64_t max) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    uint64_t avail = log_head < SERIAL_LOG_SIZE ? log_head : SERIAL_LOG_SIZE;
+    uint64_t len = avail < max ? avail : max;
+    uint64_t start = log_head - len;
+
+    for (uint64_t i = 0; i < len; i++) {
+        dst[i] = log_buf[(start + i) % SERIAL_LOG_SIZE];
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return len;
 }
 
 static void serial_write_uint(uint64_t value, int base) {
@@ -28,7 +138,7 @@ static void serial_write_uint(uint64_t value, int base) {
     int i = 0;
 
     if (value == 0) {
-        serial_write_char('0');
+        log_putc('0');
         return;
     }
 
@@ -40,38 +150,57 @@ static void serial_write_uint(uint64_t value, int base) {
 
     // Reverse output
     while (i--)
-        serial_write_char(buffer[i]);
+        log_putc(buffer[i]);
 }
 
 static void serial_write_int(int64_t value) {
     if (value < 0) {
-        serial_write_char('-');
+        log_putc('-');
         serial_write_uint((uint64_t)(-value), 10);
     } else {
         serial_write_uint((uint64_t)value, 10);
     }
 }
 
+static void log_puts(const char* str) {
+    while (*str) {
+        if (*str == '\n')
+            log_putc('\r');
+        log_putc(*str++);
+    }
+}
+
 void serial_write_char(char c) {
-    while (!serial_transmit_empty());
-    outb(SERIAL_COM1_BASE, c);
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    log_putc(c);
+    log_kick();
+
+    if (flags & 0x200) asm volatile("sti");
 }
 
 void serial_write_string(const char* str) {
-    while (*str) {
-        if (*str == '\n')
-            serial_write_char('\r');
-        serial_write_char(*str++);
-    }
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    log_puts(str);
+    log_kick();
+
+    if (flags & 0x200) asm volatile("sti");
 }
 
 void serial_printf(const char* fmt, ...) {
     va_list args;
     va_start(args, fmt);
 
+    // One message is queued atomically so concurrent writers do not interleave
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
     while (*fmt) {
         if (*fmt != '%') {
-            serial_write_char(*fmt++);
+            log_putc(*fmt++);
             continue;
         }
 
@@ -80,13 +209,13 @@ void serial_printf(const char* fmt, ...) {
         switch (*fmt) {
             case 's': {
                 const char* s = va_arg(args, const char*);
-                serial_write_string(s ? s : "(null)");
+                log_puts(s ? s : "(null)");
                 break;
             }
 
             case 'c': {
                 char c = (char)va_arg(args, int);
-                serial_write_char(c);
+                log_putc(c);
                 break;
             }
 
@@ -109,16 +238,19 @@ void serial_printf(const char* fmt, ...) {
             }
 
             case '%':
-                serial_write_char('%');
+                log_putc('%');
                 break;
 
             default:
-                serial_write_string("[?]");
+                log_puts("[?]");
                 break;
         }
 
         fmt++;
     }
 
+    log_kick();
+    if (flags & 0x200) asm volatile("sti");
+
     va_end(args);
-}
\ No newline at end of file
+}
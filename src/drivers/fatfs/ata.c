@@ -1,76 +1,437 @@
 #include <stdint.h>
 #include <io.h>
 #include <com1.h>
+#include <pci.h>
+#include <idt.h>
+#include <task.h>
+#include <timer.h>
+#include <kstring.h>
+#include <block.h>
 #include <fatfs/ata.h>
 
-static void ata_wait() {
-    uint8_t status;
+// Polls before giving up on the drive
+#define ATA_TIMEOUT 10000000
 
-    // Wait for BSY to clear
-    do {
-        status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
-    } while (status & ATA_SR_BSY);
+#define ATA_DMA_MAX_SECTORS (ATA_DMA_PAGES * PAGE_SIZE / ATA_SECTOR_SIZE)
 
-    //terminal_writestring("BSY cleared.\n");
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
 
-    // Now wait for DRQ
-    int timeout = 100000;
-    while (!(status & ATA_SR_DRQ) && timeout--) {
-        status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
-        if (status & ATA_SR_ERR) {
-            serial_printf("ATA error during wait!\n");
-            break;
+static ata_device_t dev;
+
+// The channel runs one command at a time. FatFs no longer holds the volume
+// lock across every read, so requests are serialized here.
+static mutex_t channel_lock;
+
+// Bus master state, owned by the holder of channel_lock
+static uint16_t bm_base = 0;
+static ata_prd_t* prdt = NULL;
+static uint8_t* bounce[ATA_DMA_PAGES];
+
+static volatile int dma_active = 0;
+static volatile int dma_done = 0;
+static uint8_t dma_bm_status;
+static uint8_t dma_ata_status;
+static wait_queue_t dma_wq = {0};
+
+// The status register is only valid 400ns after a command or drive select.
+// Each alternate status read takes about 100ns.
+static void ata_delay(void) {
+    for (int i = 0; i < 4; i++) inb(ATA_PRIMARY_CTRL);
+}
+
+static int ata_wait_not_busy(void) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        if (!(inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & ATA_SR_BSY)) return 0;
+    }
+    serial_printf("ATA: timeout waiting for BSY to clear\n");
+    return -1;
+}
+
+// Waits for the command to finish, -1 if it failed
+static int ata_wait_idle(void) {
+    if (ata_wait_not_busy()) return -1;
+
+    uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        serial_printf("ATA: command failed, error 0x%x\n", inb(ATA_PRIMARY_IO + ATA_REG_ERROR));
+        return -1;
+    }
+    return 0;
+}
+
+// Waits until the drive has the next data block ready
+static int ata_wait_drq(void) {
+    for (int i = 0; i < ATA_TIMEOUT; i++) {
+        uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+        if (status & ATA_SR_BSY) continue;
+
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            serial_printf("ATA: transfer failed, error 0x%x\n", inb(ATA_PRIMARY_IO + ATA_REG_ERROR));
+            return -1;
         }
+        if (status & ATA_SR_DRQ) return 0;
     }
+    serial_printf("ATA: timeout waiting for DRQ\n");
+    return -1;
 }
 
-void ata_read_sector(uint32_t lba, uint8_t* buf) {
-    outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER | ((lba >> 24) & 0x0F));
-    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, 1);
+// count is 1-256. 48-bit commands take the high bytes of each register
+// first, then the low bytes.
+static void ata_issue(uint8_t cmd, uint64_t lba, uint32_t count, int ext) {
+    if (ext) {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER);
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, (count >> 8) & 0xFF);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA0, (lba >> 24) & 0xFF);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (lba >> 32) & 0xFF);
+        outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (lba >> 40) & 0xFF);
+    } else {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER | ((lba >> 24) & 0x0F));
+    }
+
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, count & 0xFF);
     outb(ATA_PRIMARY_IO + ATA_REG_LBA0, lba & 0xFF);
     outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (lba >> 8) & 0xFF);
     outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (lba >> 16) & 0xFF);
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_READ_PIO);
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, cmd);
 
-    ata_wait();
+    ata_delay();
+}
 
-    for (int i = 0; i < 256; i++) {
-        ((uint16_t*)buf)[i] = inw(ATA_PRIMARY_IO + ATA_REG_DATA);
+static uint8_t ata_command(int write, int ext) {
+    if (dev.multiple > 1) {
+        if (write) return ext ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE;
+        return ext ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE;
     }
+    if (write) return ext ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+    return ext ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
 }
 
-void ata_write_sector(uint32_t lba, const uint8_t* buf) {
-    // 1. Wait until drive is not busy
-    while (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & ATA_SR_BSY);
+// One command of up to ATA_MAX_TRANSFER sectors. The drive raises DRQ once
+// per block of dev.multiple sectors, each moved with a single rep insw/outsw.
+static int ata_transfer(uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    int ext = lba + count > ATA_LBA28_LIMIT;
+    if (ext && !dev.lba48) return -1;
 
-    // 2. Select drive and LBA mode
-    outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER | ((lba >> 24) & 0x0F));
+    if (ata_wait_not_busy()) return -1;
+    ata_issue(ata_command(write, ext), lba, count, ext);
 
-    // 3. Send sector count and LBA
-    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, 1);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, lba & 0xFF);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, (lba >> 8) & 0xFF);
-    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+    for (uint32_t done = 0; done < count; ) {
+        uint32_t block = count - done < dev.multiple ? count - done : dev.multiple;
+        if (ata_wait_drq()) return -1;
+
+        uint8_t* p = buf + done * ATA_SECTOR_SIZE;
+        if (write) outsw(ATA_PRIMARY_IO + ATA_REG_DATA, p, block * (ATA_SECTOR_SIZE / 2));
+        else insw(ATA_PRIMARY_IO + ATA_REG_DATA, p, block * (ATA_SECTOR_SIZE / 2));
+
+        done += block;
+    }
+
+    return write ? ata_wait_idle() : 0;
+}
+
+/* Bus master DMA */
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+// Tasks sleep until IRQ14. Before the scheduler runs, and in the root task
+// (which must never block), the status register is polled instead.
+static int can_sleep(void) {
+    return current_task && current_task->pid != 0;
+}
 
-    // 4. Send write command
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_WRITE_PIO);
+// Runs with interrupts off, from IRQ14 or the polling loop
+static void dma_finish(uint8_t bm_status) {
+    uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS); // Also acknowledges INTRQ
 
-    // 5. Wait for DRQ or ERR
-    uint8_t status;
-    do {
-        status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
-        if (status & ATA_SR_ERR) {
-            serial_printf("ATA error: can't write sector\n");
-            return;
+    outb(bm_base + ATA_BM_CMD, 0);
+    outb(bm_base + ATA_BM_STATUS, bm_status | ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+
+    dma_bm_status = bm_status;
+    dma_ata_status = status;
+    dma_active = 0;
+    dma_done = 1;
+    wait_queue_wake_all(&dma_wq);
+}
+
+static void ata_irq_handler(void) {
+    uint8_t bm_status = inb(bm_base + ATA_BM_STATUS);
+
+    if (dma_active && (bm_status & ATA_BM_SR_IRQ)) {
+        dma_finish(bm_status);
+        return;
+    }
+
+    // Not a DMA completion (a flush, or a request that already timed out)
+    inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    if (bm_status & ATA_BM_SR_IRQ) outb(bm_base + ATA_BM_STATUS, bm_status);
+}
+
+static int dma_wait(void) {
+    if (can_sleep()) {
+        uint64_t deadline = kdata_ticks() + timer_ns_to_ticks(ATA_DMA_TIMEOUT_NS);
+        int timed_out = 0;
+        while (!dma_done && !timed_out) {
+            timed_out = wait_queue_sleep_until(&dma_wq, deadline);
         }
-    } while (!(status & ATA_SR_DRQ));
+    } else {
+        for (int i = 0; i < ATA_TIMEOUT && !dma_done; i++) {
+            uint8_t bm_status = inb(bm_base + ATA_BM_STATUS);
+            if (bm_status & ATA_BM_SR_IRQ) dma_finish(bm_status);
+        }
+    }
+
+    if (!dma_done) {
+        outb(bm_base + ATA_BM_CMD, 0);
+        dma_active = 0;
+        serial_printf("ATA: DMA timeout\n");
+        return -1;
+    }
 
-    // 6. Write 256 words (512 bytes)
-    for (int i = 0; i < 256; i++) {
-        outw(ATA_PRIMARY_IO + ATA_REG_DATA, ((uint16_t*)buf)[i]);
+    if ((dma_bm_status & ATA_BM_SR_ERR) || (dma_ata_status & (ATA_SR_ERR | ATA_SR_DF))) {
+        serial_printf("ATA: DMA failed, status 0x%x/0x%x\n", dma_ata_status, dma_bm_status);
+        return -1;
     }
+    return 0;
+}
+
+// One command of up to ATA_DMA_MAX_SECTORS through the bounce pages. The
+// calling task sleeps while the controller moves the data.
+static int ata_dma_transfer(uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    int ext = lba + count > ATA_LBA28_LIMIT;
+    if (ext && !dev.lba48) return -1;
+
+    uint32_t bytes = count * ATA_SECTOR_SIZE;
+    int nr_prds = 0;
+    for (uint32_t off = 0; off < bytes; off += PAGE_SIZE, nr_prds++) {
+        uint32_t len = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+        if (write) memcpy(bounce[nr_prds], buf + off, len);
+
+        prdt[nr_prds].phys = (uint32_t)virt_to_phys(bounce[nr_prds]);
+        prdt[nr_prds].bytes = (uint16_t)len;
+        prdt[nr_prds].flags = 0;
+    }
+    prdt[nr_prds - 1].flags = ATA_PRD_EOT;
+
+    if (ata_wait_not_busy()) return -1;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    uint8_t dir = write ? 0 : ATA_BM_CMD_READ;
+    outl(bm_base + ATA_BM_PRDT, (uint32_t)virt_to_phys(prdt));
+    outb(bm_base + ATA_BM_CMD, dir);
+    outb(bm_base + ATA_BM_STATUS, inb(bm_base + ATA_BM_STATUS) | ATA_BM_SR_IRQ | ATA_BM_SR_ERR);
+
+    dma_done = 0;
+    dma_active = 1;
+
+    uint8_t cmd;
+    if (write) cmd = ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+    else cmd = ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+    ata_issue(cmd, lba, count, ext);
+    outb(bm_base + ATA_BM_CMD, dir | ATA_BM_CMD_START);
+
+    int ret = dma_wait();
+
+    if (flags & 0x200) asm volatile("sti");
+    if (ret) return -1;
+
+    if (!write) {
+        for (uint32_t off = 0, i = 0; off < bytes; off += PAGE_SIZE, i++) {
+            uint32_t len = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+            memcpy(buf + off, bounce[i], len);
+        }
+    }
+    return 0;
+}
+
+// Sets up DMA when the IDE controller can bus master and the drive speaks
+// DMA. Everything stays on PIO otherwise.
+static void ata_dma_init(const uint16_t* id) {
+    if (!(id[ATA_ID_CAPABILITIES] & (1 << 8))) return;
 
-    // 7. Flush (optional for now)
-    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-    while (inb(ATA_PRIMARY_IO + ATA_REG_STATUS) & ATA_SR_BSY);
-}
\ No newline at end of file
+    pci_device_t pci;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0, &pci) != 0) return;
+
+    // Native mode moves the ports and the IRQ, only compatibility mode is supported
+    if ((pci.prog_if & 0x01) || !(pci.prog_if & ATA_BM_PROG_IF)) {
+        serial_printf("ATA: controller cannot do compatibility mode DMA, using PIO\n");
+        return;
+    }
+
+    uint64_t bar4 = pci_bar_address(&pci, 4);
+    if (!bar4) return;
+
+    prdt = (ata_prd_t*)pmm_alloc_page();
+    for (int i = 0; i < ATA_DMA_PAGES; i++) bounce[i] = (uint8_t*)pmm_alloc_page();
+
+    // PRD addresses are 32-bit
+    int usable = prdt && virt_to_phys(prdt) < 0x100000000ULL;
+    for (int i = 0; i < ATA_DMA_PAGES; i++) {
+        if (!bounce[i] || virt_to_phys(bounce[i]) >= 0x100000000ULL) usable = 0;
+    }
+    if (!usable) {
+        serial_printf("ATA: no DMA-able memory below 4GiB, using PIO\n");
+        if (prdt) pmm_free_page(prdt);
+        for (int i = 0; i < ATA_DMA_PAGES; i++) {
+            if (bounce[i]) pmm_free_page(bounce[i]);
+        }
+        prdt = NULL;
+        return;
+    }
+
+    pci_enable_bus_master(&pci);
+    bm_base = (uint16_t)bar4;
+
+    irq_register(ATA_IRQ, ata_irq_handler);
+    outb(ATA_PRIMARY_CTRL, 0); // Let the drive raise INTRQ
+
+    dev.dma = 1;
+}
+
+static int ata_rw(uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (!dev.present) return -1;
+    if (lba + count > dev.sectors) return -1;
+
+    uint32_t max = dev.dma ? ATA_DMA_MAX_SECTORS : ATA_MAX_TRANSFER;
+    int ret = 0;
+
+    mutex_lock(&channel_lock);
+    while (count > 0 && ret == 0) {
+        uint32_t chunk = count < max ? count : max;
+        ret = dev.dma ? ata_dma_transfer(lba, chunk, buf, write)
+                      : ata_transfer(lba, chunk, buf, write);
+
+        lba += chunk;
+        buf += chunk * ATA_SECTOR_SIZE;
+        count -= chunk;
+    }
+    mutex_unlock(&channel_lock);
+
+    return ret ? -1 : 0;
+}
+
+/* Block device */
+
+static int ata_block_read(block_device_t* blk, uint64_t lba, uint32_t count, uint8_t* buf) {
+    (void)blk;
+    return ata_read(lba, count, buf);
+}
+
+static int ata_block_write(block_device_t* blk, uint64_t lba, uint32_t count, const uint8_t* buf) {
+    (void)blk;
+    return ata_write(lba, count, buf);
+}
+
+static int ata_block_flush(block_device_t* blk) {
+    (void)blk;
+    return ata_flush();
+}
+
+static const block_ops_t ata_block_ops = {
+    .read = ata_block_read,
+    .write = ata_block_write,
+    .flush = ata_block_flush,
+};
+
+static block_device_t ata_block = {
+    .name = "ata0",
+    .ops = &ata_block_ops,
+};
+
+/* Public functions */
+
+int ata_init(void) {
+    if (dev.present) return 0;
+
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+
+    outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, 0xA0);
+    ata_delay();
+    outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA0, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA1, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_LBA2, 0);
+    outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay();
+
+    uint8_t status = inb(ATA_PRIMARY_IO + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) {
+        serial_printf("ATA: no drive on the primary master\n");
+        return -1;
+    }
+    if (ata_wait_not_busy()) return -1;
+
+    // ATAPI and SATA devices put their signature here and abort IDENTIFY
+    if (inb(ATA_PRIMARY_IO + ATA_REG_LBA1) || inb(ATA_PRIMARY_IO + ATA_REG_LBA2)) {
+        serial_printf("ATA: primary master is not an ATA disk\n");
+        return -1;
+    }
+    if (ata_wait_drq()) return -1;
+
+    uint16_t id[256];
+    insw(ATA_PRIMARY_IO + ATA_REG_DATA, id, 256);
+
+    dev.lba48 = (id[ATA_ID_COMMAND_SETS] >> 10) & 1;
+    dev.sectors = id[ATA_ID_LBA28_SECTORS] | ((uint64_t)id[ATA_ID_LBA28_SECTORS + 1] << 16);
+    if (dev.lba48) {
+        uint64_t sectors48 = 0;
+        for (int i = 3; i >= 0; i--) sectors48 = (sectors48 << 16) | id[ATA_ID_LBA48_SECTORS + i];
+        if (sectors48) dev.sectors = sectors48;
+    }
+
+    // Enable the largest READ/WRITE MULTIPLE block the drive supports
+    dev.multiple = 1;
+    uint8_t max_multiple = id[ATA_ID_MAX_MULTIPLE] & 0xFF;
+    if (max_multiple > 1) {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER);
+        outb(ATA_PRIMARY_IO + ATA_REG_SECCOUNT0, max_multiple);
+        outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+        ata_delay();
+
+        if (ata_wait_idle() == 0) dev.multiple = max_multiple;
+    }
+
+    ata_dma_init(id);
+
+    dev.present = 1;
+    serial_printf("ATA: %u MiB, LBA%u, %s\n", (uint32_t)(dev.sectors / 2048), dev.lba48 ? 48 : 28,
+                  dev.dma ? "bus master DMA" : "PIO");
+
+    ata_block.sectors = dev.sectors;
+    block_register(&ata_block);
+    return 0;
+}
+
+const ata_device_t* ata_device(void) {
+    return &dev;
+}
+
+int ata_read(uint64_t lba, uint32_t count, uint8_t* buf) {
+    return ata_rw(lba, count, buf, 0);
+}
+
+int ata_write(uint64_t lba, uint32_t count, const uint8_t* buf) {
+    return ata_rw(lba, count, (uint8_t*)buf, 1);
+}
+
+// Writes only reach the drive's cache, this commits them to the medium
+int ata_flush(void) {
+    if (!dev.present) return -1;
+
+    mutex_lock(&channel_lock);
+
+    int ret = ata_wait_not_busy();
+    if (ret == 0) {
+        outb(ATA_PRIMARY_IO + ATA_REG_HDDEVSEL, ATA_MASTER);
+        outb(ATA_PRIMARY_IO + ATA_REG_COMMAND, dev.lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+        ata_delay();
+        ret = ata_wait_idle();
+    }
+
+    mutex_unlock(&channel_lock);
+    return ret;
+}
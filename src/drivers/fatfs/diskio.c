@@ -1,36 +1,56 @@
 #include <fatfs/ff.h>         /* Obtains integer types */
 #include <fatfs/diskio.h>
-#include <fatfs/ata.h>
+#include <block.h>
+#include <bcache.h>
 #include <com1.h>
 #include <stdint.h>
 #include <kstring.h>
 
+// FatFs drive numbers map onto the block devices in registration order.
+// Sector I/O goes through the buffer cache.
+
 DSTATUS disk_initialize(BYTE pdrv) {
-    return 0; // Assume always ready for now
+    return block_get(pdrv) ? 0 : STA_NOINIT | STA_NODISK;
 }
 
 DSTATUS disk_status(BYTE pdrv) {
-    return 0;
+    return block_get(pdrv) ? 0 : STA_NOINIT;
 }
 
 DRESULT disk_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count) {
-    for (UINT i = 0; i < count; i++) {
-        ata_read_sector((uint32_t)(sector + i), buff + (i * 512));
-    }
-    return RES_OK;
+    block_device_t* dev = block_get(pdrv);
+    if (!dev || count == 0) return RES_PARERR;
+    return bcache_read(dev, sector, count, buff) == 0 ? RES_OK : RES_ERROR;
 }
 
+// Writes may sit in the drive's cache until FatFs asks for CTRL_SYNC
 DRESULT disk_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count) {
-    serial_printf("Sector: 0x%x\nCount: 0x%x\n");
+    block_device_t* dev = block_get(pdrv);
+    if (!dev || count == 0) return RES_PARERR;
+    return bcache_write(dev, sector, count, buff) == 0 ? RES_OK : RES_ERROR;
+}
 
-    for (UINT i = 0; i < count; i++) {
-        ata_write_sector((uint32_t)(sector + i), buff + (i * 512));
-    }
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
+    block_device_t* dev = block_get(pdrv);
+    if (!dev) return RES_PARERR;
 
+    switch (cmd) {
+        case CTRL_SYNC:
+            return bcache_flush(dev) == 0 ? RES_OK : RES_ERROR;
 
-    return RES_OK;
-}
+        case GET_SECTOR_COUNT:
+            *(LBA_t*)buff = (LBA_t)dev->sectors;
+            return RES_OK;
 
-DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff) {
-    return RES_OK; // Stubbed
-}
\ No newline at end of file
+        case GET_SECTOR_SIZE:
+            *(WORD*)buff = BLOCK_SECTOR_SIZE;
+            return RES_OK;
+
+        case GET_BLOCK_SIZE:
+            *(DWORD*)buff = 1;
+            return RES_OK;
+
+        default:
+            return RES_PARERR;
+    }
+}
@@ -22,6 +22,7 @@
 #include <kstring.h>
 #include <fatfs/ff.h>			/* Declarations of FatFs API */
 #include <fatfs/diskio.h>		/* Declarations of device I/O functions */
+#include <fatfs/pathcache.h>	/* Path lookup cache */
 
 
 /*--------------------------------------------------------------------------
@@ -936,6 +937,41 @@ static void unlock_volume (
 	}
 }
 
+
+/*-----------------------------------------------------------------------*/
+/* Read file data without holding the volume                             */
+/*-----------------------------------------------------------------------*/
+/* Only for sectors going straight into the caller's buffer: nothing other
+/  tasks share (window, FAT) is touched, so they may use the volume while
+/  the transfer is in flight and the disk can queue both requests.
+/  The sectors belong to a cluster of the file being read, resolved under
+/  the lock. It stays allocated to that file while the lock is dropped:
+/  FF_FS_LOCK refuses to unlink an open file or to open it for writing
+/  through a second object, and the caller serializes use of its own FIL
+/  (file_t lock), so no f_write or f_truncate can free the cluster. */
+
+static DRESULT disk_read_unlocked (
+	FATFS* fs,		/* Filesystem object holding the volume lock */
+	BYTE* buff,		/* Caller's data buffer */
+	LBA_t sect,		/* Start sector */
+	UINT count		/* Number of sectors */
+)
+{
+	DRESULT dr;
+
+
+#if FF_FS_LOCK
+	ff_mutex_give(fs->ldrv);
+	dr = disk_read(fs->pdrv, buff, sect, count);
+	ff_mutex_take(fs->ldrv);
+#else
+	dr = disk_read(fs->pdrv, buff, sect, count);	/* Nothing pins the cluster, keep the volume */
+#endif
+	return dr;
+}
+
+#else
+#define disk_read_unlocked(fs, buff, sect, count) disk_read((fs)->pdrv, buff, sect, count)
 #endif
 
 
@@ -2575,6 +2611,7 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			fs->wflag = 1;
+			pathcache_invalidate();
 		}
 	}
 
@@ -2610,6 +2647,7 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 				dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'. */
 			}
 			fs->wflag = 1;
+			pathcache_invalidate();
 			if (dp->dptr >= last) break;	/* If reached last entry then all entries of the object has been deleted. */
 			res = dir_next(dp, 0);	/* Next entry */
 		} while (res == FR_OK);
@@ -2621,6 +2659,7 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 	if (res == FR_OK) {
 		dp->dir[DIR_Name] = DDEM;	/* Mark the entry 'deleted'.*/
 		fs->wflag = 1;
+		pathcache_invalidate();
 	}
 #endif
 
@@ -3111,6 +3150,17 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		res = dir_sdi(dp, 0);
 
 	} else {								/* Follow path */
+		const TCHAR *full = path;
+		const pathcache_entry_t *pc = pathcache_lookup(fs, path);
+
+		if (pc) {							/* Cached: restore where the walk ended */
+			*dp = pc->dir;
+			dp->obj.fs = fs;
+			if (pc->res != FR_OK) return pc->res;
+			res = move_window(fs, dp->sect);
+			dp->dir = fs->win + dp->dptr % SS(fs);
+			return res;
+		}
 		for (;;) {
 			res = create_name(dp, &path);	/* Get a segment name of the path */
 			if (res != FR_OK) break;
@@ -3145,6 +3195,7 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 				dp->obj.sclust = ld_clust(fs, fs->win + dp->dptr % SS(fs));	/* Open next directory */
 			}
 		}
+		pathcache_insert(fs, full, dp, res);
 	}
 
 	return res;
@@ -3814,6 +3865,7 @@ FRESULT f_open (
 					st_clust(fs, dj.dir, 0);			/* Reset file allocation info */
 					st_dword(dj.dir + DIR_FileSize, 0);
 					fs->wflag = 1;
+					pathcache_invalidate();
 					if (cl != 0) {						/* Remove the cluster chain if exist */
 						sc = fs->winsect;
 						res = remove_chain(&dj.obj, cl, 0);
@@ -3977,7 +4029,7 @@ FRESULT f_read (
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
 					cc = fs->csize - csect;
 				}
-				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
+				if (disk_read_unlocked(fs, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
 #if FF_FS_TINY
 				if (fs->wflag && fs->winsect - sect < cc) {
@@ -4209,6 +4261,7 @@ FRESULT f_sync (
 					st_dword(dir + DIR_ModTime, tm);				/* Update modified time */
 					st_word(dir + DIR_LstAccDate, 0);
 					fs->wflag = 1;
+					pathcache_invalidate();
 					res = sync_fs(fs);					/* Restore it to the directory */
 					fp->flag &= (BYTE)~FA_MODIFIED;
 				}
@@ -4807,12 +4860,23 @@ FRESULT f_stat (
 	res = mount_volume(&path, &dj.obj.fs, 0);
 	if (res == FR_OK) {
 		INIT_NAMBUF(dj.obj.fs);
-		res = follow_path(&dj, path);	/* Follow the file path */
-		if (res == FR_OK) {				/* Follow completed */
-			if (dj.fn[NSFLAG] & NS_NONAME) {	/* It is origin directory */
-				res = FR_INVALID_NAME;
-			} else {							/* Found an object */
-				if (fno) get_fileinfo(&dj, fno);
+		const pathcache_entry_t *pc = pathcache_lookup(dj.obj.fs, path);
+		if (pc) {						/* Answer from the cached entry without disk access */
+			res = pc->res;
+			if (res == FR_OK && fno) {
+				DIR cd = pc->dir;
+				cd.obj.fs = dj.obj.fs;
+				cd.dir = (BYTE*)pc->dirent;
+				get_fileinfo(&cd, fno);
+			}
+		} else {
+			res = follow_path(&dj, path);	/* Follow the file path */
+			if (res == FR_OK) {				/* Follow completed */
+				if (dj.fn[NSFLAG] & NS_NONAME) {	/* It is origin directory */
+					res = FR_INVALID_NAME;
+				} else {							/* Found an object */
+					if (fno) get_fileinfo(&dj, fno);
+				}
 			}
 		}
 		FREE_NAMBUF();
@@ -5291,6 +5355,7 @@ FRESULT f_chmod (
 			{
 				dj.dir[DIR_Attr] = (attr & mask) | (dj.dir[DIR_Attr] & (BYTE)~mask);	/* Apply attribute change */
 				fs->wflag = 1;
+				pathcache_invalidate();
 			}
 			if (res == FR_OK) {
 				res = sync_fs(fs);
@@ -5336,6 +5401,7 @@ FRESULT f_utime (
 			{
 				st_dword(dj.dir + DIR_ModTime, (DWORD)fno->fdate << 16 | fno->ftime);
 				fs->wflag = 1;
+				pathcache_invalidate();
 			}
 			if (res == FR_OK) {
 				res = sync_fs(fs);
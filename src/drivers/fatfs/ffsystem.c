@@ -0,0 +1,31 @@
+#include <fatfs/ff.h>
+#include <task.h>
+
+// Tasks now sleep inside disk_read/disk_write while DMA runs, so another
+// task could enter FatFs in the meantime. Each volume (and the system lock
+// at index FF_VOLUMES) is a sleeping kernel mutex; ff.c takes it around
+// every API call.
+
+#if FF_FS_REENTRANT
+
+static mutex_t volume_locks[FF_VOLUMES + 1];
+
+int ff_mutex_create(int vol) {
+    (void)vol; // Statically initialized, and f_mount only runs at boot
+    return 1;
+}
+
+void ff_mutex_delete(int vol) {
+    (void)vol;
+}
+
+int ff_mutex_take(int vol) {
+    mutex_lock(&volume_locks[vol]);
+    return 1;
+}
+
+void ff_mutex_give(int vol) {
+    mutex_unlock(&volume_locks[vol]);
+}
+
+#endif
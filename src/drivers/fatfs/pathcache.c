@@ -0,0 +1,84 @@
+#include <fatfs/pathcache.h>
+#include <kstring.h>
+
+static pathcache_entry_t cache[PATHCACHE_SIZE];
+
+// Bumping the generation drops every entry at once
+static uint32_t generation = 1;
+
+/* Helper functions */
+
+// Build the lookup key: no leading, trailing or repeated separators and
+// upper-cased, which is how FatFs compares short names. Returns 0 when the
+// path cannot be cached (too long, or has dot segments).
+static int pathcache_key(const TCHAR* path, char* key, uint32_t* hash) {
+    uint32_t h = 2166136261u; // FNV-1a
+    int len = 0;
+
+    while (*path) {
+        while (*path == '/' || *path == '\\') path++;
+        if (!*path) break;
+        if (*path == '.') return 0;
+
+        if (len) {
+            if (len >= PATHCACHE_PATH_MAX - 1) return 0;
+            key[len++] = '/';
+            h = (h ^ '/') * 16777619u;
+        }
+
+        while (*path && *path != '/' && *path != '\\') {
+            char c = *path++;
+            if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+            if (len >= PATHCACHE_PATH_MAX - 1) return 0;
+
+            key[len++] = c;
+            h = (h ^ (uint8_t)c) * 16777619u;
+        }
+    }
+
+    if (len == 0) return 0; // The root itself is never looked up by name
+
+    key[len] = '\0';
+    *hash = h;
+    return 1;
+}
+
+/* Cache functions */
+
+const pathcache_entry_t* pathcache_lookup(FATFS* fs, const TCHAR* path) {
+    char key[PATHCACHE_PATH_MAX];
+    uint32_t hash;
+    if (!pathcache_key(path, key, &hash)) return NULL;
+
+    pathcache_entry_t* e = &cache[hash % PATHCACHE_SIZE];
+    if (e->gen != generation || e->fs_id != fs->id || e->hash != hash) return NULL;
+    if (strcmp(e->path, key) != 0) return NULL;
+
+    return e;
+}
+
+void pathcache_insert(FATFS* fs, const TCHAR* path, const DIR* dp, FRESULT res) {
+    if (res != FR_OK && res != FR_NO_FILE && res != FR_NO_PATH) return;
+
+    char key[PATHCACHE_PATH_MAX];
+    uint32_t hash;
+    if (!pathcache_key(path, key, &hash)) return;
+
+    pathcache_entry_t* e = &cache[hash % PATHCACHE_SIZE];
+    e->gen = generation;
+    e->fs_id = fs->id;
+    e->hash = hash;
+    e->res = res;
+    e->dir = *dp;
+    e->dir.dir = NULL;
+    strcpy(e->path, key);
+
+    if (res == FR_OK) {
+        memcpy(e->dirent, dp->dir, PATHCACHE_DIRENT);
+    }
+}
+
+// Called whenever FatFs rewrites a directory entry
+void pathcache_invalidate(void) {
+    generation++;
+}
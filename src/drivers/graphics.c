@@ -12,6 +12,7 @@ void graphics_init() {
     if (framebuffer_request.response == NULL
      || framebuffer_request.response->framebuffer_count < 1) {
         serial_printf("FATAL: No framebuffer found!\n");
+        serial_panic();
         while(1); 
     }
 
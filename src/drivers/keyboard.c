@@ -1,4 +1,5 @@
 #include <keyboard.h>
+#include <idt.h>
 
 static uint16_t keyboard_ring_buffer[KEYBOARD_RING_BUFFER_SIZE];
 static volatile uint16_t kb_head = 0;
@@ -11,6 +12,10 @@ static int mod_super = 0;
 
 static int e0_prefix = 0; // Extended scan code state
 
+// Every sys_wait_events(EVENT_KEY) caller sleeps here, the IRQ wakes them
+// all when a key is buffered
+static wait_queue_t key_wq = {0};
+
 static char scancode_map[128] = {
     0,  27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
     '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
@@ -28,7 +33,7 @@ static char scancode_map_shifted[128] = {
 };
 
 void keyboard_init(void) {
-    pic_enable_irq(1);
+    irq_register(IRQ_KEYBOARD - ISR_COUNT, keyboard_handler);
 
     serial_printf("Keyboard driver installed (PIC 1 unmasked)\n");
 }
@@ -39,6 +44,8 @@ void keyboard_buffer_write(uint16_t data) {
     if (next_head != kb_tail) {
         keyboard_ring_buffer[kb_head] = data;
         kb_head = next_head;
+
+        if (key_wq.head) wait_queue_wake_all(&key_wq);
     }
 }
 
@@ -52,6 +59,14 @@ uint16_t keyboard_read_key(void) {
     return val;
 }
 
+int keyboard_has_key(void) {
+    return kb_head != kb_tail;
+}
+
+wait_queue_t* keyboard_wait_queue(void) {
+    return &key_wq;
+}
+
 void keyboard_handler(void) {
     uint8_t status = inb(KEYBOARD_STATUS_PORT);
 
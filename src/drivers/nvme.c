@@ -0,0 +1,594 @@
+#include <stdint.h>
+#include <io.h>
+#include <com1.h>
+#include <pci.h>
+#include <idt.h>
+#include <vmm.h>
+#include <task.h>
+#include <timer.h>
+#include <kstring.h>
+#include <block.h>
+#include <nvme.h>
+
+// Completion polls before giving up, while there is no clock yet
+#define NVME_SPIN_LIMIT 10000000
+
+#define SLOT(n) (1u << (n))
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+// A submission/completion queue pair
+typedef struct {
+    uint16_t id;
+    uint16_t size;
+    nvme_cmd_t* sq;
+    nvme_cqe_t* cq;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    uint16_t phase;                 // Phase tag of new completions
+    volatile uint32_t* sq_doorbell;
+    volatile uint32_t* cq_doorbell;
+} nvme_queue_t;
+
+typedef struct {
+    uint32_t remaining;             // Commands of one request still in flight
+} nvme_batch_t;
+
+// The kernel runs on one CPU, so there is one I/O queue pair. Its state
+// changes with interrupts off, from the requester or the interrupt handler.
+typedef struct {
+    block_device_t blk;
+    volatile uint8_t* regs;
+    volatile uint8_t* doorbells;
+    uint64_t cap;
+    int irq_ok;
+    int broken;                     // A command timed out, the disk is given up on
+    int vwc;                        // Volatile write cache, flushes mean something
+
+    nvme_queue_t admin;
+    nvme_queue_t io;
+
+    uint32_t nr_slots;
+    uint32_t max_pages;             // Per command: NVME_SLOT_PAGES or less by MDTS
+    uint8_t* pages[NVME_MAX_SLOTS][NVME_SLOT_PAGES];
+    uint64_t* prp_list[NVME_MAX_SLOTS];
+    nvme_batch_t* batch[NVME_MAX_SLOTS];
+    uint16_t status[NVME_MAX_SLOTS];
+
+    uint32_t allocated;             // Slots owned by a request
+    uint32_t issued;                // Slots at the controller
+    wait_queue_t done_wq;
+    wait_queue_t slot_wq;
+} nvme_ctrl_t;
+
+static nvme_ctrl_t ctrl;
+
+/* Helpers */
+
+static inline uint32_t reg_read32(uint32_t reg) {
+    return *(volatile uint32_t*)(ctrl.regs + reg);
+}
+
+static inline void reg_write32(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(ctrl.regs + reg) = value;
+}
+
+static inline uint64_t reg_read64(uint32_t reg) {
+    return reg_read32(reg) | ((uint64_t)reg_read32(reg + 4) << 32);
+}
+
+static inline void reg_write64(uint32_t reg, uint64_t value) {
+    reg_write32(reg, (uint32_t)value);
+    reg_write32(reg + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+static int can_sleep(void) {
+    return ctrl.irq_ok && current_task && current_task->pid != 0;
+}
+
+static void queue_init(nvme_queue_t* q, uint16_t id, uint16_t size, void* sq, void* cq) {
+    uint32_t stride = 4u << NVME_CAP_DSTRD(ctrl.cap);
+
+    q->id = id;
+    q->size = size;
+    q->sq = (nvme_cmd_t*)sq;
+    q->cq = (nvme_cqe_t*)cq;
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = 1;
+    q->sq_doorbell = (volatile uint32_t*)(ctrl.doorbells + (2 * id) * stride);
+    q->cq_doorbell = (volatile uint32_t*)(ctrl.doorbells + (2 * id + 1) * stride);
+}
+
+// Copies cmd to the tail of the submission queue. The controller does not
+// see it before the doorbell is written.
+static void queue_push(nvme_queue_t* q, const nvme_cmd_t* cmd) {
+    q->sq[q->sq_tail] = *cmd;
+    q->sq_tail = (q->sq_tail + 1) % q->size;
+}
+
+static void queue_ring(nvme_queue_t* q) {
+    asm volatile("" ::: "memory"); // Entries before the doorbell
+    *q->sq_doorbell = q->sq_tail;
+}
+
+// Returns the next new completion, or NULL
+static nvme_cqe_t* queue_peek(nvme_queue_t* q) {
+    nvme_cqe_t* e = &q->cq[q->cq_head];
+    if ((e->status & 1) != q->phase) return NULL;
+
+    asm volatile("" ::: "memory"); // Entry after its phase tag
+    return e;
+}
+
+static void queue_pop(nvme_queue_t* q) {
+    if (++q->cq_head == q->size) {
+        q->cq_head = 0;
+        q->phase ^= 1;
+    }
+}
+
+/* Admin commands */
+
+// Runs one admin command and polls for it. Only used during bring-up.
+static int admin_cmd(nvme_cmd_t* cmd, uint32_t* result) {
+    nvme_queue_t* q = &ctrl.admin;
+
+    cmd->cid = q->sq_tail;
+    queue_push(q, cmd);
+    queue_ring(q);
+
+    for (int i = 0; i < NVME_SPIN_LIMIT; i++) {
+        nvme_cqe_t* e = queue_peek(q);
+        if (!e) continue;
+
+        uint16_t status = e->status >> 1;
+        if (result) *result = e->result;
+        queue_pop(q);
+        *q->cq_doorbell = q->cq_head;
+
+        if (status) serial_printf("NVME: admin opcode 0x%x failed, status 0x%x\n", cmd->opcode, status);
+        return status ? -1 : 0;
+    }
+
+    serial_printf("NVME: admin opcode 0x%x timed out\n", cmd->opcode);
+    return -1;
+}
+
+static int identify(uint32_t cns, uint32_t nsid, void* buf) {
+    nvme_cmd_t cmd = { 0 };
+    cmd.opcode = NVME_ADMIN_IDENTIFY;
+    cmd.nsid = nsid;
+    cmd.prp1 = virt_to_phys(buf);
+    cmd.cdw10 = cns;
+    return admin_cmd(&cmd, NULL);
+}
+
+/* Completion */
+
+// Runs with interrupts off, from the IRQ handler or the polling loop
+static void nvme_reap(void) {
+    nvme_queue_t* q = &ctrl.io;
+    int reaped = 0;
+    int finished = 0;
+
+    nvme_cqe_t* e;
+    while ((e = queue_peek(q)) != NULL) {
+        uint16_t slot = e->cid;
+        if (slot < ctrl.nr_slots && (ctrl.issued & SLOT(slot))) {
+            ctrl.issued &= ~SLOT(slot);
+            ctrl.status[slot] = e->status >> 1;
+            if (--ctrl.batch[slot]->remaining == 0) finished = 1;
+        }
+        queue_pop(q);
+        reaped = 1;
+    }
+
+    // Also lets the controller drop the (level-triggered) interrupt
+    if (reaped) *q->cq_doorbell = q->cq_head;
+    if (finished) wait_queue_wake_all(&ctrl.done_wq);
+}
+
+static void nvme_irq_handler(void) {
+    nvme_reap();
+}
+
+// Sleeps until the interrupt, or polls the completion queue and yields in
+// between (poll mode, the root task). Before the scheduler only a spin
+// count bounds the wait.
+static int nvme_wait(nvme_batch_t* batch) {
+    uint64_t deadline = kdata_ticks() + timer_ns_to_ticks(NVME_TIMEOUT_NS);
+
+    if (can_sleep()) {
+        int timed_out = 0;
+        while (batch->remaining && !timed_out) {
+            timed_out = wait_queue_sleep_until(&ctrl.done_wq, deadline);
+        }
+    } else {
+        for (int i = 0; batch->remaining; i++) {
+            nvme_reap();
+            if (!batch->remaining) break;
+
+            if (current_task) {
+                if (kdata_ticks() >= deadline) break;
+                scheduler_yield();
+            } else if (i >= NVME_SPIN_LIMIT) {
+                break;
+            }
+        }
+    }
+
+    if (batch->remaining) {
+        serial_printf("NVME: command timed out, disabling the disk\n");
+        ctrl.broken = 1;
+
+        // The batch lives on the requester's stack, late completions must not find it
+        for (uint32_t i = 0; i < ctrl.nr_slots; i++) {
+            if ((ctrl.issued & SLOT(i)) && ctrl.batch[i] == batch) ctrl.issued &= ~SLOT(i);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Slots */
+
+// Called with interrupts off. Without may_wait, returns -1 instead of
+// blocking when every slot is taken.
+static int slot_alloc(int may_wait) {
+    while (1) {
+        uint32_t all = ctrl.nr_slots == 32 ? 0xFFFFFFFF : SLOT(ctrl.nr_slots) - 1;
+        uint32_t free = ~ctrl.allocated & all;
+
+        if (free) {
+            int slot = __builtin_ctz(free);
+            ctrl.allocated |= SLOT(slot);
+            return slot;
+        }
+
+        if (!may_wait) return -1;
+        if (current_task && current_task->pid != 0) wait_queue_sleep(&ctrl.slot_wq);
+        else if (current_task) scheduler_yield();
+        else return -1;
+    }
+}
+
+static void slot_free(uint32_t mask) {
+    ctrl.allocated &= ~mask;
+    wait_queue_wake_all(&ctrl.slot_wq);
+}
+
+/* Requests */
+
+// PRP1 is the first page. A second page goes into PRP2 directly, more than
+// that into the slot's PRP list, which PRP2 then points at.
+static void submit(int slot, uint8_t opcode, uint64_t lba, uint32_t count,
+                   uint32_t bytes, nvme_batch_t* batch) {
+    nvme_cmd_t cmd = { 0 };
+    cmd.opcode = opcode;
+    cmd.cid = slot;
+    cmd.nsid = NVME_NSID;
+
+    if (bytes) {
+        uint32_t nr_pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+        cmd.prp1 = virt_to_phys(ctrl.pages[slot][0]);
+
+        if (nr_pages == 2) {
+            cmd.prp2 = virt_to_phys(ctrl.pages[slot][1]);
+        } else if (nr_pages > 2) {
+            for (uint32_t i = 1; i < nr_pages; i++) {
+                ctrl.prp_list[slot][i - 1] = virt_to_phys(ctrl.pages[slot][i]);
+            }
+            cmd.prp2 = virt_to_phys(ctrl.prp_list[slot]);
+        }
+
+        cmd.cdw10 = (uint32_t)lba;
+        cmd.cdw11 = (uint32_t)(lba >> 32);
+        cmd.cdw12 = count - 1; // Zero based
+    }
+
+    ctrl.batch[slot] = batch;
+    batch->remaining++;
+    ctrl.issued |= SLOT(slot);
+    queue_push(&ctrl.io, &cmd);
+}
+
+static void copy_pages(int slot, uint8_t* buf, uint32_t bytes, int to_device) {
+    for (uint32_t off = 0, i = 0; off < bytes; off += PAGE_SIZE, i++) {
+        uint32_t len = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+        if (to_device) memcpy(ctrl.pages[slot][i], buf + off, len);
+        else memcpy(buf + off, ctrl.pages[slot][i], len);
+    }
+}
+
+// Splits the request into slot-sized commands, queues as many as there are
+// free slots behind one doorbell write, then waits for all of them. A
+// request never waits for a slot while it holds others.
+static int nvme_rw(uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (ctrl.broken || lba + count > ctrl.blk.sectors) return -1;
+
+    uint32_t max = ctrl.max_pages * PAGE_SIZE / BLOCK_SECTOR_SIZE;
+    uint8_t opcode = write ? NVME_CMD_WRITE : NVME_CMD_READ;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    int ret = 0;
+    while (count > 0 && ret == 0) {
+        nvme_batch_t batch = { 0 };
+        int slots[NVME_MAX_SLOTS];
+        uint32_t lens[NVME_MAX_SLOTS];
+        uint32_t mask = 0;
+        int n = 0;
+        uint8_t* batch_buf = buf;
+
+        while (count > 0) {
+            int slot = slot_alloc(n == 0);
+            if (slot < 0) break;
+
+            uint32_t chunk = count < max ? count : max;
+            uint32_t bytes = chunk * BLOCK_SECTOR_SIZE;
+            if (write) copy_pages(slot, buf, bytes, 1);
+            submit(slot, opcode, lba, chunk, bytes, &batch);
+
+            slots[n] = slot;
+            lens[n++] = bytes;
+            mask |= SLOT(slot);
+
+            lba += chunk;
+            buf += bytes;
+            count -= chunk;
+        }
+        if (n == 0 || ctrl.broken) {
+            ret = -1;
+            break;
+        }
+
+        queue_ring(&ctrl.io);
+        if (nvme_wait(&batch) != 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (ctrl.status[slots[i]]) {
+                serial_printf("NVME: I/O failed, status 0x%x\n", ctrl.status[slots[i]]);
+                ret = -1;
+            }
+        }
+        if (ret == 0 && !write) {
+            for (int i = 0; i < n; i++) {
+                copy_pages(slots[i], batch_buf, lens[i], 0);
+                batch_buf += lens[i];
+            }
+        }
+        slot_free(mask);
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return ret;
+}
+
+/* Block device */
+
+static int nvme_block_read(block_device_t* blk, uint64_t lba, uint32_t count, uint8_t* buf) {
+    (void)blk;
+    return nvme_rw(lba, count, buf, 0);
+}
+
+static int nvme_block_write(block_device_t* blk, uint64_t lba, uint32_t count, const uint8_t* buf) {
+    (void)blk;
+    return nvme_rw(lba, count, (uint8_t*)buf, 1);
+}
+
+// Without a volatile write cache completed writes are already durable
+static int nvme_block_flush(block_device_t* blk) {
+    (void)blk;
+    if (!ctrl.vwc) return 0;
+    if (ctrl.broken) return -1;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    nvme_batch_t batch = { 0 };
+    int ret = -1;
+    int slot = slot_alloc(1);
+    if (slot >= 0) {
+        submit(slot, NVME_CMD_FLUSH, 0, 0, 0, &batch);
+        queue_ring(&ctrl.io);
+        if (nvme_wait(&batch) == 0) {
+            ret = ctrl.status[slot] ? -1 : 0;
+            slot_free(SLOT(slot));
+        }
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return ret;
+}
+
+static const block_ops_t nvme_block_ops = {
+    .read = nvme_block_read,
+    .write = nvme_block_write,
+    .flush = nvme_block_flush,
+};
+
+/* Initialization */
+
+// Waits up to CAP.TO for CSTS.RDY to match ready
+static int wait_ready(int ready) {
+    uint64_t limit = (uint64_t)(NVME_CAP_TO(ctrl.cap) + 1) * 500 * 1000; // ~1us per port read
+    for (uint64_t i = 0; i < limit; i++) {
+        uint32_t csts = reg_read32(NVME_CSTS);
+        if (csts & NVME_CSTS_CFS) return -1;
+        if ((csts & NVME_CSTS_RDY) == (ready ? NVME_CSTS_RDY : 0)) return 0;
+        inb(0x80);
+    }
+    return -1;
+}
+
+// Resets the controller and brings it back up with the admin queue pair
+static int enable_controller(void) {
+    if (reg_read32(NVME_CC) & NVME_CC_EN) {
+        reg_write32(NVME_CC, 0);
+        if (wait_ready(0) != 0) return -1;
+    }
+
+    void* asq = pmm_alloc_page();
+    void* acq = pmm_alloc_page();
+    if (!asq || !acq) return -1;
+    memset(asq, 0, PAGE_SIZE);
+    memset(acq, 0, PAGE_SIZE);
+    queue_init(&ctrl.admin, 0, NVME_ADMIN_ENTRIES, asq, acq);
+
+    reg_write32(NVME_AQA, ((NVME_ADMIN_ENTRIES - 1) << 16) | (NVME_ADMIN_ENTRIES - 1));
+    reg_write64(NVME_ASQ, virt_to_phys(asq));
+    reg_write64(NVME_ACQ, virt_to_phys(acq));
+
+    // NVM command set, 4KiB pages, round robin arbitration
+    reg_write32(NVME_CC, NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_EN);
+    return wait_ready(1);
+}
+
+// Reads the namespace size and transfer limit. Only 512-byte blocks are
+// supported, that is what FatFs and the block layer speak.
+static int identify_disk(void) {
+    uint8_t* id = (uint8_t*)pmm_alloc_page();
+    if (!id) return -1;
+
+    int ret = -1;
+    if (identify(NVME_CNS_CONTROLLER, 0, id) == 0) {
+        uint8_t mdts = id[NVME_ID_CTRL_MDTS];
+        ctrl.max_pages = NVME_SLOT_PAGES;
+        if (mdts && mdts < 8 && (1u << mdts) < ctrl.max_pages) ctrl.max_pages = 1u << mdts;
+        ctrl.vwc = id[NVME_ID_CTRL_VWC] & 1;
+
+        if (identify(NVME_CNS_NAMESPACE, NVME_NSID, id) == 0) {
+            uint8_t format = id[NVME_ID_NS_FLBAS] & 0xF;
+            uint32_t lbaf = *(uint32_t*)(id + NVME_ID_NS_LBAF + 4 * format);
+
+            if (((lbaf >> 16) & 0xFF) == 9) {
+                ctrl.blk.sectors = *(uint64_t*)(id + NVME_ID_NS_NSZE);
+                ret = 0;
+            } else {
+                serial_printf("NVME: namespace block size is not 512 bytes\n");
+            }
+        }
+    }
+
+    pmm_free_page(id);
+    return ret;
+}
+
+// Creates I/O queue pair 1 and the per-slot bounce and PRP list pages.
+// Slots that cannot get their pages are left out.
+static int create_io_queues(int use_irq) {
+    uint16_t size = NVME_IO_ENTRIES;
+    if (size > NVME_CAP_MQES(ctrl.cap)) size = NVME_CAP_MQES(ctrl.cap);
+
+    void* sq = pmm_alloc_page();
+    void* cq = pmm_alloc_page();
+    if (!sq || !cq) return -1;
+    memset(sq, 0, PAGE_SIZE);
+    memset(cq, 0, PAGE_SIZE);
+    queue_init(&ctrl.io, 1, size, sq, cq);
+
+    nvme_cmd_t cmd = { 0 };
+    cmd.opcode = NVME_ADMIN_SET_FEATURES;
+    cmd.cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd.cdw11 = 0; // One submission and one completion queue, zero based
+    if (admin_cmd(&cmd, NULL) != 0) return -1;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_CQ;
+    cmd.prp1 = virt_to_phys(cq);
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | ctrl.io.id;
+    cmd.cdw11 = NVME_QUEUE_PC | (use_irq ? NVME_QUEUE_IEN : 0); // Vector 0
+    if (admin_cmd(&cmd, NULL) != 0) return -1;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.opcode = NVME_ADMIN_CREATE_SQ;
+    cmd.prp1 = virt_to_phys(sq);
+    cmd.cdw10 = ((uint32_t)(size - 1) << 16) | ctrl.io.id;
+    cmd.cdw11 = ((uint32_t)ctrl.io.id << 16) | NVME_QUEUE_PC;
+    if (admin_cmd(&cmd, NULL) != 0) return -1;
+
+    // One entry stays free so a full queue never looks empty
+    ctrl.nr_slots = size - 1 < NVME_MAX_SLOTS ? size - 1 : NVME_MAX_SLOTS;
+
+    for (uint32_t s = 0; s < ctrl.nr_slots; s++) {
+        int ok = (ctrl.prp_list[s] = (uint64_t*)pmm_alloc_page()) != NULL;
+        for (uint32_t i = 0; ok && i < ctrl.max_pages; i++) {
+            ok = (ctrl.pages[s][i] = (uint8_t*)pmm_alloc_page()) != NULL;
+        }
+        if (!ok) {
+            if (ctrl.prp_list[s]) pmm_free_page(ctrl.prp_list[s]);
+            for (uint32_t i = 0; i < ctrl.max_pages; i++) {
+                if (ctrl.pages[s][i]) pmm_free_page(ctrl.pages[s][i]);
+            }
+            ctrl.nr_slots = s;
+            break;
+        }
+    }
+    return ctrl.nr_slots ? 0 : -1;
+}
+
+int nvme_init(void) {
+    pci_device_t pci;
+    int found = 0;
+    for (int i = 0; pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_NVM, i, &pci) == 0; i++) {
+        if (pci.prog_if == NVME_PROG_IF) {
+            found = 1;
+            break;
+        }
+    }
+    if (!found) return 0;
+
+    uint64_t bar = pci_bar_address(&pci, NVME_BAR);
+    if (!bar) return 0;
+
+    memset(&ctrl, 0, sizeof(ctrl));
+    pci_enable_bus_master(&pci);
+
+    ctrl.regs = (volatile uint8_t*)vmm_map_mmio(bar, NVME_DOORBELLS);
+    if (!ctrl.regs) return 0;
+    ctrl.cap = reg_read64(NVME_CAP);
+    if (NVME_CAP_MPSMIN(ctrl.cap) != 0) {
+        serial_printf("NVME: controller does not support 4KiB pages\n");
+        return 0;
+    }
+
+    // Doorbells of the admin queue and I/O queue 1
+    uint32_t stride = 4u << NVME_CAP_DSTRD(ctrl.cap);
+    ctrl.doorbells = (volatile uint8_t*)vmm_map_mmio(bar + NVME_DOORBELLS, 4 * stride);
+    if (!ctrl.doorbells) return 0;
+
+    int use_irq = !NVME_POLLED && pci.irq_line < 16;
+
+    if (enable_controller() != 0) {
+        serial_printf("NVME: controller did not become ready\n");
+        return 0;
+    }
+    if (identify_disk() != 0 || create_io_queues(use_irq) != 0) {
+        serial_printf("NVME: setup failed\n");
+        reg_write32(NVME_CC, 0);
+        return 0;
+    }
+
+    if (use_irq && irq_register(pci.irq_line, nvme_irq_handler) == 0) ctrl.irq_ok = 1;
+
+    ctrl.blk.name = "nvme0";
+    ctrl.blk.ops = &nvme_block_ops;
+    ctrl.blk.priv = &ctrl;
+
+    serial_printf("NVME: %u MiB, %u slots of %u pages, %s completion\n",
+                  (uint32_t)(ctrl.blk.sectors / 2048), ctrl.nr_slots, ctrl.max_pages,
+                  ctrl.irq_ok ? "interrupt" : "polled");
+
+    block_register(&ctrl.blk);
+    return 1;
+}
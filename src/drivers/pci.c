@@ -0,0 +1,141 @@
+#include <pci.h>
+
+static pci_device_t devices[PCI_MAX_DEVICES];
+static int nr_devices = 0;
+
+/* Configuration space access (mechanism #1) */
+
+static uint32_t config_address(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)dev << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t config_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, dev, func, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset) {
+    return config_read32(dev->bus, dev->dev, dev->func, offset);
+}
+
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(const pci_device_t* dev, uint8_t offset) {
+    return (uint8_t)(pci_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(dev->bus, dev->dev, dev->func, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value) {
+    uint32_t word = pci_read32(dev, offset);
+    int shift = (offset & 2) * 8;
+
+    word &= ~(0xFFFFu << shift);
+    word |= (uint32_t)value << shift;
+    pci_write32(dev, offset, word);
+}
+
+/* Enumeration */
+
+static void add_function(uint8_t bus, uint8_t dev, uint8_t func) {
+    if (nr_devices == PCI_MAX_DEVICES) return;
+
+    pci_device_t* d = &devices[nr_devices++];
+    d->bus = bus;
+    d->dev = dev;
+    d->func = func;
+
+    uint32_t id = pci_read32(d, PCI_VENDOR_ID);
+    d->vendor = id & 0xFFFF;
+    d->device = id >> 16;
+
+    uint32_t class_rev = pci_read32(d, PCI_CLASS_REVISION);
+    d->class_code = class_rev >> 24;
+    d->subclass = (class_rev >> 16) & 0xFF;
+    d->prog_if = (class_rev >> 8) & 0xFF;
+    d->irq_line = pci_read32(d, PCI_INTERRUPT_LINE) & 0xFF;
+
+    serial_printf("PCI: %x:%x.%u %x:%x class %x.%x irq %u\n",
+                  bus, dev, func, d->vendor, d->device, d->class_code, d->subclass, d->irq_line);
+}
+
+void pci_init(void) {
+    nr_devices = 0;
+
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t dev = 0; dev < 32; dev++) {
+            if ((config_read32(bus, dev, 0, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) continue;
+
+            // Bit 7 of the header type marks multi-function devices
+            uint8_t header = (config_read32(bus, dev, 0, PCI_HEADER_TYPE) >> 16) & 0xFF;
+            uint8_t nr_funcs = (header & 0x80) ? 8 : 1;
+
+            for (uint8_t func = 0; func < nr_funcs; func++) {
+                if ((config_read32(bus, dev, func, PCI_VENDOR_ID) & 0xFFFF) == 0xFFFF) continue;
+                add_function(bus, dev, func);
+            }
+        }
+    }
+
+    serial_printf("PCI: %u functions\n", nr_devices);
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, int index, pci_device_t* out) {
+    for (int i = 0; i < nr_devices; i++) {
+        if (devices[i].class_code != class_code || devices[i].subclass != subclass) continue;
+        if (index-- > 0) continue;
+
+        *out = devices[i];
+        return 0;
+    }
+    return -1;
+}
+
+int pci_find_device(uint16_t vendor, uint16_t device, int index, pci_device_t* out) {
+    for (int i = 0; i < nr_devices; i++) {
+        if (devices[i].vendor != vendor || devices[i].device != device) continue;
+        if (index-- > 0) continue;
+
+        *out = devices[i];
+        return 0;
+    }
+    return -1;
+}
+
+// Walks the capability list. Pass 0 to start at the head, or a previous
+// result to find the next capability with the same ID.
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t cap_id, uint8_t prev) {
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+
+    uint8_t offset = prev ? pci_read8(dev, prev + 1) : pci_read8(dev, PCI_CAPABILITY_LIST);
+    for (int guard = 0; offset && guard < 48; guard++) {
+        offset &= ~0x3;
+        if (pci_read8(dev, offset) == cap_id) return offset;
+        offset = pci_read8(dev, offset + 1);
+    }
+    return 0;
+}
+
+uint64_t pci_bar_address(const pci_device_t* dev, int bar) {
+    uint32_t low = pci_read32(dev, PCI_BAR(bar));
+
+    if (low & PCI_BAR_IO) return low & ~0x3u;
+
+    uint64_t addr = low & ~0xFu;
+    if ((low & 0x6) == PCI_BAR_MEM_64 && bar < 5) {
+        addr |= (uint64_t)pci_read32(dev, PCI_BAR(bar + 1)) << 32;
+    }
+    return addr;
+}
+
+void pci_enable_bus_master(const pci_device_t* dev) {
+    uint16_t cmd = pci_read16(dev, PCI_COMMAND);
+    cmd |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER;
+    pci_write16(dev, PCI_COMMAND, cmd);
+}
@@ -2,11 +2,17 @@
 #include <task.h>
 #include <idt.h>
 #include <io.h>
+#include <kdata.h>
+#include <timer.h>
 
 #define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
 #define PIT_COMMAND  0x43
+#define PIT_GATE_PORT 0x61
 #define PIT_FREQUENCY 1193182  
 
+#define PIT_CALIBRATE_MS 10
+
 void pit_init(uint32_t frequency) {
     if (frequency == 0) frequency = 100; 
 
@@ -19,7 +25,36 @@ void pit_init(uint32_t frequency) {
     serial_printf("PIT initialized at %d Hz\n", frequency);
 }
 
+// Measures the TSC frequency against a one-shot countdown on channel 2
+uint64_t pit_calibrate_tsc(void) {
+    uint16_t count = PIT_FREQUENCY / (1000 / PIT_CALIBRATE_MS);
+    uint8_t gate = inb(PIT_GATE_PORT);
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    // Gate low and speaker off while programming mode 0
+    outb(PIT_GATE_PORT, gate & ~0x03);
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    // Raising the gate starts the countdown, OUT2 goes high when it expires
+    outb(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20));
+    uint64_t end = rdtsc();
+
+    outb(PIT_GATE_PORT, gate);
+    if (flags & 0x200) asm volatile("sti");
+
+    return (end - start) * (1000 / PIT_CALIBRATE_MS);
+}
+
 uint64_t pit_handler(uint64_t current_rsp) {
+    kdata_tick();
+    timer_tick();
+
     // Ask scheduler for next stack
     return scheduler_schedule(current_rsp);
 }
@@ -0,0 +1,604 @@
+#include <stdint.h>
+#include <com1.h>
+#include <pci.h>
+#include <idt.h>
+#include <vmm.h>
+#include <task.h>
+#include <timer.h>
+#include <kstring.h>
+#include <block.h>
+#include <virtio_blk.h>
+
+// Register polls before giving up on the device
+#define VIRTIO_SPIN_LIMIT 10000000
+
+#define SLOT(n) (1u << (n))
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+// Chunks of one request still at the device. The requester sleeps until
+// this drops to zero.
+typedef struct {
+    uint32_t remaining;
+} vblk_batch_t;
+
+// One virtio-blk device with a single request queue. Queue state changes
+// with interrupts off, from the requester or the interrupt handler.
+typedef struct {
+    block_device_t blk;
+    char name[8];
+    uint8_t irq_line;
+    int irq_ok;
+    int broken;                     // A request timed out, the device is given up on
+
+    volatile uint8_t* common;
+    volatile uint8_t* isr;
+    volatile uint8_t* config;
+    volatile uint16_t* notify;      // Doorbell of queue 0
+
+    uint64_t features;              // Negotiated
+    uint16_t qsize;
+    virtq_desc_t* desc;
+    virtq_avail_t* avail;
+    virtq_used_t* used;
+    uint16_t avail_idx;             // Shadow of avail->idx, published by kick()
+    uint16_t last_used;             // Next used entry to reap
+
+    uint32_t nr_slots;
+    uint32_t segs;                  // Data pages per request
+    uint32_t ring_per_req;          // Ring descriptors per request, 1 with indirect ones
+    uint8_t* meta;                  // VIRTIO_BLK_META_SIZE bytes per slot
+    uint8_t* pages[VIRTIO_BLK_MAX_REQS][VIRTIO_BLK_SEGS];
+    vblk_batch_t* batch[VIRTIO_BLK_MAX_REQS];
+
+    uint32_t allocated;             // Slots owned by a request
+    uint32_t issued;                // Slots at the device
+    wait_queue_t done_wq;
+    wait_queue_t slot_wq;
+} vblk_t;
+
+static vblk_t devs[VIRTIO_BLK_MAX_DEVS];
+static int nr_devs = 0;
+
+/* Helpers */
+
+static inline uint8_t read8(volatile uint8_t* base, uint32_t off) {
+    return *(volatile uint8_t*)(base + off);
+}
+
+static inline uint16_t read16(volatile uint8_t* base, uint32_t off) {
+    return *(volatile uint16_t*)(base + off);
+}
+
+static inline uint32_t read32(volatile uint8_t* base, uint32_t off) {
+    return *(volatile uint32_t*)(base + off);
+}
+
+static inline void write8(volatile uint8_t* base, uint32_t off, uint8_t value) {
+    *(volatile uint8_t*)(base + off) = value;
+}
+
+static inline void write16(volatile uint8_t* base, uint32_t off, uint16_t value) {
+    *(volatile uint16_t*)(base + off) = value;
+}
+
+static inline void write32(volatile uint8_t* base, uint32_t off, uint32_t value) {
+    *(volatile uint32_t*)(base + off) = value;
+}
+
+static inline void write64(volatile uint8_t* base, uint32_t off, uint64_t value) {
+    write32(base, off, (uint32_t)value);
+    write32(base, off + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+static inline int has_feature(vblk_t* d, int bit) {
+    return (d->features >> bit) & 1;
+}
+
+// Tasks sleep until the queue interrupt. Before the scheduler runs, in the
+// root task, and without a usable IRQ line the used ring is polled.
+static int can_sleep(vblk_t* d) {
+    return d->irq_ok && current_task && current_task->pid != 0;
+}
+
+// With EVENT_IDX, used_event trails the available ring and avail_event
+// trails the used ring
+static inline volatile uint16_t* used_event(vblk_t* d) {
+    return (volatile uint16_t*)((uint8_t*)d->avail + 4 + 2 * d->qsize);
+}
+
+static inline volatile uint16_t* avail_event(vblk_t* d) {
+    return (volatile uint16_t*)((uint8_t*)d->used + 4 + 8 * d->qsize);
+}
+
+/* Completion */
+
+// Asks for the next interrupt only once the request closest to finishing
+// can have finished, instead of on every completion
+static void arm_interrupt(vblk_t* d) {
+    uint32_t wanted = 1;
+
+    if (d->issued) {
+        wanted = 0xFFFFFFFF;
+        for (uint32_t i = 0; i < d->nr_slots; i++) {
+            if ((d->issued & SLOT(i)) && d->batch[i]->remaining < wanted) {
+                wanted = d->batch[i]->remaining;
+            }
+        }
+    }
+    *used_event(d) = (uint16_t)(d->last_used + wanted - 1);
+}
+
+// Runs with interrupts off, from the IRQ handler or the polling loop
+static void vblk_reap(vblk_t* d) {
+    int finished = 0;
+
+    while (1) {
+        while (d->last_used != d->used->idx) {
+            asm volatile("" ::: "memory"); // Entry after the index
+            virtq_used_elem_t* e = &d->used->ring[d->last_used % d->qsize];
+            uint32_t slot = e->id / d->ring_per_req;
+            d->last_used++;
+
+            if (slot >= d->nr_slots || !(d->issued & SLOT(slot))) continue;
+            d->issued &= ~SLOT(slot);
+            if (--d->batch[slot]->remaining == 0) finished = 1;
+        }
+
+        if (!has_feature(d, VIRTIO_F_EVENT_IDX)) break;
+
+        // The device may have moved on before it saw the new used_event
+        arm_interrupt(d);
+        asm volatile("mfence" ::: "memory");
+        if (d->last_used == d->used->idx) break;
+    }
+
+    if (finished) wait_queue_wake_all(&d->done_wq);
+}
+
+static void vblk_irq_handler(void) {
+    for (int i = 0; i < nr_devs; i++) {
+        // Reading the ISR status acknowledges the interrupt
+        if (read8(devs[i].isr, 0) & VIRTIO_ISR_QUEUE) vblk_reap(&devs[i]);
+    }
+}
+
+// Returns 0 once the batch finished. A request that never finishes keeps
+// its buffers, the device may still write to them.
+static int vblk_wait(vblk_t* d, vblk_batch_t* batch) {
+    if (can_sleep(d)) {
+        uint64_t deadline = kdata_ticks() + timer_ns_to_ticks(VIRTIO_BLK_TIMEOUT_NS);
+        int timed_out = 0;
+        while (batch->remaining && !timed_out) {
+            timed_out = wait_queue_sleep_until(&d->done_wq, deadline);
+        }
+    } else {
+        for (int i = 0; i < VIRTIO_SPIN_LIMIT && batch->remaining; i++) vblk_reap(d);
+    }
+
+    if (batch->remaining) {
+        serial_printf("VIRTIO: %s request timed out, disabling the disk\n", d->name);
+        d->broken = 1;
+
+        // The batch lives on the requester's stack, late completions must not find it
+        for (uint32_t i = 0; i < d->nr_slots; i++) {
+            if ((d->issued & SLOT(i)) && d->batch[i] == batch) d->issued &= ~SLOT(i);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Slots */
+
+// Called with interrupts off. Without may_wait, returns -1 instead of
+// blocking when every slot is taken.
+static int slot_alloc(vblk_t* d, int may_wait) {
+    while (1) {
+        uint32_t all = d->nr_slots == 32 ? 0xFFFFFFFF : SLOT(d->nr_slots) - 1;
+        uint32_t free = ~d->allocated & all;
+
+        if (free) {
+            int slot = __builtin_ctz(free);
+            d->allocated |= SLOT(slot);
+            return slot;
+        }
+
+        if (!may_wait) return -1;
+        if (current_task && current_task->pid != 0) wait_queue_sleep(&d->slot_wq);
+        else if (current_task) scheduler_yield();
+        else return -1;
+    }
+}
+
+static void slot_free(vblk_t* d, uint32_t mask) {
+    d->allocated &= ~mask;
+    wait_queue_wake_all(&d->slot_wq);
+}
+
+static uint8_t* slot_meta(vblk_t* d, int slot) {
+    return d->meta + slot * VIRTIO_BLK_META_SIZE;
+}
+
+/* Requests */
+
+// Builds header, data pages and status byte as one chain, either in the
+// slot's indirect table or in the slot's own range of ring descriptors,
+// and puts it on the available ring. The device does not see it before kick().
+static void submit(vblk_t* d, int slot, uint32_t type, uint64_t sector,
+                   uint32_t bytes, vblk_batch_t* batch) {
+    uint8_t* meta = slot_meta(d, slot);
+    virtio_blk_req_t* hdr = (virtio_blk_req_t*)meta;
+    uint8_t* status = meta + sizeof(virtio_blk_req_t);
+
+    hdr->type = type;
+    hdr->reserved = 0;
+    hdr->sector = sector;
+    *status = 0xFF;
+
+    int indirect = has_feature(d, VIRTIO_F_INDIRECT_DESC);
+    uint16_t head = slot * d->ring_per_req;
+    uint16_t base = indirect ? 0 : head;
+    virtq_desc_t* chain = indirect ? (virtq_desc_t*)(meta + 32) : &d->desc[head];
+
+    int n = 0;
+    chain[n].addr = virt_to_phys(hdr);
+    chain[n].len = sizeof(virtio_blk_req_t);
+    chain[n].flags = VIRTQ_DESC_F_NEXT;
+    chain[n].next = base + n + 1;
+    n++;
+
+    for (uint32_t off = 0, i = 0; off < bytes; off += PAGE_SIZE, i++, n++) {
+        chain[n].addr = virt_to_phys(d->pages[slot][i]);
+        chain[n].len = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+        chain[n].flags = VIRTQ_DESC_F_NEXT | (type == VIRTIO_BLK_T_IN ? VIRTQ_DESC_F_WRITE : 0);
+        chain[n].next = base + n + 1;
+    }
+
+    chain[n].addr = virt_to_phys(status);
+    chain[n].len = 1;
+    chain[n].flags = VIRTQ_DESC_F_WRITE;
+    chain[n].next = 0;
+    n++;
+
+    if (indirect) {
+        d->desc[head].addr = virt_to_phys(chain);
+        d->desc[head].len = n * sizeof(virtq_desc_t);
+        d->desc[head].flags = VIRTQ_DESC_F_INDIRECT;
+        d->desc[head].next = 0;
+    }
+
+    d->batch[slot] = batch;
+    batch->remaining++;
+    d->issued |= SLOT(slot);
+
+    d->avail->ring[d->avail_idx % d->qsize] = head;
+    d->avail_idx++;
+}
+
+// Publishes everything submitted since the last kick and notifies the
+// device once, unless it said it does not need to hear about it
+static void kick(vblk_t* d) {
+    uint16_t old = d->avail->idx;
+    uint16_t new = d->avail_idx;
+
+    asm volatile("" ::: "memory"); // Ring entries before the index
+    d->avail->idx = new;
+    asm volatile("mfence" ::: "memory");
+
+    int notify;
+    if (has_feature(d, VIRTIO_F_EVENT_IDX)) {
+        uint16_t event = *avail_event(d);
+        notify = (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+    } else {
+        notify = !(d->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) *d->notify = 0;
+}
+
+static void copy_pages(vblk_t* d, int slot, uint8_t* buf, uint32_t bytes, int to_device) {
+    for (uint32_t off = 0, i = 0; off < bytes; off += PAGE_SIZE, i++) {
+        uint32_t len = bytes - off < PAGE_SIZE ? bytes - off : PAGE_SIZE;
+        if (to_device) memcpy(d->pages[slot][i], buf + off, len);
+        else memcpy(buf + off, d->pages[slot][i], len);
+    }
+}
+
+// Splits the request into slot-sized chunks, queues as many as there are
+// free slots with a single notification, then sleeps until all are done.
+// A request never waits for a slot while it holds others.
+static int vblk_rw(vblk_t* d, uint64_t lba, uint32_t count, uint8_t* buf, int write) {
+    if (lba + count > d->blk.sectors) return -1;
+    if (write && has_feature(d, VIRTIO_BLK_F_RO)) return -1;
+
+    uint32_t max = d->segs * PAGE_SIZE / BLOCK_SECTOR_SIZE;
+    uint32_t type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    int ret = 0;
+    while (count > 0 && ret == 0 && !d->broken) {
+        vblk_batch_t batch = { 0 };
+        int slots[VIRTIO_BLK_MAX_REQS];
+        uint32_t lens[VIRTIO_BLK_MAX_REQS];
+        uint32_t mask = 0;
+        int n = 0;
+        uint8_t* batch_buf = buf;
+
+        while (count > 0) {
+            int slot = slot_alloc(d, n == 0);
+            if (slot < 0) break;
+
+            uint32_t chunk = count < max ? count : max;
+            uint32_t bytes = chunk * BLOCK_SECTOR_SIZE;
+            if (write) copy_pages(d, slot, buf, bytes, 1);
+            submit(d, slot, type, lba, bytes, &batch);
+
+            slots[n] = slot;
+            lens[n++] = bytes;
+            mask |= SLOT(slot);
+
+            lba += chunk;
+            buf += bytes;
+            count -= chunk;
+        }
+        if (n == 0) {
+            ret = -1;
+            break;
+        }
+
+        kick(d);
+        vblk_reap(d); // Re-arms used_event for this batch
+        if (vblk_wait(d, &batch) != 0) {
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (slot_meta(d, slots[i])[sizeof(virtio_blk_req_t)] != VIRTIO_BLK_S_OK) ret = -1;
+        }
+        if (ret == 0 && !write) {
+            for (int i = 0; i < n; i++) {
+                copy_pages(d, slots[i], batch_buf, lens[i], 0);
+                batch_buf += lens[i];
+            }
+        }
+        slot_free(d, mask);
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return d->broken ? -1 : ret;
+}
+
+/* Block device */
+
+static int vblk_block_read(block_device_t* blk, uint64_t lba, uint32_t count, uint8_t* buf) {
+    return vblk_rw((vblk_t*)blk->priv, lba, count, buf, 0);
+}
+
+static int vblk_block_write(block_device_t* blk, uint64_t lba, uint32_t count, const uint8_t* buf) {
+    return vblk_rw((vblk_t*)blk->priv, lba, count, (uint8_t*)buf, 1);
+}
+
+// Without the FLUSH feature the device has no volatile cache to flush
+static int vblk_block_flush(block_device_t* blk) {
+    vblk_t* d = (vblk_t*)blk->priv;
+    if (!has_feature(d, VIRTIO_BLK_F_FLUSH)) return 0;
+    if (d->broken) return -1;
+
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    vblk_batch_t batch = { 0 };
+    int ret = -1;
+    int slot = slot_alloc(d, 1);
+    if (slot >= 0) {
+        submit(d, slot, VIRTIO_BLK_T_FLUSH, 0, 0, &batch);
+        kick(d);
+        vblk_reap(d);
+        if (vblk_wait(d, &batch) == 0) {
+            ret = slot_meta(d, slot)[sizeof(virtio_blk_req_t)] == VIRTIO_BLK_S_OK ? 0 : -1;
+            slot_free(d, SLOT(slot));
+        }
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return ret;
+}
+
+static const block_ops_t vblk_block_ops = {
+    .read = vblk_block_read,
+    .write = vblk_block_write,
+    .flush = vblk_block_flush,
+};
+
+/* Initialization */
+
+// Maps the common, notify, ISR and device structures the vendor
+// capabilities point at. Returns 0 if all four are there.
+static int map_structures(vblk_t* d, const pci_device_t* pci, uint32_t* notify_mult,
+                          volatile uint8_t** notify_base) {
+    uint8_t cap = 0;
+    while ((cap = pci_find_capability(pci, PCI_CAP_VENDOR, cap)) != 0) {
+        uint8_t type = pci_read8(pci, cap + VIRTIO_CAP_CFG_TYPE);
+        uint8_t bar = pci_read8(pci, cap + VIRTIO_CAP_BAR);
+        uint32_t offset = pci_read32(pci, cap + VIRTIO_CAP_OFFSET);
+        uint32_t length = pci_read32(pci, cap + VIRTIO_CAP_LENGTH);
+
+        if (bar > 5 || (pci_read32(pci, PCI_BAR(bar)) & PCI_BAR_IO)) continue;
+        uint64_t base = pci_bar_address(pci, bar);
+        if (!base || !length) continue;
+
+        volatile uint8_t** target = NULL;
+        switch (type) {
+            case VIRTIO_PCI_CAP_COMMON: target = &d->common; break;
+            case VIRTIO_PCI_CAP_NOTIFY: target = notify_base; break;
+            case VIRTIO_PCI_CAP_ISR:    target = &d->isr; break;
+            case VIRTIO_PCI_CAP_DEVICE: target = &d->config; break;
+        }
+        if (!target || *target) continue;
+
+        *target = (volatile uint8_t*)vmm_map_mmio(base + offset, length);
+        if (type == VIRTIO_PCI_CAP_NOTIFY) *notify_mult = pci_read32(pci, cap + VIRTIO_CAP_NOTIFY_MULT);
+    }
+
+    return (d->common && *notify_base && d->isr && d->config) ? 0 : -1;
+}
+
+static int negotiate(vblk_t* d) {
+    write8(d->common, VIRTIO_COMMON_STATUS, 0);
+    for (int i = 0; i < VIRTIO_SPIN_LIMIT && read8(d->common, VIRTIO_COMMON_STATUS); i++);
+
+    write8(d->common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACK);
+    write8(d->common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    write32(d->common, VIRTIO_COMMON_DFSELECT, 0);
+    uint64_t offered = read32(d->common, VIRTIO_COMMON_DF);
+    write32(d->common, VIRTIO_COMMON_DFSELECT, 1);
+    offered |= (uint64_t)read32(d->common, VIRTIO_COMMON_DF) << 32;
+
+    uint64_t wanted = (1ULL << VIRTIO_F_VERSION_1) | (1ULL << VIRTIO_F_INDIRECT_DESC) |
+                      (1ULL << VIRTIO_F_EVENT_IDX) | (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+                      (1ULL << VIRTIO_BLK_F_RO) | (1ULL << VIRTIO_BLK_F_FLUSH);
+    d->features = offered & wanted;
+    if (!has_feature(d, VIRTIO_F_VERSION_1)) return -1; // Legacy-only device
+
+    write32(d->common, VIRTIO_COMMON_GFSELECT, 0);
+    write32(d->common, VIRTIO_COMMON_GF, (uint32_t)d->features);
+    write32(d->common, VIRTIO_COMMON_GFSELECT, 1);
+    write32(d->common, VIRTIO_COMMON_GF, (uint32_t)(d->features >> 32));
+
+    uint8_t status = VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK;
+    write8(d->common, VIRTIO_COMMON_STATUS, status);
+    return (read8(d->common, VIRTIO_COMMON_STATUS) & VIRTIO_STATUS_FEATURES_OK) ? 0 : -1;
+}
+
+// Sets up queue 0 and the per-slot buffers. Slots that cannot get their
+// pages are left out.
+static int setup_queue(vblk_t* d, uint32_t notify_mult, volatile uint8_t* notify_base) {
+    write16(d->common, VIRTIO_COMMON_Q_SELECT, 0);
+    uint16_t max = read16(d->common, VIRTIO_COMMON_Q_SIZE);
+    if (max == 0) return -1;
+
+    // Split rings need a power of two
+    d->qsize = VIRTQ_MAX_SIZE;
+    while (d->qsize > max) d->qsize >>= 1;
+
+    uint8_t* ring = (uint8_t*)pmm_alloc_page();
+    d->meta = (uint8_t*)pmm_alloc_pages(VIRTIO_BLK_MAX_REQS * VIRTIO_BLK_META_SIZE / PAGE_SIZE);
+    if (!ring || !d->meta) return -1;
+    memset(ring, 0, PAGE_SIZE);
+    memset(d->meta, 0, VIRTIO_BLK_MAX_REQS * VIRTIO_BLK_META_SIZE);
+
+    d->desc = (virtq_desc_t*)ring;
+    d->avail = (virtq_avail_t*)(ring + VIRTQ_AVAIL_OFFSET);
+    d->used = (virtq_used_t*)(ring + VIRTQ_USED_OFFSET);
+
+    d->segs = VIRTIO_BLK_SEGS;
+    if (has_feature(d, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = read32(d->config, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max && seg_max < d->segs) d->segs = seg_max;
+    }
+
+    d->ring_per_req = has_feature(d, VIRTIO_F_INDIRECT_DESC) ? 1 : d->segs + 2;
+    d->nr_slots = d->qsize / d->ring_per_req;
+    if (d->nr_slots > VIRTIO_BLK_MAX_REQS) d->nr_slots = VIRTIO_BLK_MAX_REQS;
+    if (d->nr_slots == 0) return -1;
+
+    for (uint32_t s = 0; s < d->nr_slots; s++) {
+        for (uint32_t i = 0; i < d->segs; i++) {
+            d->pages[s][i] = (uint8_t*)pmm_alloc_page();
+            if (!d->pages[s][i]) {
+                for (uint32_t j = 0; j < i; j++) pmm_free_page(d->pages[s][j]);
+                d->nr_slots = s;
+                break;
+            }
+        }
+        if (d->nr_slots == s) break;
+    }
+    if (d->nr_slots == 0) return -1;
+
+    write16(d->common, VIRTIO_COMMON_Q_SIZE, d->qsize);
+    write16(d->common, VIRTIO_COMMON_Q_MSIX, VIRTIO_MSI_NO_VECTOR);
+    write64(d->common, VIRTIO_COMMON_Q_DESC, virt_to_phys(d->desc));
+    write64(d->common, VIRTIO_COMMON_Q_AVAIL, virt_to_phys(d->avail));
+    write64(d->common, VIRTIO_COMMON_Q_USED, virt_to_phys(d->used));
+
+    uint16_t notify_off = read16(d->common, VIRTIO_COMMON_Q_NOFF);
+    d->notify = (volatile uint16_t*)(notify_base + notify_off * notify_mult);
+
+    write16(d->common, VIRTIO_COMMON_Q_ENABLE, 1);
+    return 0;
+}
+
+static void probe(const pci_device_t* pci) {
+    if (nr_devs == VIRTIO_BLK_MAX_DEVS) return;
+
+    vblk_t* d = &devs[nr_devs];
+    memset(d, 0, sizeof(vblk_t));
+    memcpy(d->name, "vblk0", 6);
+    d->name[4] += nr_devs;
+
+    pci_enable_bus_master(pci);
+
+    uint32_t notify_mult = 0;
+    volatile uint8_t* notify_base = NULL;
+    if (map_structures(d, pci, &notify_mult, &notify_base) != 0) {
+        serial_printf("VIRTIO: %s has no modern interface\n", d->name);
+        return;
+    }
+    if (negotiate(d) != 0 || setup_queue(d, notify_mult, notify_base) != 0) {
+        serial_printf("VIRTIO: %s setup failed\n", d->name);
+        write8(d->common, VIRTIO_COMMON_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    d->blk.sectors = read32(d->config, VIRTIO_BLK_CFG_CAPACITY) |
+                     ((uint64_t)read32(d->config, VIRTIO_BLK_CFG_CAPACITY + 4) << 32);
+    d->blk.name = d->name;
+    d->blk.ops = &vblk_block_ops;
+    d->blk.priv = d;
+
+    // Polled until the interrupt is hooked up below
+    d->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+    d->irq_line = pci->irq_line;
+    write8(d->common, VIRTIO_COMMON_STATUS, read8(d->common, VIRTIO_COMMON_STATUS) | VIRTIO_STATUS_DRIVER_OK);
+
+    nr_devs++;
+    serial_printf("VIRTIO: %s, %u MiB, %u requests of %u pages%s%s\n", d->name,
+                  (uint32_t)(d->blk.sectors / 2048), d->nr_slots, d->segs,
+                  has_feature(d, VIRTIO_F_INDIRECT_DESC) ? ", indirect" : "",
+                  has_feature(d, VIRTIO_F_EVENT_IDX) ? ", event idx" : "");
+}
+
+int virtio_blk_init(void) {
+    pci_device_t pci;
+    for (int i = 0; pci_find_device(VIRTIO_VENDOR, VIRTIO_DEV_BLK, i, &pci) == 0; i++) probe(&pci);
+    for (int i = 0; pci_find_device(VIRTIO_VENDOR, VIRTIO_DEV_BLK_LEGACY, i, &pci) == 0; i++) probe(&pci);
+
+    for (int i = 0; i < nr_devs; i++) {
+        vblk_t* d = &devs[i];
+
+        // One handler serves every device, register it once per line
+        int shared = 0;
+        for (int j = 0; j < i; j++) {
+            if (devs[j].irq_ok && devs[j].irq_line == d->irq_line) shared = 1;
+        }
+        if (d->irq_line < 16 && (shared || irq_register(d->irq_line, vblk_irq_handler) == 0)) {
+            d->irq_ok = 1;
+            d->avail->flags = 0;
+        } else {
+            serial_printf("VIRTIO: %s has no usable IRQ line, polling\n", d->name);
+        }
+
+        block_register(&d->blk);
+    }
+    return nr_devs;
+}
@@ -35,7 +35,16 @@ const char *exception_names[32] = {
     "Reserved"
 };
 
-void exception_handler(uint64_t vector, uint64_t error, uint64_t rip) {
+void exception_handler(uint64_t vector, uint64_t error, uint64_t* rip_ptr) {
+    uint64_t rip = *rip_ptr;
+
+    // A kernel-mode fault on a user pointer inside copy_to_user and friends
+    if (vector == ERR_VECTOR_PAGEFAULT && !(error & (1 << 2)) && uaccess_fixup(rip_ptr)) {
+        return;
+    }
+
+    serial_panic();
+
     serial_printf("EXCEPTION %d: %s\n", vector, exception_names[vector]);
     serial_printf("RIP: 0x%x\n", (void*)rip);
 
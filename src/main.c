@@ -14,9 +14,12 @@
 #include <com1.h>
 
 #include <task.h>
+#include <kdata.h>
 
 #include <graphics.h>
 #include <keyboard.h>
+#include <pci.h>
+#include <block.h>
 #include <fatfs/ff.h>
 
 #define PML4_ENTRY_COUNT 512
@@ -109,9 +112,12 @@ static void system_init() {
 
     heap_init();
     keyboard_init();
+    pci_init();
+    block_init();
     mount_filesystem();
     scheduler_init();
     graphics_init();
+    kdata_init(PIT_FREQUENCY_HZ);
     pit_init(PIT_FREQUENCY_HZ);
 }
 
@@ -169,6 +169,7 @@ static void place_bitmap(struct limine_memmap_response* memmap,
     }
 
     serial_printf("PMM PANIC: Could not place bitmap\n");
+    serial_panic();
     while (1);
 }
 
@@ -0,0 +1,106 @@
+#include <uaccess.h>
+
+typedef struct {
+    uint64_t insn;    // Instruction that may fault on a user address
+    uint64_t fixup;   // Where to resume if it does
+} ex_entry_t;
+
+extern const ex_entry_t __ex_table_start[];
+extern const ex_entry_t __ex_table_end[];
+
+/* Helper functions */
+
+// Returns the number of bytes left uncopied, 0 on success.
+// rep movsb keeps RCX up to date, so after a fault it holds the remainder.
+static inline size_t uaccess_copy(void* dst, const void* src, size_t size) {
+    asm volatile(
+        "1: rep movsb\n"
+        "2:\n"
+        ".section .ex_table, \"a\"\n"
+        "    .balign 8\n"
+        "    .quad 1b, 2b\n"
+        ".previous\n"
+        : "+D"(dst), "+S"(src), "+c"(size)
+        :
+        : "memory"
+    );
+    return size;
+}
+
+static inline int uaccess_get_u8(uint8_t* out, const uint8_t* user_src) {
+    int err = 0;
+    uint8_t val = 0;
+
+    asm volatile(
+        "1: movb (%2), %1\n"
+        "2:\n"
+        ".section .fixup, \"ax\"\n"
+        "3: movl %3, %0\n"
+        "    jmp 2b\n"
+        ".previous\n"
+        ".section .ex_table, \"a\"\n"
+        "    .balign 8\n"
+        "    .quad 1b, 3b\n"
+        ".previous\n"
+        : "+r"(err), "+q"(val)
+        : "r"(user_src), "i"(-EFAULT)
+        : "memory"
+    );
+
+    *out = val;
+    return err;
+}
+
+/* User access functions */
+
+int access_ok(const void* user_ptr, size_t size) {
+    uint64_t start = (uint64_t)user_ptr;
+    uint64_t end = start + size;
+
+    if (end < start) return 0; // Wrapped around
+    return end <= USER_SPACE_END;
+}
+
+int copy_to_user(void* user_dst, const void* src, size_t size) {
+    if (!access_ok(user_dst, size)) return -EFAULT;
+    return uaccess_copy(user_dst, src, size) ? -EFAULT : 0;
+}
+
+int copy_from_user(void* dst, const void* user_src, size_t size) {
+    if (!access_ok(user_src, size)) return -EFAULT;
+    return uaccess_copy(dst, user_src, size) ? -EFAULT : 0;
+}
+
+int64_t strncpy_from_user(char* dst, const char* user_src, size_t max) {
+    if (max == 0) return -ENAMETOOLONG;
+
+    for (size_t i = 0; i < max; i++) {
+        const uint8_t* src = (const uint8_t*)user_src + i;
+        if ((uint64_t)src >= USER_SPACE_END) {
+            dst[i] = 0;
+            return -EFAULT;
+        }
+
+        uint8_t c;
+        if (uaccess_get_u8(&c, src)) {
+            dst[i] = 0;
+            return -EFAULT;
+        }
+
+        dst[i] = (char)c;
+        if (c == 0) return (int64_t)i;
+    }
+
+    dst[max - 1] = 0;
+    return -ENAMETOOLONG;
+}
+
+int uaccess_fixup(uint64_t* rip) {
+    for (const ex_entry_t* e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->insn == *rip) {
+            *rip = e->fixup;
+            return 1;
+        }
+    }
+    return 0;
+}
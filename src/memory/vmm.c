@@ -1,6 +1,7 @@
 #include <vmm.h>
 
 extern uint64_t limine_hhdm;
+extern uint64_t* kernel_pml4;
 
 /* Helper functions */
 
@@ -39,6 +40,7 @@ static uint64_t* get_or_alloc_table(uint64_t* table, size_t index) {
     void* new_table = pmm_alloc_page();
     if (!new_table) {
         serial_printf("VMM PANIC: Out of memory allocating page table\n");
+        serial_panic();
         while (1);
     }
     
@@ -108,6 +110,25 @@ uint64_t vmm_get_mapping(uint64_t* pml4, uint64_t virt) {
     return entry & PAGE_ALIGN_MASK;
 }
 
+// Maps a device's register range into the MMIO window with caching
+// disabled. Returns the virtual address of phys, NULL if the window is full.
+void* vmm_map_mmio(uint64_t phys, size_t size) {
+    static uint64_t next = VMM_MMIO_BASE;
+
+    uint64_t offset = phys & (PAGE_SIZE - 1);
+    uint64_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (next + pages * PAGE_SIZE > VMM_MMIO_BASE + VMM_MMIO_SIZE) return NULL;
+
+    uint64_t virt = next;
+    for (uint64_t i = 0; i < pages; i++) {
+        vmm_map_page(kernel_pml4, virt + i * PAGE_SIZE, (phys & PAGE_ALIGN_MASK) + i * PAGE_SIZE,
+                     VMM_PRESENT | VMM_WRITE | VMM_PCD | VMM_PWT);
+    }
+    next += pages * PAGE_SIZE;
+
+    return (void*)(virt + offset);
+}
+
 uint64_t* vmm_create_pml4(void) {
     uint64_t* pml4 = pmm_alloc_page();
     if (!pml4) return NULL;
@@ -0,0 +1,122 @@
+#include <file.h>
+#include <pipe.h>
+#include <errno.h>
+
+/* Descriptor table functions */
+
+fd_table_t* fd_table_create(void) {
+    fd_table_t* table = (fd_table_t*)kmalloc(sizeof(fd_table_t));
+    if (!table) return NULL;
+
+    memset(table, 0, sizeof(fd_table_t));
+    table->users = 1;
+    return table;
+}
+
+// Drops one user; the last one closes every descriptor
+void fd_table_put(fd_table_t* table) {
+    if (!table || --table->users > 0) return;
+
+    for (int fd = 0; fd < MAX_FDS; fd++) {
+        if (table->fds[fd]) file_put(table->fds[fd]);
+    }
+    kfree(table);
+}
+
+// Takes over the caller's reference. Returns the descriptor or -EMFILE.
+int fd_install(fd_table_t* table, file_t* file) {
+    for (int fd = FD_FIRST_FREE; fd < MAX_FDS; fd++) {
+        if (!table->fds[fd]) {
+            table->fds[fd] = file;
+            return fd;
+        }
+    }
+    return -EMFILE;
+}
+
+file_t* fd_get(fd_table_t* table, int fd) {
+    if (!table || fd < 0 || fd >= MAX_FDS) return NULL;
+    return table->fds[fd];
+}
+
+int fd_close(fd_table_t* table, int fd) {
+    file_t* file = fd_get(table, fd);
+    if (!file) return -EBADF;
+
+    table->fds[fd] = NULL;
+    file_put(file);
+    return 0;
+}
+
+/* File functions */
+
+static BYTE fatfs_mode(uint32_t flags) {
+    BYTE mode = 0;
+
+    switch (flags & O_ACCMODE) {
+        case O_WRONLY: mode = FA_WRITE; break;
+        case O_RDWR:   mode = FA_READ | FA_WRITE; break;
+        default:       mode = FA_READ; break;
+    }
+
+    // FatFs' create modes also create missing files, so they are only used
+    // with O_CREAT. file_open() handles O_TRUNC and O_APPEND otherwise.
+    if (flags & O_CREAT) {
+        if ((flags & O_TRUNC) && mode != FA_READ) mode |= FA_CREATE_ALWAYS;
+        else if (flags & O_APPEND) mode |= FA_OPEN_APPEND;
+        else mode |= FA_OPEN_ALWAYS;
+    }
+
+    return mode;
+}
+
+// Returns a file holding one reference, or NULL with *err set
+file_t* file_open(const char* path, uint32_t flags, int* err) {
+    file_t* file = (file_t*)kmalloc(sizeof(file_t));
+    if (!file) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    memset(file, 0, sizeof(file_t));
+
+    FRESULT res;
+    if (flags & O_DIRECTORY) {
+        res = f_opendir(&file->dir, path);
+        file->type = FILE_TYPE_DIR;
+    } else {
+        res = f_open(&file->fil, path, fatfs_mode(flags));
+        file->type = FILE_TYPE_FILE;
+
+        // An existing file is only truncated when opened for writing
+        if (res == FR_OK && !(flags & O_CREAT)) {
+            if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+                res = f_truncate(&file->fil);
+            } else if (flags & O_APPEND) {
+                res = f_lseek(&file->fil, f_size(&file->fil));
+            }
+            if (res != FR_OK) f_close(&file->fil);
+        }
+    }
+
+    if (res != FR_OK) {
+        kfree(file);
+        if (res == FR_NO_FILE || res == FR_NO_PATH) *err = -ENOENT;
+        else if (res == FR_LOCKED) *err = -EBUSY;          // Open elsewhere (FF_FS_LOCK)
+        else if (res == FR_TOO_MANY_OPEN_FILES) *err = -EMFILE;
+        else *err = -1;
+        return NULL;
+    }
+
+    file->refs = 1;
+    file->flags = flags;
+    return file;
+}
+
+void file_put(file_t* file) {
+    if (--file->refs > 0) return;
+
+    if (file->type == FILE_TYPE_FILE) f_close(&file->fil);
+    else if (file->type == FILE_TYPE_DIR) f_closedir(&file->dir);
+    else if (file->type == FILE_TYPE_PIPE) pipe_release(file->pipe, (file->flags & O_ACCMODE) == O_WRONLY);
+    kfree(file);
+}
@@ -0,0 +1,79 @@
+#include <futex.h>
+#include <uaccess.h>
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+static wait_queue_t futex_buckets[FUTEX_HASH_BUCKETS];
+
+/* Helper functions */
+
+// Returns 0 if uaddr is not a mapped user address in the current address
+// space. Kernel addresses are refused, or the value check in futex_wait
+// would let userspace probe kernel memory.
+static uint64_t futex_key(uint64_t uaddr) {
+    if (!access_ok((const void*)uaddr, sizeof(uint32_t))) return 0;
+
+    uint64_t* pml4_virt = (uint64_t*)(current_task->cr3 + limine_hhdm);
+    uint64_t page = vmm_get_mapping(pml4_virt, uaddr & ~(PAGE_SIZE - 1));
+    if (!page) return 0;
+
+    return page + (uaddr & (PAGE_SIZE - 1));
+}
+
+static wait_queue_t* futex_bucket(uint64_t key) {
+    return &futex_buckets[(key >> 2) % FUTEX_HASH_BUCKETS];
+}
+
+/* Futex functions */
+
+// Syscalls run with interrupts off, so the value check and the enqueue
+// cannot race with a futex_wake from another task.
+int futex_wait(uint64_t uaddr, uint32_t expected) {
+    if (uaddr & 3) return -1;
+
+    uint64_t key = futex_key(uaddr);
+    if (!key) return -1;
+
+    volatile uint32_t* word = (volatile uint32_t*)(key + limine_hhdm);
+    if (*word != expected) return -1;
+
+    current_task->futex_key = key;
+    wait_queue_sleep(futex_bucket(key));
+    current_task->futex_key = 0;
+
+    return 0;
+}
+
+int futex_wake(uint64_t uaddr, uint32_t count) {
+    if (uaddr & 3) return -1;
+
+    uint64_t key = futex_key(uaddr);
+    if (!key) return -1;
+
+    wait_queue_t* wq = futex_bucket(key);
+    task_t* prev = NULL;
+    task_t* task = wq->head;
+    int woken = 0;
+
+    // Buckets are shared between keys, only unlink the matching waiters
+    while (task && (uint32_t)woken < count) {
+        task_t* next = task->wait_next;
+
+        if (task->futex_key == key) {
+            if (prev) prev->wait_next = next;
+            else wq->head = next;
+            if (wq->tail == task) wq->tail = prev;
+
+            task->wait_next = NULL;
+            task_wake(task);
+            woken++;
+        } else {
+            prev = task;
+        }
+
+        task = next;
+    }
+
+    return woken;
+}
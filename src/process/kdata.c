@@ -0,0 +1,91 @@
+#include <kdata.h>
+#include <pit.h>
+
+extern uint64_t limine_hhdm;
+
+static kdata_time_t* time_page = NULL;
+static uint64_t tsc_boot = 0;
+
+static inline uint64_t get_phys_addr(void* addr) {
+    return (uint64_t)addr - limine_hhdm;
+}
+
+void kdata_init(uint32_t tick_hz) {
+    time_page = (kdata_time_t*)pmm_alloc_page();
+    if (!time_page) {
+        serial_printf("KDATA PANIC: Out of memory allocating time page\n");
+        serial_panic();
+        while (1);
+    }
+    memset(time_page, 0, PAGE_SIZE);
+
+    uint64_t tsc_hz = pit_calibrate_tsc();
+
+    time_page->tick_hz = tick_hz;
+    time_page->tsc_hz = tsc_hz;
+    time_page->tsc_mult = (1000000000ULL << KDATA_TSC_SHIFT) / tsc_hz;
+
+    tsc_boot = rdtsc();
+    time_page->tsc_base = tsc_boot;
+
+    serial_printf("KDATA: TSC calibrated at %u kHz\n", (uint32_t)(tsc_hz / 1000));
+}
+
+// Called from the PIT interrupt, so there is never more than one writer.
+void kdata_tick(void) {
+    if (!time_page) return;
+
+    uint64_t now = rdtsc();
+
+    time_page->seq++;
+    asm volatile("" ::: "memory");
+
+    time_page->ticks++;
+    time_page->tsc_base = now;
+    time_page->ns_base = kdata_tsc_to_ns(now - tsc_boot);
+
+    asm volatile("" ::: "memory");
+    time_page->seq++;
+}
+
+uint64_t kdata_tsc_hz(void) {
+    return time_page ? time_page->tsc_hz : 0;
+}
+
+uint64_t kdata_tsc_to_ns(uint64_t tsc_delta) {
+    if (!time_page) return 0;
+    return ((unsigned __int128)tsc_delta * time_page->tsc_mult) >> KDATA_TSC_SHIFT;
+}
+
+uint64_t kdata_ticks(void) {
+    return time_page ? time_page->ticks : 0;
+}
+
+uint32_t kdata_tick_hz(void) {
+    return time_page ? time_page->tick_hz : 0;
+}
+
+/* Process mapping functions */
+
+kdata_proc_t* kdata_map_process(uint64_t* pml4_virt, uint64_t pid) {
+    kdata_proc_t* proc_page = (kdata_proc_t*)pmm_alloc_page();
+    if (!proc_page) return NULL;
+
+    memset(proc_page, 0, PAGE_SIZE);
+    proc_page->pid = pid;
+
+    // Both pages are user-readable only
+    vmm_map_page(pml4_virt, USER_KDATA_TIME, get_phys_addr(time_page), VMM_PRESENT | VMM_USER);
+    vmm_map_page(pml4_virt, USER_KDATA_PROC, get_phys_addr(proc_page), VMM_PRESENT | VMM_USER);
+
+    return proc_page;
+}
+
+// Must run before destroy_user_memory(), which would otherwise free the
+// shared time page along with the rest of the process' leaf pages.
+void kdata_unmap_process(uint64_t* pml4_virt, kdata_proc_t* proc_page) {
+    vmm_unmap_page(pml4_virt, USER_KDATA_TIME);
+    vmm_unmap_page(pml4_virt, USER_KDATA_PROC);
+
+    if (proc_page) pmm_free_page(proc_page);
+}
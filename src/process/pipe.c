@@ -0,0 +1,119 @@
+#include <pipe.h>
+#include <uaccess.h>
+#include <errno.h>
+
+/* Helper functions */
+
+static file_t* pipe_file(pipe_t* pipe, uint32_t flags) {
+    file_t* file = (file_t*)kmalloc(sizeof(file_t));
+    if (!file) return NULL;
+
+    memset(file, 0, sizeof(file_t));
+    file->type = FILE_TYPE_PIPE;
+    file->refs = 1;
+    file->flags = flags;
+    file->pipe = pipe;
+    return file;
+}
+
+/* Pipe functions */
+
+// Returns 0 with both ends holding one reference each, or -ENOMEM
+int pipe_create(file_t** read_end, file_t** write_end) {
+    pipe_t* pipe = (pipe_t*)kmalloc(sizeof(pipe_t));
+    if (!pipe) return -ENOMEM;
+    memset(pipe, 0, sizeof(pipe_t));
+
+    pipe->buf = (uint8_t*)pmm_alloc_pages(PIPE_PAGES);
+    *read_end = pipe_file(pipe, O_RDONLY);
+    *write_end = pipe_file(pipe, O_WRONLY);
+
+    if (!pipe->buf || !*read_end || !*write_end) {
+        if (pipe->buf) pmm_free_pages(pipe->buf, PIPE_PAGES);
+        if (*read_end) kfree(*read_end);
+        if (*write_end) kfree(*write_end);
+        kfree(pipe);
+        return -ENOMEM;
+    }
+
+    pipe->readers = 1;
+    pipe->writers = 1;
+    return 0;
+}
+
+// Called when the last reference to one end goes away
+void pipe_release(pipe_t* pipe, int write_end) {
+    if (write_end) {
+        pipe->writers--;
+        wait_queue_wake_all(&pipe->read_wq);  // EOF
+    } else {
+        pipe->readers--;
+        wait_queue_wake_all(&pipe->write_wq); // EPIPE
+    }
+
+    if (pipe->readers == 0 && pipe->writers == 0) {
+        pmm_free_pages(pipe->buf, PIPE_PAGES);
+        kfree(pipe);
+    }
+}
+
+// Blocks until data is available. Returns the bytes read, 0 at EOF.
+int64_t pipe_read(pipe_t* pipe, void* user_buf, uint64_t len) {
+    if (len == 0) return 0;
+
+    while (pipe_bytes(pipe) == 0) {
+        if (pipe->writers == 0) return 0;
+        wait_queue_sleep(&pipe->read_wq);
+    }
+
+    uint64_t n = pipe_bytes(pipe);
+    if (n > len) n = len;
+
+    // At most two pieces, split where the ring wraps
+    uint64_t done = 0;
+    while (done < n) {
+        uint32_t off = pipe->tail % PIPE_SIZE;
+        uint64_t chunk = n - done;
+        if (chunk > PIPE_SIZE - off) chunk = PIPE_SIZE - off;
+
+        if (copy_to_user((uint8_t*)user_buf + done, pipe->buf + off, chunk)) {
+            if (done == 0) return -EFAULT;
+            break;
+        }
+        pipe->tail += chunk;
+        done += chunk;
+    }
+
+    wait_queue_wake_all(&pipe->write_wq);
+    return (int64_t)done;
+}
+
+// Blocks until everything is written or the last reader goes away
+int64_t pipe_write(pipe_t* pipe, const void* user_buf, uint64_t len) {
+    uint64_t done = 0;
+
+    while (done < len) {
+        if (pipe->readers == 0) return done ? (int64_t)done : -EPIPE;
+
+        uint32_t space = PIPE_SIZE - pipe_bytes(pipe);
+        if (space == 0) {
+            wait_queue_sleep(&pipe->write_wq);
+            continue;
+        }
+
+        uint32_t off = pipe->head % PIPE_SIZE;
+        uint64_t chunk = len - done;
+        if (chunk > space) chunk = space;
+        if (chunk > PIPE_SIZE - off) chunk = PIPE_SIZE - off;
+
+        if (copy_from_user(pipe->buf + off, (const uint8_t*)user_buf + done, chunk)) {
+            return done ? (int64_t)done : -EFAULT;
+        }
+        pipe->head += chunk;
+        done += chunk;
+
+        wait_queue_wake_all(&pipe->read_wq);
+    }
+
+    return (int64_t)done;
+}
@@ -1,4 +1,8 @@
 #include <task.h>
+#include <timer.h>
+#include <ring.h>
+#include <channel.h>
+#include <trace.h>
 
 extern void exit_switch_to(uint64_t rsp);
 extern uint64_t* kernel_pml4; 
@@ -6,17 +10,39 @@ extern uint64_t limine_hhdm;
 
 extern struct limine_framebuffer* framebuffer;
 
-void create_kernel_task(void (*entry_point)());
+task_t* create_kernel_task(void (*entry_point)());
 int create_user_process_from_file(const char* filename, int argc, char** argv, int is_wm);
-void task_exit(void);
-void free_page_table_level(uint64_t* table_virt, int level);
-void destroy_user_memory(uint64_t pml4_phys);
+void task_exit(int code);
+void free_page_table_level(uint64_t* table_virt, int level, int preemptible);
+void destroy_user_memory(uint64_t pml4_phys, int preemptible);
+static void reaper_main(void);
+static void map_user_stack(uint64_t* pml4_virt, uint64_t top, uint64_t size, void** top_page_out);
+static void thread_stack_put(address_space_t* mm, uint64_t top);
 
 task_t* current_task = NULL;
 task_t* task_head = NULL;
-static uint64_t next_pid = 1;
 
-static task_t* zombie_task = NULL;
+typedef struct {
+    task_t* task;
+    uint64_t generation;
+} pid_entry_t;
+
+static pid_entry_t pid_table[MAX_TASKS];
+
+// Free slots are recycled in FIFO order so a slot stays unused for as long
+// as possible before its next generation is handed out
+static uint16_t pid_free_queue[MAX_TASKS];
+static uint32_t pid_free_head = 0;
+static uint32_t pid_free_count = 0;
+
+// Set by scheduler_hand_off(), consumed by the next schedule()
+static task_t* hand_off_target = NULL;
+
+// Exited tasks waiting for the reaper, linked through task->next (they are
+// off the run queue by then)
+static task_t* zombie_head = NULL;
+static task_t* zombie_tail = NULL;
+static wait_queue_t reaper_wq = {0};
 
 static inline uint64_t get_phys_addr(void* addr) {
     return (uint64_t)addr - limine_hhdm;
@@ -26,67 +52,401 @@ static inline void* get_virt_addr(uint64_t phys) {
     return (void*)(phys + limine_hhdm);
 }
 
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* PID table functions */
+
+static void pid_table_init(void) {
+    // Slot 0 is reserved for the root task (PID 0)
+    for (uint32_t slot = 1; slot < MAX_TASKS; slot++) {
+        pid_free_queue[slot - 1] = slot;
+    }
+    pid_free_head = 0;
+    pid_free_count = MAX_TASKS - 1;
+}
+
+static int64_t pid_alloc(task_t* task) {
+    if (pid_free_count == 0) return -1;
+
+    uint16_t slot = pid_free_queue[pid_free_head];
+    pid_free_head = (pid_free_head + 1) % MAX_TASKS;
+    pid_free_count--;
+
+    pid_table[slot].task = task;
+    return (int64_t)((pid_table[slot].generation << PID_SLOT_BITS) | slot);
+}
+
+static void pid_release(uint64_t pid) {
+    uint16_t slot = PID_SLOT(pid);
+    if (slot == 0 || pid_table[slot].task == NULL) return;
+
+    pid_table[slot].task = NULL;
+    pid_table[slot].generation++;
+
+    uint32_t tail = (pid_free_head + pid_free_count) % MAX_TASKS;
+    pid_free_queue[tail] = slot;
+    pid_free_count++;
+}
+
+/* Run list functions */
+
+static void task_list_insert(task_t* task) {
+    task->next = task_head->next;
+    task->prev = task_head;
+    task_head->next->prev = task;
+    task_head->next = task;
+}
+
+static void task_list_remove(task_t* task) {
+    task->prev->next = task->next;
+    task->next->prev = task->prev;
+
+    if (task == task_head) {
+        task_head = task->next;
+    }
+}
+
+static void task_set_name(task_t* task, const char* path) {
+    // Keep only the file name ("/bin/idpwm.elf" -> "idpwm.elf")
+    const char* base = path;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/') base = p + 1;
+    }
+
+    strncpy(task->name, base, TASK_NAME_LEN - 1);
+    task->name[TASK_NAME_LEN - 1] = 0;
+}
+
+// Charges the CPU time since the last switch to prev and starts next's slice
+static void account_switch(task_t* prev, task_t* next, int voluntary) {
+    uint64_t now = rdtsc();
+
+    prev->runtime_tsc += now - prev->switched_in_tsc;
+    if (prev != next) {
+        if (voluntary) prev->nr_voluntary++;
+        else prev->nr_involuntary++;
+    }
+
+    next->switched_in_tsc = now;
+}
+
 /* Scheduler functions */
 
 void scheduler_init(void) {
     task_t* root_task = (task_t*)kmalloc(sizeof(task_t));
+    memset(root_task, 0, sizeof(task_t));
     root_task->pid = 0;
     root_task->next = root_task; 
+    root_task->prev = root_task;
     root_task->rsp = 0; 
+    root_task->cr3 = read_cr3(); // Idle runs on the kernel page tables
+    root_task->switched_in_tsc = rdtsc();
+    task_set_name(root_task, "idle");
 
     current_task = root_task;
     task_head = root_task;
+
+    pid_table_init();
+    pid_table[0].task = root_task;
     
     serial_printf("Scheduler initialized. Root task PID 0 created.\n");
+
+    task_t* reaper = create_kernel_task(reaper_main);
+    if (reaper) task_set_name(reaper, "reaper");
 }
 
-uint64_t scheduler_schedule(uint64_t current_rsp) {
-    // Clean up any zombies left by previous exit calls
-    if (zombie_task != NULL) {
-        // Free Kernel Stack
-        kfree((void*)zombie_task->kernel_stack - 4096);
+// Frees everything but the task struct and its PID, which stay behind for
+// the parent to collect the exit code. Runs on the reaper thread with
+// interrupts disabled, apart from short windows during the page table walk.
+static void task_release(task_t* zombie) {
+    // Unmapped from the address space, which may outlive this task
+    ring_destroy(zombie);
+    trace_task_free(zombie);
+
+    // Closes the files once the last thread of the process is gone
+    fd_table_put(zombie->files);
+    zombie->files = NULL;
+
+    // Free Kernel Stack
+    kfree((void*)zombie->kernel_stack - KERNEL_STACK_SIZE);
 
-        destroy_user_memory(zombie_task->cr3);
+    address_space_t* mm = zombie->mm;
+
+    // The address space goes away with its last thread
+    if (mm && --mm->users == 0) {
+        void* pml4_virt = (void*)(mm->cr3 + limine_hhdm);
+
+        // Shared kernel pages must be unmapped before the page walk frees them
+        kdata_unmap_process((uint64_t*)pml4_virt, mm->kdata_page);
+        chan_task_exit(zombie);
+
+        destroy_user_memory(mm->cr3, 1);
         
         // Free PML4 Page
-        void* pml4_virt = (void*)(zombie_task->cr3 + limine_hhdm);
         pmm_free_page(pml4_virt);
-        
-        // Free Task Struct
-        kfree(zombie_task);
-        
-        // Clear zombie ptr
-        zombie_task = NULL;
+
+        while (mm->free_stacks) {
+            free_stack_t* next = mm->free_stacks->next;
+            kfree(mm->free_stacks);
+            mm->free_stacks = next;
+        }
+        while (mm->share_free) {
+            share_range_t* next = mm->share_free->next;
+            kfree(mm->share_free);
+            mm->share_free = next;
+        }
+        kfree(mm);
+    } else if (mm && zombie->thread_stack) {
+        // Other threads live on, let the next one reuse this stack
+        thread_stack_put(mm, zombie->thread_stack);
     }
+    zombie->mm = NULL;
+    zombie->released = 1;
+}
 
-    if (!current_task) return current_rsp;
+static void task_free(task_t* task) {
+    pid_release(task->pid);
+    
+    // Free Task Struct
+    kfree(task);
+}
 
-    // Save the stack pointer of the task we are leaving
-    current_task->rsp = current_rsp;
+// The root task never blocks, so this always finds something to run
+static task_t* pick_next_task(task_t* from) {
+    task_t* next = from->next;
+    while (next->state != TASK_RUNNING) {
+        next = next->next;
+    }
+    return next;
+}
 
-    // Pick the next task
-    current_task = current_task->next;
+static void switch_address_space(task_t* prev, task_t* next) {
+    tss_set_rsp0(next->kernel_stack);
 
-    tss_set_rsp0(current_task->kernel_stack);
+    if (next->fs_base != prev->fs_base) {
+        wrmsr(MSR_FS_BASE, next->fs_base);
+    }
 
     uint64_t old_cr3 = read_cr3();
     
     // Only switch if it's actually different 
-    if (current_task->cr3 != 0 && current_task->cr3 != old_cr3) {
-        write_cr3(current_task->cr3);
+    if (next->cr3 != 0 && next->cr3 != old_cr3) {
+        write_cr3(next->cr3);
+    }
+}
+
+static uint64_t schedule(uint64_t current_rsp, int voluntary) {
+    if (!current_task) return current_rsp;
+
+    // Save the stack pointer of the task we are leaving
+    current_task->rsp = current_rsp;
+
+    // Pick the next task. A hand-off skips the run queue order entirely.
+    task_t* prev = current_task;
+    task_t* target = hand_off_target;
+    hand_off_target = NULL;
+
+    if (target && target != prev && target->state == TASK_RUNNING) {
+        current_task = target;
+    } else {
+        current_task = pick_next_task(prev);
     }
+    account_switch(prev, current_task, voluntary);
+
+    switch_address_space(prev, current_task);
 
     // Return the stack pointer of the task we are entering
     return current_task->rsp;
 }
 
+uint64_t scheduler_schedule(uint64_t current_rsp) {
+    return schedule(current_rsp, 0);
+}
+
+// Entered through YIELD_VECTOR (idt.asm) when a task gives up the CPU
+uint64_t scheduler_yield_handler(uint64_t current_rsp) {
+    return schedule(current_rsp, 1);
+}
+
+void scheduler_yield(void) {
+    asm volatile("int $0x81" ::: "memory");
+}
+
+// Makes the next switch go straight to task, which inherits the rest of
+// the current timeslice. Call with interrupts off, right before blocking.
+void scheduler_hand_off(task_t* task) {
+    hand_off_target = task;
+}
+
+/* Wait queue functions */
+
+// Blocks the current task until someone wakes it. Callers re-check their
+// condition afterwards, as wakeups only mean "something changed".
+void wait_queue_sleep(wait_queue_t* wq) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    current_task->state = TASK_BLOCKED;
+    current_task->wait_next = NULL;
+
+    if (wq->tail) wq->tail->wait_next = current_task;
+    else wq->head = current_task;
+    wq->tail = current_task;
+
+    scheduler_yield();
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+static void wait_queue_remove(wait_queue_t* wq, task_t* task) {
+    task_t* prev = NULL;
+    for (task_t* t = wq->head; t; prev = t, t = t->wait_next) {
+        if (t != task) continue;
+
+        if (prev) prev->wait_next = t->wait_next;
+        else wq->head = t->wait_next;
+        if (wq->tail == t) wq->tail = prev;
+
+        t->wait_next = NULL;
+        return;
+    }
+}
+
+// Like wait_queue_sleep(), but gives up once kdata_ticks() reaches
+// wake_tick. Returns 1 on timeout, 0 if woken through the queue.
+int wait_queue_sleep_until(wait_queue_t* wq, uint64_t wake_tick) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    int timed_out = 0;
+
+    if (kdata_ticks() >= wake_tick) {
+        timed_out = 1;
+    } else {
+        timer_arm(current_task, wake_tick);
+        wait_queue_sleep(wq);
+
+        // Whichever side did not fire still holds a reference to us
+        timer_cancel(current_task);
+        wait_queue_remove(wq, current_task);
+        timed_out = kdata_ticks() >= wake_tick;
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+    return timed_out;
+}
+
+task_t* wait_queue_wake_one(wait_queue_t* wq) {
+    task_t* task = wq->head;
+    if (!task) return NULL;
+
+    wq->head = task->wait_next;
+    if (!wq->head) wq->tail = NULL;
+
+    task->wait_next = NULL;
+    task_wake(task);
+    return task;
+}
+
+// Wakes one specific sleeper. Returns 0 if it was not on the queue.
+int wait_queue_wake_task(wait_queue_t* wq, task_t* task) {
+    for (task_t* t = wq->head; t; t = t->wait_next) {
+        if (t != task) continue;
+
+        wait_queue_remove(wq, task);
+        task_wake(task);
+        return 1;
+    }
+    return 0;
+}
+
+int wait_queue_wake_all(wait_queue_t* wq) {
+    int woken = 0;
+    while (wait_queue_wake_one(wq)) woken++;
+    return woken;
+}
+
+void task_wake(task_t* task) {
+    if (task->state == TASK_BLOCKED) {
+        task->state = TASK_RUNNING;
+    }
+}
+
+/* Mutex functions */
+
+// The root task must stay runnable, so it yields instead of sleeping
+void mutex_lock(mutex_t* m) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    while (m->locked) {
+        if (current_task->pid == 0) scheduler_yield();
+        else wait_queue_sleep(&m->wq);
+    }
+    m->locked = 1;
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+void mutex_unlock(mutex_t* m) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    m->locked = 0;
+    wait_queue_wake_one(&m->wq);
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+/* Reaper functions */
+
+// Frees exited tasks outside of interrupt context. The reaper sleeps while
+// the zombie list is empty, so it only competes for the CPU after an exit.
+static void reaper_main(void) {
+    asm volatile("cli");
+
+    while (1) {
+        while (!zombie_head) {
+            wait_queue_sleep(&reaper_wq);
+        }
+
+        task_t* zombie = zombie_head;
+        zombie_head = zombie->next;
+        if (!zombie_head) zombie_tail = NULL;
+        zombie->next = NULL;
+
+        task_release(zombie);
+
+        // Nobody is going to wait for an orphan
+        if (zombie->parent) {
+            wait_queue_wake_all(&zombie->parent->child_exit);
+        } else {
+            task_free(zombie);
+        }
+
+        // Let the timer in between zombies
+        asm volatile("sti; nop; cli");
+    }
+}
+
 /* Process creation functions */
 
-void create_kernel_task(void (*entry_point)()) {
+task_t* create_kernel_task(void (*entry_point)()) {
     task_t* new_task = (task_t*)kmalloc(sizeof(task_t));
+    memset(new_task, 0, sizeof(task_t));
+    task_set_name(new_task, "kthread");
+
+    int64_t pid = pid_alloc(new_task);
+    if (pid < 0) {
+        serial_printf("Task creation failed: PID table full\n");
+        kfree(new_task);
+        return NULL;
+    }
     
-    uint64_t stack_bottom = (uint64_t)kmalloc(4096);
-    uint64_t stack_top = stack_bottom + 4096;
+    uint64_t stack_bottom = (uint64_t)kmalloc(KERNEL_STACK_SIZE);
+    uint64_t stack_top = stack_bottom + KERNEL_STACK_SIZE;
 
     uint64_t* sp = (uint64_t*)stack_top;
     
@@ -102,18 +462,37 @@ void create_kernel_task(void (*entry_point)()) {
 
     // Create task struct
     new_task->rsp = (uint64_t)sp;
-    new_task->pid = next_pid++;
+    new_task->pid = (uint64_t)pid;
+    new_task->tgid = new_task->pid;
+    new_task->kernel_stack = stack_top;
     new_task->cr3 = (uint64_t)vmm_create_process_pml4(kernel_pml4);
     
     // Add to linked list
-    new_task->next = task_head->next;
-    task_head->next = new_task;
+    task_list_insert(new_task);
     
     serial_printf("Task created: PID %d\n", new_task->pid);
+
+    return new_task;
+}
+
+// Undoes a half-built process: frees whatever parts of task were set up,
+// the user mappings and the PML4. task may be NULL if it was not allocated.
+static void abort_user_process(uint64_t* pml4_virt, task_t* task) {
+    if (task) {
+        if (task->files) fd_table_put(task->files);
+        if (task->mm) kfree(task->mm);
+        if (task->kernel_stack) kfree((void*)(task->kernel_stack - KERNEL_STACK_SIZE));
+        if (task->pid) pid_release(task->pid);
+        kfree(task);
+    }
+
+    destroy_user_memory(get_phys_addr(pml4_virt), 0);
+    pmm_free_page(pml4_virt);
 }
 
 int create_user_process_from_file(const char* filename, int argc, char** argv, int is_wm) {
     uint64_t* pml4_virt = pmm_alloc_page(); 
+    if (!pml4_virt) return -1;
     uint64_t* pml4_phys = (uint64_t*)get_phys_addr(pml4_virt);
     
     // Copy kernel mappings
@@ -125,26 +504,16 @@ int create_user_process_from_file(const char* filename, int argc, char** argv, i
     elf_load_result_t elf;
     int load_err = load_elf_file(filename, pml4_virt, &elf);
     if (load_err < 0) {
+        abort_user_process(pml4_virt, NULL);
         return -1;
     }
 
     /* Allocate user stack */
-    size_t stack_pages = USER_STACK_SIZE / 4096;
-    if (USER_STACK_SIZE % 4096 != 0) stack_pages++;
-
     void* stack_page_virt = NULL;
-
-    for (size_t i = 0; i < stack_pages; i++) {
-        void* stack_page = pmm_alloc_page();
-        if (!stack_page) {
-            serial_printf("OOM during stack allocation\n");
-            return -1;
-        }
-
-        if (i == 0) stack_page_virt = stack_page;
-
-        uint64_t page_vaddr = USER_STACK_TOP - ((i + 1) * 4096);
-        vmm_map_page(pml4_virt, page_vaddr, get_phys_addr(stack_page), 0x7);
+    map_user_stack(pml4_virt, USER_STACK_TOP, USER_STACK_SIZE, &stack_page_virt);
+    if (!stack_page_virt) {
+        abort_user_process(pml4_virt, NULL);
+        return -1;
     }
 
     //uint64_t user_stack_top = USER_STACK_TOP;
@@ -155,7 +524,8 @@ int create_user_process_from_file(const char* filename, int argc, char** argv, i
     char* stack_base = (char*)stack_page_virt;
 
     // Store USER virt addresses of strings we copy
-    uint64_t user_argv_addrs[32];
+    uint64_t user_argv_addrs[EXEC_MAX_ARGS];
+    if (argc > EXEC_MAX_ARGS) argc = EXEC_MAX_ARGS;
 
     // Copy strings
     for (int i = 0; i < argc; i++) {
@@ -187,18 +557,62 @@ int create_user_process_from_file(const char* filename, int argc, char** argv, i
 
     // Create task struct 
     task_t* new_task = (task_t*)kmalloc(sizeof(task_t));
+    if (!new_task) {
+        serial_printf("OOM when task struct\n");
+        abort_user_process(pml4_virt, NULL);
+        return -1;
+    }
     memset(new_task, 0, sizeof(task_t));
 
-    new_task->pid = next_pid++;
+    int64_t pid = pid_alloc(new_task);
+    if (pid < 0) {
+        serial_printf("Process creation failed: PID table full\n");
+        abort_user_process(pml4_virt, new_task);
+        return -1;
+    }
+
+    new_task->pid = (uint64_t)pid;
+    new_task->tgid = new_task->pid;
     new_task->cr3 = (uint64_t)pml4_phys;
-    new_task->kernel_stack = (uint64_t)kmalloc(4096*4) + 4096;
-    if (!new_task->kernel_stack) {
+    task_set_name(new_task, filename);
+
+    void* kernel_stack = kmalloc(KERNEL_STACK_SIZE);
+    if (!kernel_stack) {
         serial_printf("OOM when kernel stack\n");
+        abort_user_process(pml4_virt, new_task);
         return -1;
     }
+    new_task->kernel_stack = (uint64_t)kernel_stack + KERNEL_STACK_SIZE;
 
     new_task->next = NULL;
-    new_task->program_break = elf.program_break;
+
+    address_space_t* mm = (address_space_t*)kmalloc(sizeof(address_space_t));
+    if (!mm) {
+        serial_printf("OOM when address space\n");
+        abort_user_process(pml4_virt, new_task);
+        return -1;
+    }
+    memset(mm, 0, sizeof(address_space_t));
+    mm->cr3 = new_task->cr3;
+    mm->program_break = elf.program_break;
+    mm->thread_stack_next = THREAD_STACK_TOP;
+    mm->share_next = USER_SHARE_BASE;
+    mm->users = 1;
+    new_task->mm = mm;
+
+    new_task->files = fd_table_create();
+    if (!new_task->files) {
+        serial_printf("OOM when file table\n");
+        abort_user_process(pml4_virt, new_task);
+        return -1;
+    }
+
+    mm->kdata_page = kdata_map_process(pml4_virt, new_task->pid);
+    if (!mm->kdata_page) {
+        serial_printf("OOM when kernel data page\n");
+        abort_user_process(pml4_virt, new_task);
+        return -1;
+    }
 
     // If the task will be launched as a window manager, map framebuffer to userspace
     if (is_wm) {
@@ -248,59 +662,304 @@ int create_user_process_from_file(const char* filename, int argc, char** argv, i
     sp--; *sp = 0; // R15
     
     new_task->rsp = (uint64_t)sp;
+
+    // Processes started by the kernel itself have no one to wait for them
+    if (current_task && current_task->mm) {
+        new_task->parent = current_task;
+        new_task->sibling = current_task->children;
+        current_task->children = new_task;
+    }
     
     // Add task to linked list
-    new_task->next = task_head->next;
-    task_head->next = new_task;
+    task_list_insert(new_task);
     
     serial_printf("Process loaded from %s! Entry: 0x%x\n", filename, elf.entry);
 
     return new_task->pid;
 }
 
+// Returns the top of a mapped thread stack, reusing one left by an exited
+// thread before carving a new one below the previous. 0 when out of space.
+static uint64_t thread_stack_get(address_space_t* mm, uint64_t* pml4_virt) {
+    free_stack_t* fs = mm->free_stacks;
+    if (fs) {
+        uint64_t top = fs->top;
+        mm->free_stacks = fs->next;
+        kfree(fs);
+
+        // The new thread expects a zero return address at the top, as on a
+        // freshly mapped stack
+        uint64_t top_page = vmm_get_mapping(pml4_virt, top - PAGE_SIZE);
+        if (top_page) memset((void*)(top_page + limine_hhdm), 0, PAGE_SIZE);
+        return top;
+    }
+
+    uint64_t top = mm->thread_stack_next;
+    if (top - THREAD_STACK_SIZE <= mm->program_break) {
+        serial_printf("Thread creation failed: out of stack space\n");
+        return 0;
+    }
+
+    void* stack_page_virt = NULL;
+    map_user_stack(pml4_virt, top, THREAD_STACK_SIZE, &stack_page_virt);
+    if (!stack_page_virt) return 0;
+
+    mm->thread_stack_next = top - THREAD_STACK_SIZE - THREAD_STACK_GAP;
+    return top;
+}
+
+// The pages stay mapped, so if the list node cannot be allocated the range
+// is simply never reused
+static void thread_stack_put(address_space_t* mm, uint64_t top) {
+    free_stack_t* fs = (free_stack_t*)kmalloc(sizeof(free_stack_t));
+    if (!fs) return;
+
+    fs->top = top;
+    fs->next = mm->free_stacks;
+    mm->free_stacks = fs;
+}
+
+// Returns the base of size bytes (page multiple) of the share window, the
+// first unmapped range that fits before untouched space. 0 when full.
+uint64_t share_va_alloc(address_space_t* mm, uint64_t size) {
+    for (share_range_t** link = &mm->share_free; *link; link = &(*link)->next) {
+        share_range_t* r = *link;
+        if (r->size < size) continue;
+
+        uint64_t base = r->base;
+        r->base += size;
+        r->size -= size;
+        if (r->size == 0) {
+            *link = r->next;
+            kfree(r);
+        }
+        return base;
+    }
+
+    if (mm->share_next + size > USER_SHARE_BASE + USER_SHARE_SIZE) return 0;
+
+    uint64_t base = mm->share_next;
+    mm->share_next += size;
+    return base;
+}
+
+// Gives a range back to the share window, merging it with its neighbours.
+// If the list node cannot be allocated the range is simply never reused.
+void share_va_free(address_space_t* mm, uint64_t base, uint64_t size) {
+    share_range_t* prev = NULL;
+    share_range_t* next = mm->share_free;
+    while (next && next->base < base) {
+        prev = next;
+        next = next->next;
+    }
+
+    if (prev && prev->base + prev->size == base) {
+        prev->size += size;
+    } else {
+        share_range_t* r = (share_range_t*)kmalloc(sizeof(share_range_t));
+        if (!r) return;
+
+        r->base = base;
+        r->size = size;
+        r->next = next;
+        if (prev) prev->next = r;
+        else mm->share_free = r;
+        prev = r;
+    }
+
+    if (next && prev->base + prev->size == next->base) {
+        prev->size += next->size;
+        prev->next = next->next;
+        kfree(next);
+    }
+
+    // The last range shrinks untouched space again rather than staying listed
+    if (!prev->next && prev->base + prev->size == mm->share_next) {
+        mm->share_next = prev->base;
+        if (mm->share_free == prev) {
+            mm->share_free = NULL;
+        } else {
+            share_range_t* r = mm->share_free;
+            while (r->next != prev) r = r->next;
+            r->next = NULL;
+        }
+        kfree(prev);
+    }
+}
+
+// Adds another task to the calling process. It shares the caller's page
+// tables and heap, and starts at entry(arg) on a fresh stack.
+int create_user_thread(uint64_t entry, uint64_t arg, uint64_t tls) {
+    task_t* parent = current_task;
+    address_space_t* mm = parent->mm;
+    if (!mm) return -1;
+
+    uint64_t* pml4_virt = (uint64_t*)get_virt_addr(mm->cr3);
+
+    uint64_t stack_top = thread_stack_get(mm, pml4_virt);
+    if (!stack_top) return -1;
+
+    task_t* new_task = (task_t*)kmalloc(sizeof(task_t));
+    memset(new_task, 0, sizeof(task_t));
+
+    int64_t pid = pid_alloc(new_task);
+    if (pid < 0) {
+        serial_printf("Thread creation failed: PID table full\n");
+        thread_stack_put(mm, stack_top);
+        kfree(new_task);
+        return -1;
+    }
+
+    void* kernel_stack = kmalloc(KERNEL_STACK_SIZE);
+    if (!kernel_stack) {
+        serial_printf("OOM when kernel stack\n");
+        thread_stack_put(mm, stack_top);
+        pid_release((uint64_t)pid);
+        kfree(new_task);
+        return -1;
+    }
+
+    new_task->pid = (uint64_t)pid;
+    new_task->tgid = parent->tgid;
+    new_task->cr3 = mm->cr3;
+    new_task->mm = mm;
+    new_task->files = parent->files;
+    if (new_task->files) new_task->files->users++;
+    new_task->is_wm = parent->is_wm;
+    new_task->fs_base = tls;
+    new_task->thread_stack = stack_top;
+    new_task->kernel_stack = (uint64_t)kernel_stack + KERNEL_STACK_SIZE;
+    memcpy(new_task->name, parent->name, TASK_NAME_LEN);
+    mm->users++;
+
+    // Leave a zero return address below the 16-byte aligned stack top,
+    // as if entry had just been called
+    uint64_t user_rsp = stack_top - 16 - 8;
+
+    uint64_t* sp = (uint64_t*)new_task->kernel_stack;
+
+    sp--; *sp = 0x23;               // SS
+    sp--; *sp = user_rsp;           // RSP
+    sp--; *sp = 0x202;              // RFLAGS
+    sp--; *sp = 0x1B;               // CS
+    sp--; *sp = entry;              // RIP
+
+    sp--; *sp = 0; // RAX
+    sp--; *sp = 0; // RBX
+    sp--; *sp = 0; // RCX
+    sp--; *sp = 0; // RDX
+    sp--; *sp = 0; // RSI
+
+    // RDI holds the thread argument
+    sp--; *sp = arg;
+
+    for (int i = 0; i < 9; i++) {   // RBP, R8 - R15
+        sp--; *sp = 0;
+    }
+
+    new_task->rsp = (uint64_t)sp;
+
+    task_list_insert(new_task);
+
+    serial_printf("Thread %d created in process %d\n", new_task->pid, new_task->tgid);
+
+    return new_task->pid;
+}
+
 /* Process freeing functions */
 
-void task_exit(void) {
+void task_exit(int code) {
     asm volatile("cli"); // Disable interrupts
 
     task_t* victim = current_task;
     
     serial_printf("Exiting PID %d...\n", victim->pid);
 
-    // Find the previous task in the list to unlink victim
-    task_t* prev = task_head;
-    while (prev->next != victim) {
-        prev = prev->next;
-        if (prev == task_head && victim != task_head) {
-             serial_printf("Panic: Corrupt task list\n");
-             while(1);
+    victim->exit_code = code;
+
+    // Orphan the children. Ones that already exited are not waited for anymore.
+    task_t* child = victim->children;
+    while (child) {
+        task_t* next = child->sibling;
+        child->parent = NULL;
+        child->sibling = NULL;
+        if (child->state == TASK_ZOMBIE && child->released) {
+            task_free(child);
         }
+        child = next;
     }
+    victim->children = NULL;
 
-    // Unlink the victim
-    prev->next = victim->next;
-    
-    if (victim == task_head) {
-        task_head = victim->next;
-    }
+    // Callers waiting for a reply see the task gone and give up
+    wait_queue_wake_all(&victim->ipc_reply_wq);
 
-    zombie_task = victim; // Scheduled for deletion
+    // Unlink the victim from the run queue, its PID lives on until reaped
+    task_list_remove(victim);
 
-    // Switch to next task
-    current_task = victim->next; 
+    victim->state = TASK_ZOMBIE;
 
-    tss_set_rsp0(current_task->kernel_stack + 4096);
+    // Hand it to the reaper, which wakes the parent once it is freed
+    victim->next = NULL;
+    if (zombie_tail) zombie_tail->next = victim;
+    else zombie_head = victim;
+    zombie_tail = victim;
+    wait_queue_wake_one(&reaper_wq);
 
-    uint64_t old_cr3 = read_cr3();
-    if (current_task->cr3 != 0 && current_task->cr3 != old_cr3) {
-        write_cr3(current_task->cr3);
-    }
+    // Switch to next task (task_list_remove left victim->prev intact)
+    current_task = pick_next_task(victim->prev); 
+    account_switch(victim, current_task, 1);
+
+    switch_address_space(victim, current_task);
 
     // Jump to the new stack and restore registers (switch.asm)
     exit_switch_to(current_task->rsp);
 }
 
-void free_page_table_level(uint64_t* table_virt, int level) {
+static void task_unlink_child(task_t* parent, task_t* child) {
+    task_t** link = &parent->children;
+    while (*link && *link != child) {
+        link = &(*link)->sibling;
+    }
+    if (*link) *link = child->sibling;
+    child->sibling = NULL;
+    child->parent = NULL;
+}
+
+// Waits for a child of the current task to exit and frees it.
+// pid -1 waits for any child. Returns the child's PID, or -1 if there is
+// no such child.
+int task_waitpid(int64_t pid, int* exit_code_out) {
+    task_t* self = current_task;
+
+    while (1) {
+        task_t* found = NULL;
+        int have_child = 0;
+
+        for (task_t* child = self->children; child; child = child->sibling) {
+            if (pid != -1 && child->pid != (uint64_t)pid) continue;
+            have_child = 1;
+            if (child->state == TASK_ZOMBIE && child->released) {
+                found = child;
+                break;
+            }
+        }
+
+        if (!have_child) return -1;
+
+        if (found) {
+            int child_pid = (int)found->pid;
+            if (exit_code_out) *exit_code_out = found->exit_code;
+
+            task_unlink_child(self, found);
+            task_free(found);
+            return child_pid;
+        }
+
+        wait_queue_sleep(&self->child_exit);
+    }
+}
+
+void free_page_table_level(uint64_t* table_virt, int level, int preemptible) {
     for (int i = 0; i < 512; i++) {
         uint64_t entry = table_virt[i];
         
@@ -312,7 +971,7 @@ void free_page_table_level(uint64_t* table_virt, int level) {
 
         if (level > 1) {
             // If we are at PML4, PDP, or PD, recurse deeper
-            free_page_table_level(child_virt, level - 1);
+            free_page_table_level(child_virt, level - 1, preemptible);
         } 
         else if (level == 1) {
             // We are at the Page Table (PT). This entry points to a physical page of RAM.
@@ -327,10 +986,16 @@ void free_page_table_level(uint64_t* table_virt, int level) {
         
         // Clear the entry
         table_virt[i] = 0;
+
+        // Open an interrupt window after every page table (up to 2 MB of
+        // pages) so a large address space does not stall the timer
+        if (preemptible && level == 2) {
+            asm volatile("sti; nop; cli");
+        }
     }
 }
 
-void destroy_user_memory(uint64_t pml4_phys) {
+void destroy_user_memory(uint64_t pml4_phys, int preemptible) {
     uint64_t* pml4_virt = (uint64_t*)get_virt_addr(pml4_phys);
 
     // NOTE: Only clear the lower half (User Space: 0 to 255)
@@ -342,7 +1007,7 @@ void destroy_user_memory(uint64_t pml4_phys) {
             uint64_t* pdp_virt = (uint64_t*)get_virt_addr(pdp_phys);
             
             // Start recursion from PDP (Level 3)
-            free_page_table_level(pdp_virt, 3);
+            free_page_table_level(pdp_virt, 3, preemptible);
             
             // Free the PDP table itself
             pmm_free_page(pdp_virt);
@@ -354,18 +1019,67 @@ void destroy_user_memory(uint64_t pml4_phys) {
 
 /* Helper functions */
 
-void copy_to_user_mem(uint64_t* user_pml4, uint64_t vaddr, void* data, uint64_t size) {
-    uint64_t old_cr3 = read_cr3();
-    write_cr3((uint64_t)user_pml4);
-    memcpy((void*)vaddr, data, size);
-    write_cr3(old_cr3);
+// Maps size bytes of zeroed stack ending at top. Returns the HHDM address of
+// the highest page through top_page_out (NULL on failure) so callers can
+// write initial data without switching page tables.
+static void map_user_stack(uint64_t* pml4_virt, uint64_t top, uint64_t size, void** top_page_out) {
+    size_t stack_pages = size / 4096;
+    if (size % 4096 != 0) stack_pages++;
+
+    *top_page_out = NULL;
+
+    for (size_t i = 0; i < stack_pages; i++) {
+        void* stack_page = pmm_alloc_page();
+        if (!stack_page) {
+            serial_printf("OOM during stack allocation\n");
+            *top_page_out = NULL;
+            return;
+        }
+        memset(stack_page, 0, PAGE_SIZE);
+
+        if (i == 0) *top_page_out = stack_page;
+
+        uint64_t page_vaddr = top - ((i + 1) * 4096);
+        vmm_map_page(pml4_virt, page_vaddr, get_phys_addr(stack_page), 0x7);
+    }
 }
 
-task_t* get_task_by_pid(uint64_t pid) {
+// Fills up to max entries and returns the total number of tasks
+int task_collect_stats(task_stats_t* out, uint64_t max) {
+    uint64_t now = rdtsc();
+    int count = 0;
+
     task_t* curr = task_head;
     do {
-        if (curr->pid == pid) return curr;
+        if ((uint64_t)count < max) {
+            task_stats_t* st = &out[count];
+            memset(st, 0, sizeof(task_stats_t));
+
+            uint64_t runtime = curr->runtime_tsc;
+            if (curr == current_task) {
+                // Include the slice that is still running
+                runtime += now - curr->switched_in_tsc;
+                st->is_current = 1;
+            }
+
+            st->pid = curr->pid;
+            memcpy(st->name, curr->name, TASK_NAME_LEN);
+            st->state = curr->state;
+            st->runtime_ns = kdata_tsc_to_ns(runtime);
+            st->nr_voluntary = curr->nr_voluntary;
+            st->nr_involuntary = curr->nr_involuntary;
+        }
+
+        count++;
         curr = curr->next;
     } while (curr != task_head);
-    return NULL;
+
+    return count;
+}
+
+task_t* get_task_by_pid(uint64_t pid) {
+    task_t* task = pid_table[PID_SLOT(pid)].task;
+    if (!task || task->pid != pid) return NULL;
+    if (task->state == TASK_ZOMBIE) return NULL;
+    return task;
 }
@@ -0,0 +1,80 @@
+#include <timer.h>
+
+extern task_t* current_task;
+
+// Armed tasks, sorted by wake_tick
+static task_t* timer_head = NULL;
+
+/* Timer functions */
+
+// Called from the PIT interrupt after kdata_tick()
+void timer_tick(void) {
+    uint64_t now = kdata_ticks();
+
+    while (timer_head && timer_head->wake_tick <= now) {
+        task_t* task = timer_head;
+        timer_head = task->timer_next;
+
+        task->timer_next = NULL;
+        task->timer_armed = 0;
+        task_wake(task);
+    }
+}
+
+void timer_arm(task_t* task, uint64_t wake_tick) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    if (task->timer_armed) timer_cancel(task);
+
+    task->wake_tick = wake_tick;
+    task->timer_armed = 1;
+
+    task_t** link = &timer_head;
+    while (*link && (*link)->wake_tick <= wake_tick) {
+        link = &(*link)->timer_next;
+    }
+    task->timer_next = *link;
+    *link = task;
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+void timer_cancel(task_t* task) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    if (task->timer_armed) {
+        task_t** link = &timer_head;
+        while (*link && *link != task) {
+            link = &(*link)->timer_next;
+        }
+        if (*link) *link = task->timer_next;
+
+        task->timer_next = NULL;
+        task->timer_armed = 0;
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+// Rounds up, so a sleep never ends early
+uint64_t timer_ns_to_ticks(uint64_t ns) {
+    uint64_t hz = kdata_tick_hz();
+    return (ns / 1000000000ULL) * hz + ((ns % 1000000000ULL) * hz + 999999999ULL) / 1000000000ULL;
+}
+
+void timer_sleep_ticks(uint64_t ticks) {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    uint64_t deadline = kdata_ticks() + ticks;
+
+    while (kdata_ticks() < deadline) {
+        timer_arm(current_task, deadline);
+        current_task->state = TASK_BLOCKED;
+        scheduler_yield();
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+}
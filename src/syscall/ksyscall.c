@@ -1,10 +1,31 @@
 #include <ksyscall.h>
+#include <trace.h>
+
+static uint64_t syscall_dispatch(registers_t* regs, uint64_t syscall_number);
 
 // This function is called from assembly descriptors/idt.asm
 // Returns: The value to be put in RAX (return value)
 uint64_t syscall_dispatcher(registers_t* regs) {
     uint64_t syscall_number = regs->rax; // RAX holds the syscall number
 
+    if (!trace_flags) {
+        return syscall_dispatch(regs, syscall_number);
+    }
+
+    // sys_exit never returns, record it on the way in
+    if (syscall_number == SYS_EXIT) {
+        uint64_t now = rdtsc();
+        trace_syscall(regs, syscall_number, regs->rdi, now, now);
+    }
+
+    uint64_t start = rdtsc();
+    uint64_t ret = syscall_dispatch(regs, syscall_number);
+    trace_syscall(regs, syscall_number, ret, start, rdtsc());
+
+    return ret;
+}
+
+static uint64_t syscall_dispatch(registers_t* regs, uint64_t syscall_number) {
     // SysV ABI for arguments: RDI, RSI, RDX, RCX, R8, R9
     switch (syscall_number) {
         case SYS_WRITE:
@@ -15,13 +36,29 @@ uint64_t syscall_dispatcher(registers_t* regs) {
             sys_exit((int)regs->rdi);
             return 0;
 
+        case SYS_WAITPID:
+            // RDI = child pid (-1 for any), RSI = int* exit status (may be NULL)
+            return sys_waitpid((int)regs->rdi, (int*)regs->rsi);
+
         case SYS_READ_KEY:
             return sys_read_key();
 
+        case SYS_LOG_READ:
+            // RDI = buffer, RSI = buffer size; returns the newest log bytes
+            return sys_log_read((char*)regs->rdi, regs->rsi);
+
+        case SYS_BLOCK_STATS:
+            // RDI = bcache_stats_t out
+            return sys_block_stats((bcache_stats_t*)regs->rdi);
+
         case SYS_EXEC: 
             // RDI=filename_ptr
              return sys_exec((const char*)regs->rdi, (int)regs->rsi, (char**)regs->rdx);
 
+        case SYS_EXEC_FDS:
+            // RDI = path, RSI = argc, RDX = argv, RCX = int[3] descriptors for the child's 0-2
+            return sys_exec_fds((const char*)regs->rdi, (int)regs->rsi, (char**)regs->rdx, (const int*)regs->rcx);
+
         case SYS_GET_FB_INFO:
             return sys_get_fb_info((struct fb_info*)regs->rdi);
 
@@ -42,6 +79,18 @@ uint64_t syscall_dispatcher(registers_t* regs) {
             // RDI = pointer to message_t struct in user memory
             return sys_ipc_recv((message_t*)regs->rdi);
 
+        case SYS_IPC_CALL:
+            // RDI = dest_pid, RSI = message_t* (request in, reply out)
+            return sys_ipc_call((int)regs->rdi, (message_t*)regs->rsi);
+
+        case SYS_IPC_REPLY_WAIT:
+            // RDI = pid to reply to (0 = none), RSI = message_t* (reply in, next message out)
+            return sys_ipc_reply_wait((int)regs->rdi, (message_t*)regs->rsi);
+
+        case SYS_WAIT_EVENTS:
+            // RDI = EVENT_* mask, RSI = timeout in ns (EVENT_TIMER only)
+            return sys_wait_events((uint32_t)regs->rdi, regs->rsi);
+
         case SYS_SHARE_MEM:
             // RDI=target_pid, RSI=size, RDX=pointer to output variable (target_vaddr)
             return sys_share_mem(
@@ -62,6 +111,88 @@ uint64_t syscall_dispatcher(registers_t* regs) {
         case SYS_DIR_READ:
             return sys_read_dir_entry((const char*)regs->rdi, regs->rsi, (struct kdirent*)regs->rdx);
 
+        case SYS_OPEN:
+            // RDI = path, RSI = O_* flags
+            return sys_open((const char*)regs->rdi, (uint32_t)regs->rsi);
+
+        case SYS_READ:
+            // RDI = fd, RSI = buffer, RDX = length
+            return sys_read((int)regs->rdi, (void*)regs->rsi, regs->rdx);
+
+        case SYS_PREAD:
+            // RDI = fd, RSI = buffer, RDX = length, RCX = file offset
+            return sys_pread((int)regs->rdi, (void*)regs->rsi, regs->rdx, regs->rcx);
+
+        case SYS_SEEK:
+            // RDI = fd, RSI = offset, RDX = SEEK_SET/SEEK_CUR/SEEK_END
+            return sys_seek((int)regs->rdi, (int64_t)regs->rsi, (int)regs->rdx);
+
+        case SYS_CLOSE:
+            return sys_close((int)regs->rdi);
+
+        case SYS_FD_WRITE:
+            // RDI = fd, RSI = buffer, RDX = length
+            return sys_fd_write((int)regs->rdi, (const void*)regs->rsi, regs->rdx);
+
+        case SYS_FSTAT:
+            // RDI = fd, RSI = struct kstat*
+            return sys_fstat((int)regs->rdi, (struct kstat*)regs->rsi);
+
+        case SYS_PIPE:
+            // RDI = int[2], receives the read and write descriptors
+            return sys_pipe((int*)regs->rdi);
+
+        case SYS_GETDENTS:
+            // RDI = directory fd, RSI = kdirent buffer, RDX = buffer size in bytes
+            return sys_getdents((int)regs->rdi, (struct kdirent*)regs->rsi, regs->rdx);
+
+        case SYS_TASK_STATS:
+            // RDI = task_stats_t array, RSI = capacity in entries
+            return sys_task_stats((task_stats_t*)regs->rdi, regs->rsi);
+
+        case SYS_THREAD_CREATE:
+            // RDI = entry point, RSI = argument, RDX = TLS base (FS)
+            return sys_thread_create(regs->rdi, regs->rsi, regs->rdx);
+
+        case SYS_FUTEX_WAIT:
+            // RDI = futex word, RSI = expected value
+            return sys_futex_wait((uint32_t*)regs->rdi, (uint32_t)regs->rsi);
+
+        case SYS_FUTEX_WAKE:
+            // RDI = futex word, RSI = max waiters to wake
+            return sys_futex_wake((uint32_t*)regs->rdi, (uint32_t)regs->rsi);
+
+        case SYS_RING_SETUP:
+            return sys_ring_setup();
+
+        case SYS_RING_ENTER:
+            // RDI = SQEs to submit, RSI = completions to wait for, RDX = flags
+            return sys_ring_enter((uint32_t)regs->rdi, (uint32_t)regs->rsi, (uint32_t)regs->rdx);
+
+        case SYS_CHAN_CREATE:
+            // RDI = peer PID, RSI = data bytes per direction, RDX = chan_info_t out
+            return sys_chan_create((int)regs->rdi, regs->rsi, (struct chan_info*)regs->rdx);
+
+        case SYS_CHAN_ACCEPT:
+            // RDI = channel id, RSI = chan_info_t out
+            return sys_chan_accept(regs->rdi, (struct chan_info*)regs->rsi);
+
+        case SYS_CHAN_NOTIFY:
+            // RDI = channel id
+            return sys_chan_notify(regs->rdi);
+
+        case SYS_CHAN_CLOSE:
+            // RDI = channel id
+            return sys_chan_close(regs->rdi);
+
+        case SYS_TRACE_CTL:
+            // RDI = TRACE_CTL_* command, RSI/RDX = command arguments
+            return sys_trace_ctl(regs->rdi, regs->rsi, regs->rdx);
+
+        case SYS_TRACE_READ:
+            // RDI = trace_record_t array, RSI = capacity, RDX = timeout in ms
+            return sys_trace_read((trace_record_t*)regs->rdi, regs->rsi, regs->rdx);
+
         default:
             serial_printf("[KERNEL] Unknown Syscall: %d\n", syscall_number);
             return -1;
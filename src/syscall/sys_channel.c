@@ -0,0 +1,198 @@
+#include <ksyscall.h>
+#include <channel.h>
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+static channel_t channels[CHAN_MAX];
+
+/* Helper functions */
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+// Which side of the channel the process is, or -1
+static int chan_side(channel_t* chan, uint64_t pid) {
+    if (!chan->used || pid == 0) return -1;
+    if (chan->pids[0] == pid) return 0;
+    if (chan->pids[1] == pid) return 1;
+    return -1;
+}
+
+static channel_t* chan_lookup(uint64_t id, int* side) {
+    if (id >= CHAN_MAX) return NULL;
+
+    channel_t* chan = &channels[id];
+    *side = chan_side(chan, current_task->tgid);
+    return *side < 0 ? NULL : chan;
+}
+
+// Returns the user address the pages landed at, 0 when the window is full
+static uint64_t chan_map(task_t* task, channel_t* chan) {
+    address_space_t* mm = task->mm;
+    uint64_t base = share_va_alloc(mm, chan->nr_pages * PAGE_SIZE);
+    if (!base) return 0;
+
+    uint64_t* pml4_virt = (uint64_t*)(mm->cr3 + limine_hhdm);
+    for (uint64_t i = 0; i < chan->nr_pages; i++) {
+        vmm_map_page(pml4_virt, base + i * PAGE_SIZE,
+                     virt_to_phys((uint8_t*)chan->pages + i * PAGE_SIZE), 0x7);
+    }
+    return base;
+}
+
+static void chan_unmap(address_space_t* mm, channel_t* chan, int side) {
+    uint64_t* pml4_virt = (uint64_t*)(mm->cr3 + limine_hhdm);
+    for (uint64_t i = 0; i < chan->nr_pages; i++) {
+        vmm_unmap_page(pml4_virt, chan->user_base[side] + i * PAGE_SIZE);
+    }
+    share_va_free(mm, chan->user_base[side], chan->nr_pages * PAGE_SIZE);
+}
+
+static void chan_doorbell(channel_t* chan, int side) {
+    task_t* peer = get_task_by_pid(chan->pids[side]);
+    if (!peer) return;
+
+    peer->doorbells |= 1ULL << (chan - channels);
+    ipc_notify(peer);
+}
+
+// Drops one endpoint. The pages go back once neither side maps them.
+static void chan_close_side(channel_t* chan, int side, address_space_t* mm) {
+    if (mm) chan_unmap(mm, chan, side);
+
+    chan->pids[side] = 0;
+
+    // Tell the other side its peer is gone
+    chan_ring_t* rings = (chan_ring_t*)chan->pages;
+    rings[side].closed = 1;
+
+    if (chan->pids[side ^ 1]) {
+        chan_doorbell(chan, side ^ 1);
+        return;
+    }
+
+    pmm_free_pages(chan->pages, chan->nr_pages);
+    memset(chan, 0, sizeof(channel_t));
+}
+
+/* Channel functions */
+
+// Sender PID for a doorbell delivered to pid
+uint64_t chan_peer_pid(uint64_t id, uint64_t pid) {
+    if (id >= CHAN_MAX) return 0;
+
+    int side = chan_side(&channels[id], pid);
+    return side < 0 ? 0 : channels[id].pids[side ^ 1];
+}
+
+// Must run while the address space still exists, before destroy_user_memory()
+// would free the shared pages along with the process' own.
+void chan_task_exit(task_t* task) {
+    for (int i = 0; i < CHAN_MAX; i++) {
+        int side = chan_side(&channels[i], task->tgid);
+        if (side >= 0) chan_close_side(&channels[i], side, task->mm);
+    }
+}
+
+/* Syscall functions */
+
+// Creates a channel with size data bytes per direction between the caller
+// and peer_pid, mapped into both. Returns the channel id.
+int64_t sys_chan_create(int peer_pid, uint64_t size, chan_info_t* user_info) {
+    task_t* peer = get_task_by_pid(peer_pid);
+    if (!peer || !peer->mm || !current_task->mm) return -EINVAL;
+    if (peer->tgid == current_task->tgid) return -EINVAL;
+    if (!access_ok(user_info, sizeof(chan_info_t))) return -EFAULT;
+
+    if (size < CHAN_MIN_DATA) size = CHAN_MIN_DATA;
+    if (size > CHAN_MAX_DATA) return -EINVAL;
+
+    uint64_t data = CHAN_MIN_DATA;
+    while (data < size) data <<= 1;
+
+    int id = -1;
+    for (int i = 0; i < CHAN_MAX; i++) {
+        if (!channels[i].used) {
+            id = i;
+            break;
+        }
+    }
+    if (id < 0) return -EMFILE;
+
+    channel_t* chan = &channels[id];
+    chan->nr_pages = 1 + 2 * data / PAGE_SIZE;
+    chan->pages = pmm_alloc_pages(chan->nr_pages);
+    if (!chan->pages) return -ENOMEM;
+    memset(chan->pages, 0, PAGE_SIZE);
+
+    chan_ring_t* rings = (chan_ring_t*)chan->pages;
+    for (int i = 0; i < 2; i++) {
+        rings[i].size = (uint32_t)data;
+        rings[i].data_off = PAGE_SIZE + i * (uint32_t)data;
+    }
+
+    chan->used = 1;
+    chan->pids[0] = current_task->tgid;
+    chan->pids[1] = peer->tgid;
+    chan->user_base[0] = chan_map(current_task, chan);
+    chan->user_base[1] = chan_map(peer, chan);
+    if (!chan->user_base[0] || !chan->user_base[1]) {
+        if (chan->user_base[0]) chan_unmap(current_task->mm, chan, 0);
+        if (chan->user_base[1]) chan_unmap(peer->mm, chan, 1);
+        pmm_free_pages(chan->pages, chan->nr_pages);
+        memset(chan, 0, sizeof(channel_t));
+        return -ENOMEM;
+    }
+
+    chan_info_t info = {
+        .id = (uint64_t)id,
+        .base = chan->user_base[0],
+        .peer_pid = chan->pids[1],
+        .tx = 0,
+        .size = (uint32_t)data,
+    };
+    if (copy_to_user(user_info, &info, sizeof(info))) return -EFAULT;
+
+    return id;
+}
+
+// Looks up the caller's end of a channel another process created with it
+int64_t sys_chan_accept(uint64_t id, chan_info_t* user_info) {
+    int side;
+    channel_t* chan = chan_lookup(id, &side);
+    if (!chan) return -EBADF;
+
+    chan_info_t info = {
+        .id = id,
+        .base = chan->user_base[side],
+        .peer_pid = chan->pids[side ^ 1],
+        .tx = (uint32_t)side,
+        .size = ((chan_ring_t*)chan->pages)[0].size,
+    };
+    if (copy_to_user(user_info, &info, sizeof(info))) return -EFAULT;
+
+    return 0;
+}
+
+// Rings the peer's doorbell. Doorbells coalesce until the peer receives one.
+int64_t sys_chan_notify(uint64_t id) {
+    int side;
+    channel_t* chan = chan_lookup(id, &side);
+    if (!chan) return -EBADF;
+    if (!chan->pids[side ^ 1]) return -EPIPE;
+
+    chan_doorbell(chan, side ^ 1);
+    return 0;
+}
+
+int64_t sys_chan_close(uint64_t id) {
+    int side;
+    channel_t* chan = chan_lookup(id, &side);
+    if (!chan) return -EBADF;
+
+    chan_close_side(chan, side, current_task->mm);
+    current_task->doorbells &= ~(1ULL << id);
+    return 0;
+}
@@ -1,28 +1,110 @@
 #include <ksyscall.h>
+#include <pipe.h>
 
-int64_t sys_file_read(const char* path, void* user_buf, uint64_t max_len) {
+extern task_t* current_task;
+
+// Whole clusters go straight from disk into the bounce buffer
+#define FILE_BOUNCE_SIZE (16 * 1024)
+
+/* Helper functions */
+
+// Reads up to len bytes from the current position of fil into user memory.
+// FatFs must not fault on user memory, so data goes through a bounce buffer.
+static int64_t read_to_user(FIL* fil, void* user_buf, uint64_t len) {
+    if (!access_ok(user_buf, len)) return -EFAULT;
+
+    uint64_t left = f_size(fil) - f_tell(fil);
+    if (len > left) len = left;
+    if (len == 0) return 0;
+
+    uint64_t bounce_size = len < FILE_BOUNCE_SIZE ? len : FILE_BOUNCE_SIZE;
+    uint8_t* bounce = (uint8_t*)kmalloc(bounce_size);
+    if (!bounce) return -ENOMEM;
+
+    int64_t total = 0;
+    while ((uint64_t)total < len) {
+        // Clamp before narrowing, FatFs counts in 32 bits
+        uint64_t rest = len - total;
+        UINT chunk = (UINT)(rest < bounce_size ? rest : bounce_size);
+
+        UINT bytes_read;
+        if (f_read(fil, bounce, chunk, &bytes_read) != FR_OK) {
+            if (total == 0) total = -1;
+            break;
+        }
+
+        // Undo the position change for bytes that never reached the caller
+        if (copy_to_user((uint8_t*)user_buf + total, bounce, bytes_read)) {
+            f_lseek(fil, f_tell(fil) - bytes_read);
+            if (total == 0) total = -EFAULT;
+            break;
+        }
+
+        total += bytes_read;
+        if (bytes_read < chunk) break;
+    }
+
+    kfree(bounce);
+    return total;
+}
+
+// Counterpart of read_to_user() for writes at the current position
+static int64_t write_from_user(FIL* fil, const void* user_buf, uint64_t len) {
+    if (!access_ok(user_buf, len)) return -EFAULT;
+    if (len == 0) return 0;
+
+    uint64_t bounce_size = len < FILE_BOUNCE_SIZE ? len : FILE_BOUNCE_SIZE;
+    uint8_t* bounce = (uint8_t*)kmalloc(bounce_size);
+    if (!bounce) return -ENOMEM;
+
+    int64_t total = 0;
+    while ((uint64_t)total < len) {
+        // Clamp before narrowing, FatFs counts in 32 bits
+        uint64_t left = len - total;
+        UINT chunk = (UINT)(left < bounce_size ? left : bounce_size);
+
+        if (copy_from_user(bounce, (const uint8_t*)user_buf + total, chunk)) {
+            if (total == 0) total = -EFAULT;
+            break;
+        }
+
+        UINT written;
+        if (f_write(fil, bounce, chunk, &written) != FR_OK) {
+            if (total == 0) total = -1;
+            break;
+        }
+
+        total += written;
+        if (written < chunk) break; // Volume full
+    }
+
+    kfree(bounce);
+    return total;
+}
+
+/* Path based syscalls */
+
+int64_t sys_file_read(const char* user_path, void* user_buf, uint64_t max_len) {
+    char path[SYSCALL_PATH_MAX];
     FIL file;
-    FRESULT res;
-    UINT bytes_read;
 
-    res = f_open(&file, path, FA_READ);
-    if (res != FR_OK) return -1;
+    if (strncpy_from_user(path, user_path, sizeof(path)) < 0) return -EFAULT;
 
-    uint64_t fsize = f_size(&file);
-    if (fsize > max_len) fsize = max_len;
+    if (f_open(&file, path, FA_READ) != FR_OK) return -1;
 
-    // TODO: Verify user buffer
-    res = f_read(&file, user_buf, fsize, &bytes_read);
+    int64_t ret = read_to_user(&file, user_buf, max_len);
     f_close(&file);
 
-    if (res != FR_OK) return -1;
-    return bytes_read;
+    return ret;
 }
 
 int sys_stat(const char* user_path, struct kstat* user_stat_out) {
+    char path[SYSCALL_PATH_MAX];
     FILINFO fno;
 
-    FRESULT res = f_stat(user_path, &fno);
+    if (strncpy_from_user(path, user_path, sizeof(path)) < 0) return -EFAULT;
+
+    FRESULT res = f_stat(path, &fno);
     if (res != FR_OK) {
         return -1;
     }
@@ -33,16 +115,19 @@ int sys_stat(const char* user_path, struct kstat* user_stat_out) {
     // NOTE: FATFS AM_DIR (0x10) indicates directory
     kst.flags = (fno.fattrib & AM_DIR) ? 1 : 0; 
 
-    memcpy(user_stat_out, &kst, sizeof(struct kstat));
+    if (copy_to_user(user_stat_out, &kst, sizeof(struct kstat))) return -EFAULT;
     
     return 0;
 }
 
-int sys_read_dir_entry(const char* path, uint64_t index, struct kdirent* user_out) {
+int sys_read_dir_entry(const char* user_path, uint64_t index, struct kdirent* user_out) {
+    char path[SYSCALL_PATH_MAX];
     DIR dir;
     FILINFO fno;
     FRESULT res;
 
+    if (strncpy_from_user(path, user_path, sizeof(path)) < 0) return -EFAULT;
+
     res = f_opendir(&dir, path);
     if (res != FR_OK) {
         return -1;
@@ -70,9 +155,229 @@ int sys_read_dir_entry(const char* path, uint64_t index, struct kdirent* user_ou
     k_ent.size = fno.fsize;
     k_ent.is_dir = (fno.fattrib & AM_DIR) ? 1 : 0;
 
-    // TODO: verify user_out
-    memcpy(user_out, &k_ent, sizeof(struct kdirent));
-
     f_closedir(&dir);
+
+    if (copy_to_user(user_out, &k_ent, sizeof(struct kdirent))) return -EFAULT;
     return 0;
-}
\ No newline at end of file
+}
+
+
+/* Descriptor based syscalls */
+
+int sys_open(const char* user_path, uint32_t flags) {
+    char path[SYSCALL_PATH_MAX];
+    if (strncpy_from_user(path, user_path, sizeof(path)) < 0) return -EFAULT;
+    if (!current_task->files) return -EBADF;
+
+    int err = 0;
+    file_t* file = file_open(path, flags, &err);
+    if (!file) return err;
+
+    int fd = fd_install(current_task->files, file);
+    if (fd < 0) file_put(file);
+    return fd;
+}
+
+int64_t sys_read(int fd, void* user_buf, uint64_t len) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file || file->type == FILE_TYPE_DIR) return -EBADF;
+    if ((file->flags & O_ACCMODE) == O_WRONLY) return -EBADF;
+
+    // A sibling thread may close the descriptor while we sleep, on a pipe
+    // or on the disk
+    file->refs++;
+
+    int64_t ret;
+    if (file->type == FILE_TYPE_PIPE) {
+        ret = pipe_read(file->pipe, user_buf, len);
+    } else {
+        mutex_lock(&file->lock);
+        ret = read_to_user(&file->fil, user_buf, len);
+        mutex_unlock(&file->lock);
+    }
+
+    file_put(file);
+    return ret;
+}
+
+int64_t sys_fd_write(int fd, const void* user_buf, uint64_t len) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file || file->type == FILE_TYPE_DIR) return -EBADF;
+    if ((file->flags & O_ACCMODE) == O_RDONLY) return -EBADF;
+
+    file->refs++;
+
+    int64_t ret;
+    if (file->type == FILE_TYPE_PIPE) {
+        ret = pipe_write(file->pipe, user_buf, len);
+    } else {
+        mutex_lock(&file->lock);
+        ret = write_from_user(&file->fil, user_buf, len);
+        mutex_unlock(&file->lock);
+    }
+
+    file_put(file);
+    return ret;
+}
+
+// Like sys_stat for an open descriptor. For pipes size is the bytes buffered.
+int sys_fstat(int fd, struct kstat* user_stat_out) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file) return -EBADF;
+
+    struct kstat kst;
+    memset(&kst, 0, sizeof(kst));
+
+    switch (file->type) {
+        case FILE_TYPE_FILE:
+            kst.size = f_size(&file->fil);
+            break;
+        case FILE_TYPE_DIR:
+            kst.flags = KSTAT_DIR;
+            break;
+        case FILE_TYPE_PIPE:
+            kst.size = pipe_bytes(file->pipe);
+            kst.flags = KSTAT_PIPE;
+            break;
+    }
+
+    if (copy_to_user(user_stat_out, &kst, sizeof(struct kstat))) return -EFAULT;
+    return 0;
+}
+
+// Writes the read end to fds[0] and the write end to fds[1]
+int sys_pipe(int* user_fds) {
+    if (!current_task->files) return -EBADF;
+    if (!access_ok(user_fds, 2 * sizeof(int))) return -EFAULT;
+
+    file_t* ends[2];
+    int ret = pipe_create(&ends[0], &ends[1]);
+    if (ret < 0) return ret;
+
+    int fds[2];
+    fds[0] = fd_install(current_task->files, ends[0]);
+    fds[1] = fds[0] < 0 ? -EMFILE : fd_install(current_task->files, ends[1]);
+
+    if (fds[1] < 0) {
+        if (fds[0] >= 0) fd_close(current_task->files, fds[0]);
+        else file_put(ends[0]);
+        file_put(ends[1]);
+        return -EMFILE;
+    }
+
+    if (copy_to_user(user_fds, fds, sizeof(fds))) {
+        fd_close(current_task->files, fds[0]);
+        fd_close(current_task->files, fds[1]);
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// Reads at offset without moving the file position
+int64_t sys_pread(int fd, void* user_buf, uint64_t len, uint64_t offset) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file || file->type != FILE_TYPE_FILE) return -EBADF;
+    if ((file->flags & O_ACCMODE) == O_WRONLY) return -EBADF;
+
+    if (offset > f_size(&file->fil)) return 0;
+
+    file->refs++;
+    mutex_lock(&file->lock);
+
+    FSIZE_t saved = f_tell(&file->fil);
+    int64_t ret = -1;
+    if (f_lseek(&file->fil, offset) == FR_OK) {
+        ret = read_to_user(&file->fil, user_buf, len);
+        f_lseek(&file->fil, saved);
+    }
+
+    mutex_unlock(&file->lock);
+    file_put(file);
+    return ret;
+}
+
+int64_t sys_seek(int fd, int64_t offset, int whence) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file || file->type != FILE_TYPE_FILE) return -EBADF;
+
+    int64_t base;
+    switch (whence) {
+        case SEEK_SET: base = 0; break;
+        case SEEK_CUR: base = f_tell(&file->fil); break;
+        case SEEK_END: base = f_size(&file->fil); break;
+        default: return -EINVAL;
+    }
+
+    int64_t pos = base + offset;
+    if (pos < 0) return -EINVAL;
+
+    // Reading files cannot grow them, clamp instead of extending
+    if ((file->flags & O_ACCMODE) == O_RDONLY && (uint64_t)pos > f_size(&file->fil)) {
+        pos = f_size(&file->fil);
+    }
+
+    // Following the cluster chain may sleep on the disk
+    file->refs++;
+    mutex_lock(&file->lock);
+    int64_t ret = f_lseek(&file->fil, pos) == FR_OK ? (int64_t)f_tell(&file->fil) : -1;
+    mutex_unlock(&file->lock);
+    file_put(file);
+    return ret;
+}
+
+static int64_t fill_dents(file_t* file, struct kdirent* user_buf, uint64_t max) {
+    struct kdirent k_ent;
+    uint64_t count = 0;
+
+    while (count < max) {
+        FILINFO* fno = &file->pending;
+
+        if (!file->has_pending) {
+            if (f_readdir(&file->dir, fno) != FR_OK) {
+                if (count == 0) return -1;
+                break;
+            }
+            if (fno->fname[0] == 0) break; // End of directory
+            file->has_pending = 1;
+        }
+
+        memset(&k_ent, 0, sizeof(struct kdirent));
+        strncpy(k_ent.name, fno->fname, sizeof(k_ent.name) - 1);
+        k_ent.size = fno->fsize;
+        k_ent.is_dir = (fno->fattrib & AM_DIR) ? 1 : 0;
+
+        // Entry stays pending if it cannot be delivered, the ones before
+        // it are already consumed and must be reported
+        if (copy_to_user(&user_buf[count], &k_ent, sizeof(struct kdirent))) {
+            if (count == 0) return -EFAULT;
+            break;
+        }
+
+        file->has_pending = 0;
+        count++;
+    }
+
+    return (int64_t)(count * sizeof(struct kdirent));
+}
+
+// Fills user_buf with as many kdirent records as fit, continuing where the
+// last call stopped. Returns the number of bytes written, 0 at the end.
+int64_t sys_getdents(int fd, struct kdirent* user_buf, uint64_t size) {
+    file_t* file = fd_get(current_task->files, fd);
+    if (!file || file->type != FILE_TYPE_DIR) return -EBADF;
+
+    uint64_t max = size / sizeof(struct kdirent);
+    if (max == 0) return -EINVAL;
+    if (!access_ok(user_buf, max * sizeof(struct kdirent))) return -EFAULT;
+
+    file->refs++;
+    mutex_lock(&file->lock);
+    int64_t ret = fill_dents(file, user_buf, max);
+    mutex_unlock(&file->lock);
+    file_put(file);
+    return ret;
+}
+
+int sys_close(int fd) {
+    return fd_close(current_task->files, fd);
+}
@@ -16,6 +16,6 @@ int sys_get_fb_info(struct fb_info* user_out) {
     info.fb_pitch = fb_pitch();
     info.fb_bpp = fb_bpp();
 
-    memcpy(user_out, &info, sizeof(info));
+    if (copy_to_user(user_out, &info, sizeof(info))) return -EFAULT;
     return 0;
 }
\ No newline at end of file
@@ -1,14 +1,49 @@
 #include <ksyscall.h>
+#include <timer.h>
 
 extern task_t* current_task;
 
 void sys_write(int fd, const char* buf) {
     (void)fd; // Unused for now, always write to COM1
-    serial_printf(buf);
+
+    // Copy the string in pieces; never use it as a format string
+    char chunk[256];
+    while (1) {
+        int64_t len = strncpy_from_user(chunk, buf, sizeof(chunk));
+        if (len == -EFAULT) return;
+
+        serial_printf("%s", chunk);
+        if (len >= 0) return;
+
+        buf += sizeof(chunk) - 1;
+    }
+}
+
+// Copy the tail of the kernel log out through a bounce buffer, the log ring
+// is only stable with interrupts disabled.
+int64_t sys_log_read(char* user_buf, uint64_t len) {
+    if (len > SERIAL_LOG_SIZE) len = SERIAL_LOG_SIZE;
+    if (len == 0) return 0;
+    if (!access_ok(user_buf, len)) return -EFAULT;
+
+    char* tmp = kmalloc(len);
+    if (!tmp) return -ENOMEM;
+
+    uint64_t n = serial_log_read(tmp, len);
+    int64_t ret = copy_to_user(user_buf, tmp, n) ? -EFAULT : (int64_t)n;
+
+    kfree(tmp);
+    return ret;
+}
+
+int sys_block_stats(bcache_stats_t* user_out) {
+    bcache_stats_t stats;
+    bcache_get_stats(&stats);
+    return copy_to_user(user_out, &stats, sizeof(stats)) ? -EFAULT : 0;
 }
 
 uint64_t sys_read_key() {
-    if (current_task->msg_count > 0) {
+    if (current_task->msg_count > 0 || current_task->doorbells) {
         return 0;
     }
 
@@ -17,4 +52,39 @@ uint64_t sys_read_key() {
     asm volatile("sti");
 
     return val;
-}
\ No newline at end of file
+}
+
+static uint32_t ready_events(task_t* task, uint32_t mask, uint64_t wake_tick) {
+    uint32_t ready = 0;
+    if ((mask & EVENT_IPC) && (task->msg_count > 0 || task->doorbells)) ready |= EVENT_IPC;
+    if ((mask & EVENT_KEY) && keyboard_has_key()) ready |= EVENT_KEY;
+    if ((mask & EVENT_TIMER) && kdata_ticks() >= wake_tick) ready |= EVENT_TIMER;
+    return ready;
+}
+
+// Blocks until one of the events in mask is pending and returns all the
+// pending ones. Messages wake the task through ipc_notify(), keys through
+// the keyboard IRQ and the timeout through the PIT.
+int64_t sys_wait_events(uint32_t mask, uint64_t timeout_ns) {
+    if (mask == 0 || (mask & ~EVENT_ALL)) return -EINVAL;
+
+    task_t* self = current_task;
+    uint64_t wake_tick = 0;
+    if (mask & EVENT_TIMER) wake_tick = kdata_ticks() + timer_ns_to_ticks(timeout_ns);
+
+    // A task sits on one queue at a time. Key waiters share the keyboard's
+    // queue, and ipc_notify() pulls them off it for messages.
+    wait_queue_t* wq = (mask & EVENT_KEY) ? keyboard_wait_queue() : &self->event_wq;
+
+    uint32_t ready;
+    while (!(ready = ready_events(self, mask, wake_tick))) {
+        self->key_waiting = (mask & EVENT_KEY) != 0;
+
+        if (mask & EVENT_TIMER) wait_queue_sleep_until(wq, wake_tick);
+        else wait_queue_sleep(wq);
+
+        self->key_waiting = 0;
+    }
+
+    return ready;
+}
@@ -21,7 +21,7 @@ static inline void invlpg(void* m) {
 
 void* sys_sbrk(intptr_t inc) {
     task_t* task = current_task;
-    uint64_t old_break = task->program_break;
+    uint64_t old_break = task->mm->program_break;
 
     if (inc == 0) {
         return (void*)old_break;
@@ -66,31 +66,27 @@ void* sys_sbrk(intptr_t inc) {
         }
     }
 
-    task->program_break = new_break;
+    task->mm->program_break = new_break;
     return (void*)old_break;
 }
 
 uint64_t sys_share_mem(int target_pid, size_t size, uint64_t* target_vaddr_out) {
     size = ALIGN_UP(size, PAGE_SIZE);
+    if (size == 0) return 0;
 
     task_t* target = get_task_by_pid(target_pid);
-    if (!target) return 0;
+    if (!target || !target->mm) return 0;
+    if (!access_ok(target_vaddr_out, sizeof(uint64_t))) return 0;
 
-    // --- FIX START ---
-    // Align Current Task's Break to Page Boundary
-    if (current_task->program_break & (PAGE_SIZE - 1)) {
-        current_task->program_break = (current_task->program_break + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
-    }
-    uint64_t my_vaddr = current_task->program_break; 
-    current_task->program_break += size;
+    // Both sides map it in their share window, away from the heap
+    uint64_t my_vaddr = share_va_alloc(current_task->mm, size);
+    if (!my_vaddr) return 0;
 
-    // Align Target Task's Break to Page Boundary
-    if (target->program_break & (PAGE_SIZE - 1)) {
-        target->program_break = (target->program_break + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    uint64_t their_vaddr = share_va_alloc(target->mm, size);
+    if (!their_vaddr) {
+        share_va_free(current_task->mm, my_vaddr, size);
+        return 0;
     }
-    uint64_t their_vaddr = target->program_break;
-    target->program_break += size;
-    // --- FIX END ---
 
     uint64_t* my_pml4 = (uint64_t*)phys_to_virt(current_task->cr3);
     uint64_t* their_pml4 = (uint64_t*)phys_to_virt(target->cr3);
@@ -113,7 +109,7 @@ uint64_t sys_share_mem(int target_pid, size_t size, uint64_t* target_vaddr_out)
     }
     
     // Return 'their_vaddr' to the caller so they can send it to the WM
-    *target_vaddr_out = their_vaddr;
+    if (copy_to_user(target_vaddr_out, &their_vaddr, sizeof(uint64_t))) return 0;
     return my_vaddr;
 }
 
@@ -126,6 +122,7 @@ int sys_unmap(void* vaddr_ptr, size_t size) {
     // 2. Get the Virtual Address of the current PML4
     // (cr3 is physical, we need HHDM virtual to read/write it)
     uint64_t* pml4 = (uint64_t*)phys_to_virt(current_task->cr3);
+    uint64_t unmapped = 0;
 
     for (uint64_t i = 0; i < size; i += PAGE_SIZE) {
         uint64_t curr_vaddr = vaddr + i;
@@ -156,6 +153,7 @@ int sys_unmap(void* vaddr_ptr, size_t size) {
             
             // B. Invalidate TLB for this address
             invlpg((void*)curr_vaddr);
+            unmapped += PAGE_SIZE;
             
             // C. Free the Physical Memory
             // NOTE: This assumes the other process (the client) is dead or 
@@ -164,5 +162,11 @@ int sys_unmap(void* vaddr_ptr, size_t size) {
             //pmm_free_page((void*)phys_to_virt(phys_addr));
         }
     }
+
+    // A share window range that was mapped whole can be handed out again
+    if (size && unmapped == size && !(vaddr & (PAGE_SIZE - 1)) &&
+        vaddr >= USER_SHARE_BASE && vaddr + size <= USER_SHARE_BASE + USER_SHARE_SIZE) {
+        share_va_free(current_task->mm, vaddr, size);
+    }
     return 0;
 }
\ No newline at end of file
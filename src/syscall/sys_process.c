@@ -1,17 +1,76 @@
 #include <ksyscall.h>
+#include <ring.h>
+#include <channel.h>
 
 extern task_t* current_task;
 
 /* Process creation/exit */
 
-int sys_exec(const char* path, int argc, char** argv) {
-    return create_user_process_from_file(path, argc, argv, 0);
+int sys_exec(const char* user_path, int argc, char** user_argv) {
+    return sys_exec_fds(user_path, argc, user_argv, NULL);
+}
+
+// Like sys_exec, and the child's descriptors 0-2 start as the caller's
+// descriptors user_fd_map[0..2] (-1 leaves one closed)
+int sys_exec_fds(const char* user_path, int argc, char** user_argv, const int* user_fd_map) {
+    char path[SYSCALL_PATH_MAX];
+    if (strncpy_from_user(path, user_path, sizeof(path)) < 0) return -EFAULT;
+    if (argc < 0 || argc > EXEC_MAX_ARGS) return -EINVAL;
+
+    file_t* inherit[FD_FIRST_FREE] = { NULL, NULL, NULL };
+    if (user_fd_map) {
+        int fd_map[FD_FIRST_FREE];
+        if (copy_from_user(fd_map, user_fd_map, sizeof(fd_map))) return -EFAULT;
+
+        for (int i = 0; i < FD_FIRST_FREE; i++) {
+            if (fd_map[i] < 0) continue;
+
+            inherit[i] = fd_get(current_task->files, fd_map[i]);
+            if (!inherit[i]) return -EBADF;
+        }
+    }
+
+    // Pull the argument strings in before the new address space is built
+    char* argv[EXEC_MAX_ARGS];
+    char* strings = (char*)kmalloc(EXEC_MAX_ARGS_SIZE);
+    if (!strings) return -ENOMEM;
+
+    size_t used = 0;
+    for (int i = 0; i < argc; i++) {
+        char* user_arg;
+        int64_t len;
+
+        if (copy_from_user(&user_arg, &user_argv[i], sizeof(user_arg)) ||
+            (len = strncpy_from_user(strings + used, user_arg, EXEC_MAX_ARGS_SIZE - used)) < 0) {
+            kfree(strings);
+            return -EFAULT;
+        }
+
+        argv[i] = strings + used;
+        used += len + 1;
+    }
+
+    int pid = create_user_process_from_file(path, argc, argv, 0);
+    kfree(strings);
+
+    // The child cannot run before this syscall returns
+    task_t* child = pid >= 0 ? get_task_by_pid(pid) : NULL;
+    if (child) trace_exec(current_task, (uint64_t)pid);
+    if (child && child->files) {
+        for (int i = 0; i < FD_FIRST_FREE; i++) {
+            if (!inherit[i]) continue;
+
+            inherit[i]->refs++;
+            child->files->fds[i] = inherit[i];
+        }
+    }
+    return pid;
 }
 
 void sys_exit(int code) {
     serial_printf("[KERNEL] Process exited with code %d\n", code);
     
-    task_exit();
+    task_exit(code);
 
     while(1) {
         serial_printf("Syscall exit error, should not reach here! HANGING\n");
@@ -19,6 +78,35 @@ void sys_exit(int code) {
     }
 }
 
+int sys_waitpid(int pid, int* status_out) {
+    int status;
+    int ret = task_waitpid(pid, &status);
+
+    if (ret >= 0 && status_out && copy_to_user(status_out, &status, sizeof(int))) {
+        return -EFAULT;
+    }
+    return ret;
+}
+
+int sys_task_stats(task_stats_t* user_out, uint64_t max) {
+    if (!user_out) max = 0;
+    if (max > MAX_TASKS) max = MAX_TASKS;
+    if (max == 0) return task_collect_stats(NULL, 0);
+
+    if (!access_ok(user_out, max * sizeof(task_stats_t))) return -EFAULT;
+
+    task_stats_t* stats = (task_stats_t*)kmalloc(max * sizeof(task_stats_t));
+    if (!stats) return -ENOMEM;
+
+    int total = task_collect_stats(stats, max);
+    uint64_t filled = (uint64_t)total < max ? (uint64_t)total : max;
+
+    if (copy_to_user(user_out, stats, filled * sizeof(task_stats_t))) total = -EFAULT;
+
+    kfree(stats);
+    return total;
+}
+
 /* Inter-process communication */
 
 int sys_ipc_send(int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3) {
@@ -36,16 +124,123 @@ int sys_ipc_send(int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3)
 
     target->msg_tail = (target->msg_tail + 1) % MSG_QUEUE_SIZE;
     target->msg_count++;
+
+    ipc_notify(target);
     
     return 0;
 }
 
+// Wakes whatever the task waits for new messages in
+void ipc_notify(task_t* task) {
+    ring_notify(task);
+    wait_queue_wake_all(&task->event_wq);
+    if (task->key_waiting) wait_queue_wake_task(keyboard_wait_queue(), task);
+}
+
+// Channel doorbells are delivered ahead of queued messages, so a full
+// queue can never swallow them. Returns 0 if nothing is pending.
+int ipc_peek_message(task_t* task, message_t* out) {
+    if (task->doorbells) {
+        uint64_t id = __builtin_ctzll(task->doorbells);
+
+        out->sender_pid = (int)chan_peer_pid(id, task->tgid);
+        out->type = MSG_CHAN_DOORBELL;
+        out->data1 = id;
+        out->data2 = 0;
+        out->data3 = 0;
+        return 1;
+    }
+
+    if (task->msg_count == 0) return 0;
+
+    *out = task->msgs[task->msg_head];
+    return 1;
+}
+
+// Removes what ipc_peek_message() returned
+void ipc_pop_message(task_t* task) {
+    if (task->doorbells) {
+        task->doorbells &= task->doorbells - 1;
+        return;
+    }
+
+    if (task->msg_count == 0) return;
+
+    task->msg_head = (task->msg_head + 1) % MSG_QUEUE_SIZE;
+    task->msg_count--;
+}
+
 int sys_ipc_recv(message_t* out_msg) {
-    if (current_task->msg_count == 0) return -1;
+    message_t msg;
+    if (!ipc_peek_message(current_task, &msg)) return -1;
 
-    *out_msg = current_task->msgs[current_task->msg_head];
-    current_task->msg_head = (current_task->msg_head + 1) % MSG_QUEUE_SIZE;
-    current_task->msg_count--;
+    // Leave the message queued if it cannot be delivered
+    if (copy_to_user(out_msg, &msg, sizeof(message_t))) {
+        return -EFAULT;
+    }
+    ipc_pop_message(current_task);
 
     return 0;
-}
\ No newline at end of file
+}
+
+// Sends *user_msg and blocks until dest_pid answers through
+// sys_ipc_reply_wait(). The reply overwrites *user_msg. If the receiver is
+// waiting it runs next, on what is left of the caller's timeslice.
+int sys_ipc_call(int dest_pid, message_t* user_msg) {
+    message_t msg;
+    if (copy_from_user(&msg, user_msg, sizeof(message_t))) return -EFAULT;
+
+    task_t* self = current_task;
+    int ret = sys_ipc_send(dest_pid, msg.type, msg.data1, msg.data2, msg.data3);
+    if (ret < 0) return ret;
+
+    self->ipc_call_to = (uint64_t)dest_pid;
+    self->ipc_replied = 0;
+
+    while (!self->ipc_replied) {
+        task_t* target = get_task_by_pid(dest_pid);
+        if (!target) break;
+
+        scheduler_hand_off(target);
+        wait_queue_sleep(&target->ipc_reply_wq);
+    }
+
+    self->ipc_call_to = 0;
+    if (!self->ipc_replied) return -1; // Receiver exited
+
+    if (copy_to_user(user_msg, &self->ipc_reply, sizeof(message_t))) return -EFAULT;
+    return 0;
+}
+
+// Answers a pending sys_ipc_call() from reply_pid (0 for none) with
+// *user_msg, then waits for the next message and stores it there. The
+// caller gets the CPU straight away if nothing is queued yet.
+int sys_ipc_reply_wait(int reply_pid, message_t* user_msg) {
+    message_t msg;
+    if (copy_from_user(&msg, user_msg, sizeof(message_t))) return -EFAULT;
+
+    task_t* self = current_task;
+    task_t* caller = NULL;
+
+    if (reply_pid) {
+        caller = get_task_by_pid(reply_pid);
+        if (!caller || caller->ipc_call_to != self->pid || caller->ipc_replied) return -1;
+
+        msg.sender_pid = self->pid;
+        caller->ipc_reply = msg;
+        caller->ipc_replied = 1;
+        wait_queue_wake_task(&self->ipc_reply_wq, caller);
+    }
+
+    while (!ipc_peek_message(self, &msg)) {
+        if (caller) scheduler_hand_off(caller);
+        caller = NULL;
+        wait_queue_sleep(&self->event_wq);
+    }
+
+    // Leave the message queued if it cannot be delivered
+    if (copy_to_user(user_msg, &msg, sizeof(message_t))) return -EFAULT;
+    ipc_pop_message(self);
+
+    return 0;
+}
@@ -0,0 +1,235 @@
+#include <ksyscall.h>
+#include <ring.h>
+#include <timer.h>
+
+extern task_t* current_task;
+extern uint64_t limine_hhdm;
+
+/* Helper functions */
+
+static inline uint64_t virt_to_phys(void* virt) {
+    return (uint64_t)virt - limine_hhdm;
+}
+
+static int cq_full(io_ring_t* ring) {
+    return ring->hdr->cq_tail - ring->hdr->cq_head >= RING_CQ_ENTRIES;
+}
+
+// Callers check cq_full() first
+static void post_cqe(io_ring_t* ring, uint64_t user_data, int64_t res, message_t* msg) {
+    ring_hdr_t* hdr = ring->hdr;
+    ring_cqe_t* cqe = &ring->cq[hdr->cq_tail & (RING_CQ_ENTRIES - 1)];
+
+    cqe->user_data = user_data;
+    cqe->res = res;
+    cqe->flags = 0;
+    if (msg) {
+        cqe->msg = *msg;
+        cqe->flags |= RING_CQE_MSG;
+    }
+
+    // Entry must be visible before the tail moves
+    asm volatile("" ::: "memory");
+    hdr->cq_tail = hdr->cq_tail + 1;
+}
+
+static int pop_message(message_t* out) {
+    if (!ipc_peek_message(current_task, out)) return 0;
+
+    ipc_pop_message(current_task);
+    return 1;
+}
+
+// Runs one request. Returns 1 if it completed, 0 if it has to wait.
+static int ring_execute(io_ring_t* ring, ring_sqe_t* sqe, uint64_t* wake_tick) {
+    int64_t res;
+    message_t msg;
+
+    switch (sqe->opcode) {
+        case RING_OP_NOP:
+            res = 0;
+            break;
+
+        case RING_OP_IPC_SEND:
+            res = sys_ipc_send((int)sqe->arg[0], (int)sqe->arg[1], sqe->arg[2], sqe->arg[3], sqe->arg[4]);
+            break;
+
+        case RING_OP_IPC_RECV:
+            if (!pop_message(&msg)) return 0;
+            post_cqe(ring, sqe->user_data, 0, &msg);
+            return 1;
+
+        case RING_OP_FILE_READ:
+            res = sys_file_read((const char*)sqe->arg[0], (void*)sqe->arg[1], sqe->arg[2]);
+            break;
+
+        case RING_OP_STAT:
+            res = sys_stat((const char*)sqe->arg[0], (struct kstat*)sqe->arg[1]);
+            break;
+
+        case RING_OP_DIR_READ:
+            res = sys_read_dir_entry((const char*)sqe->arg[0], sqe->arg[1], (struct kdirent*)sqe->arg[2]);
+            break;
+
+        case RING_OP_SLEEP:
+            if (*wake_tick == 0) {
+                *wake_tick = kdata_ticks() + timer_ns_to_ticks(sqe->arg[0]);
+            }
+            if (kdata_ticks() < *wake_tick) return 0;
+            res = 0;
+            break;
+
+        default:
+            res = -1;
+            break;
+    }
+
+    post_cqe(ring, sqe->user_data, res, NULL);
+    return 1;
+}
+
+// Retries waiting requests in submission order. Returns how many completed.
+static uint32_t ring_run_pending(io_ring_t* ring) {
+    uint32_t completed = 0;
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < ring->nr_pending; i++) {
+        ring_pending_t* p = &ring->pending[i];
+
+        if (!cq_full(ring) && ring_execute(ring, &p->sqe, &p->wake_tick)) {
+            completed++;
+        } else {
+            ring->pending[kept++] = *p;
+        }
+    }
+
+    ring->nr_pending = kept;
+    ring->hdr->nr_pending = kept;
+    return completed;
+}
+
+// Earliest RING_OP_SLEEP deadline, 0 if none
+static uint64_t ring_next_deadline(io_ring_t* ring) {
+    uint64_t deadline = 0;
+    for (uint32_t i = 0; i < ring->nr_pending; i++) {
+        uint64_t t = ring->pending[i].wake_tick;
+        if (t && (deadline == 0 || t < deadline)) deadline = t;
+    }
+    return deadline;
+}
+
+/* Ring functions */
+
+// Wakes the owner if it is waiting in ring_enter (e.g. a message arrived)
+void ring_notify(task_t* task) {
+    if (task->ring) wait_queue_wake_all(&task->ring->wq);
+}
+
+// Unmaps and frees the ring while the owner's address space still exists
+void ring_destroy(task_t* task) {
+    io_ring_t* ring = task->ring;
+    if (!ring) return;
+
+    if (task->mm) {
+        uint64_t* pml4_virt = (uint64_t*)(task->mm->cr3 + limine_hhdm);
+        for (uint64_t i = 0; i < RING_PAGES; i++) {
+            vmm_unmap_page(pml4_virt, ring->user_base + i * PAGE_SIZE);
+        }
+        share_va_free(task->mm, ring->user_base, RING_PAGES * PAGE_SIZE);
+    }
+
+    pmm_free_pages(ring->pages, RING_PAGES);
+    kfree(ring);
+    task->ring = NULL;
+}
+
+/* Syscall functions */
+
+// Maps a ring for the calling task and returns its user address
+uint64_t sys_ring_setup(void) {
+    task_t* task = current_task;
+    if (!task->mm) return 0;
+    if (task->ring) return task->ring->user_base;
+
+    void* pages = pmm_alloc_pages(RING_PAGES);
+    if (!pages) return 0;
+    memset(pages, 0, RING_PAGES * PAGE_SIZE);
+
+    io_ring_t* ring = (io_ring_t*)kmalloc(sizeof(io_ring_t));
+    if (!ring) {
+        pmm_free_pages(pages, RING_PAGES);
+        return 0;
+    }
+    memset(ring, 0, sizeof(io_ring_t));
+
+    address_space_t* mm = task->mm;
+    ring->user_base = share_va_alloc(mm, RING_PAGES * PAGE_SIZE);
+    if (!ring->user_base) {
+        kfree(ring);
+        pmm_free_pages(pages, RING_PAGES);
+        return 0;
+    }
+
+    uint64_t* pml4_virt = (uint64_t*)(mm->cr3 + limine_hhdm);
+    for (uint64_t i = 0; i < RING_PAGES; i++) {
+        vmm_map_page(pml4_virt, ring->user_base + i * PAGE_SIZE,
+                     virt_to_phys((uint8_t*)pages + i * PAGE_SIZE), 0x7);
+    }
+
+    ring->pages = pages;
+    ring->hdr = (ring_hdr_t*)pages;
+    ring->sq = (ring_sqe_t*)((uint8_t*)pages + sizeof(ring_hdr_t));
+    ring->cq = (ring_cqe_t*)((uint8_t*)pages + PAGE_SIZE);
+
+    ring->hdr->sq_entries = RING_SQ_ENTRIES;
+    ring->hdr->sq_off = sizeof(ring_hdr_t);
+    ring->hdr->cq_entries = RING_CQ_ENTRIES;
+    ring->hdr->cq_off = PAGE_SIZE;
+
+    task->ring = ring;
+    return ring->user_base;
+}
+
+// Consumes up to to_submit SQEs, then with RING_ENTER_WAIT blocks until at
+// least min_complete completions were posted during this call.
+// Returns the number of SQEs consumed, or -1 without a ring.
+int sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    io_ring_t* ring = current_task->ring;
+    if (!ring) return -1;
+
+    ring_hdr_t* hdr = ring->hdr;
+    uint32_t completed = ring_run_pending(ring);
+    uint32_t submitted = 0;
+
+    while (submitted < to_submit && hdr->sq_head != hdr->sq_tail) {
+        if (cq_full(ring) || ring->nr_pending >= RING_MAX_PENDING) break;
+
+        // Copy first, userspace may rewrite the slot once sq_head moves
+        ring_sqe_t sqe = ring->sq[hdr->sq_head & (RING_SQ_ENTRIES - 1)];
+        hdr->sq_head = hdr->sq_head + 1;
+        submitted++;
+
+        uint64_t wake_tick = 0;
+        if (ring_execute(ring, &sqe, &wake_tick)) {
+            completed++;
+        } else {
+            ring_pending_t* p = &ring->pending[ring->nr_pending++];
+            p->sqe = sqe;
+            p->wake_tick = wake_tick;
+        }
+    }
+    hdr->nr_pending = ring->nr_pending;
+
+    if (!(flags & RING_ENTER_WAIT)) return submitted;
+
+    // A full CQ can only drain from userspace, so never sleep on one
+    while (completed < min_complete && ring->nr_pending > 0 && !cq_full(ring)) {
+        uint64_t deadline = ring_next_deadline(ring);
+        if (deadline) wait_queue_sleep_until(&ring->wq, deadline);
+        else wait_queue_sleep(&ring->wq);
+
+        completed += ring_run_pending(ring);
+    }
+
+    return submitted;
+}
@@ -0,0 +1,19 @@
+#include <ksyscall.h>
+#include <futex.h>
+
+extern task_t* current_task;
+
+/* Thread syscalls */
+
+int sys_thread_create(uint64_t entry, uint64_t arg, uint64_t tls) {
+    if (!entry) return -1;
+    return create_user_thread(entry, arg, tls);
+}
+
+int sys_futex_wait(uint32_t* uaddr, uint32_t expected) {
+    return futex_wait((uint64_t)uaddr, expected);
+}
+
+int sys_futex_wake(uint32_t* uaddr, uint32_t count) {
+    return futex_wake((uint64_t)uaddr, count);
+}
@@ -0,0 +1,180 @@
+#include <ksyscall.h>
+#include <trace.h>
+#include <timer.h>
+
+extern task_t* current_task;
+
+uint32_t trace_flags = 0;
+static uint64_t trace_pid = 0;
+
+// Armed by TRACE_CTL_ON_EXEC, applied by trace_exec()
+static uint64_t trace_exec_parent = 0;
+static uint32_t trace_exec_flags = 0;
+
+static trace_stats_t trace_global;
+
+static trace_record_t trace_ring[TRACE_RING_SIZE];
+static uint32_t trace_head = 0;   // Next record to read
+static uint32_t trace_tail = 0;   // Next record to write
+static uint64_t trace_dropped = 0;
+static wait_queue_t trace_readers = {0};
+
+/* Helper functions */
+
+static inline uint32_t log2_bucket(uint64_t ns) {
+    if (ns == 0) return 0;
+    uint32_t bucket = 63 - __builtin_clzll(ns);
+    return bucket < TRACE_HIST_BUCKETS ? bucket : TRACE_HIST_BUCKETS - 1;
+}
+
+static void stats_add(trace_stats_t* stats, uint64_t nr, uint64_t ns) {
+    stats->count[nr]++;
+    stats->total_ns[nr] += ns;
+    if (ns > stats->max_ns[nr]) stats->max_ns[nr] = ns;
+    stats->hist[nr][log2_bucket(ns)]++;
+}
+
+static void log_record(registers_t* regs, uint64_t nr, uint64_t ret, uint64_t start_ns, uint64_t ns) {
+    if (trace_pid && current_task->pid != trace_pid) return;
+
+    // Keep the oldest records, a reader that falls behind sees the gap.
+    // An exit record replaces the newest one instead, strace stops on it.
+    if (trace_tail - trace_head >= TRACE_RING_SIZE) {
+        trace_dropped++;
+        if (nr != SYS_EXIT) return;
+        trace_tail--;
+    }
+
+    trace_record_t* rec = &trace_ring[trace_tail % TRACE_RING_SIZE];
+    rec->timestamp_ns = start_ns;
+    rec->duration_ns = ns;
+    rec->pid = (uint32_t)current_task->pid;
+    rec->nr = (uint32_t)nr;
+    rec->args[0] = regs->rdi;
+    rec->args[1] = regs->rsi;
+    rec->args[2] = regs->rdx;
+    rec->ret = (int64_t)ret;
+    rec->reserved = 0;
+    trace_tail++;
+
+    if (trace_readers.head) wait_queue_wake_all(&trace_readers);
+}
+
+/* Trace functions */
+
+// Called by syscall_dispatcher when trace_flags is set
+void trace_syscall(registers_t* regs, uint64_t nr, uint64_t ret, uint64_t tsc_start, uint64_t tsc_end) {
+    if (nr >= TRACE_MAX_SYSCALLS) return;
+
+    // Some syscalls return with interrupts enabled (sys_read_key)
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags));
+
+    uint64_t ns = kdata_tsc_to_ns(tsc_end - tsc_start);
+
+    if (trace_flags & TRACE_STATS) {
+        task_t* task = current_task;
+        if (!task->trace) {
+            task->trace = (trace_stats_t*)kmalloc(sizeof(trace_stats_t));
+            if (task->trace) memset(task->trace, 0, sizeof(trace_stats_t));
+        }
+        if (task->trace) stats_add(task->trace, nr, ns);
+        stats_add(&trace_global, nr, ns);
+    }
+
+    if (trace_flags & TRACE_LOG) {
+        log_record(regs, nr, ret, kdata_tsc_to_ns(tsc_start), ns);
+    }
+
+    if (flags & 0x200) asm volatile("sti");
+}
+
+// Called by sys_exec_fds before the child can run. If the parent armed
+// TRACE_CTL_ON_EXEC, the child becomes the only traced pid from its first
+// syscall on, and the log starts out empty.
+void trace_exec(task_t* parent, uint64_t child_pid) {
+    if (!trace_exec_parent || parent->pid != trace_exec_parent) return;
+
+    trace_pid = child_pid;
+    trace_head = trace_tail = 0;
+    trace_dropped = 0;
+    trace_flags |= trace_exec_flags;
+    trace_exec_parent = 0;
+}
+
+void trace_task_free(task_t* task) {
+    if (task->trace) {
+        kfree(task->trace);
+        task->trace = NULL;
+    }
+}
+
+/* Syscall functions */
+
+int sys_trace_ctl(uint64_t cmd, uint64_t arg0, uint64_t arg1) {
+    switch (cmd) {
+        case TRACE_CTL_SET_FLAGS: {
+            uint32_t old = trace_flags;
+            trace_flags = (uint32_t)arg0 & (TRACE_STATS | TRACE_LOG);
+            return (int)old;
+        }
+
+        case TRACE_CTL_SET_PID:
+            trace_pid = arg0;
+            return 0;
+
+        case TRACE_CTL_GET_STATS: {
+            trace_stats_t* stats = &trace_global;
+            if (arg0) {
+                task_t* task = get_task_by_pid(arg0);
+                if (!task) return -1;
+                if (!task->trace) return -2; // Nothing recorded yet
+                stats = task->trace;
+            }
+            if (copy_to_user((void*)arg1, stats, sizeof(trace_stats_t))) return -EFAULT;
+            return 0;
+        }
+
+        case TRACE_CTL_RESET:
+            memset(&trace_global, 0, sizeof(trace_stats_t));
+            trace_head = trace_tail = 0;
+            trace_dropped = 0;
+            return 0;
+
+        case TRACE_CTL_DROPPED:
+            return (int)trace_dropped;
+
+        case TRACE_CTL_ON_EXEC:
+            trace_exec_flags = (uint32_t)arg0 & (TRACE_STATS | TRACE_LOG);
+            trace_exec_parent = trace_exec_flags ? current_task->pid : 0;
+            return 0;
+
+        default:
+            return -EINVAL;
+    }
+}
+
+// Copies up to max records. If the log is empty, waits up to timeout_ms for
+// one to arrive. Returns the number of records copied.
+int sys_trace_read(trace_record_t* user_out, uint64_t max, uint64_t timeout_ms) {
+    if (trace_head == trace_tail && timeout_ms) {
+        uint64_t wake_tick = kdata_ticks() + timer_ns_to_ticks(timeout_ms * 1000000ULL);
+        while (trace_head == trace_tail) {
+            if (wait_queue_sleep_until(&trace_readers, wake_tick)) break;
+        }
+    }
+
+    uint64_t copied = 0;
+    while (copied < max && trace_head != trace_tail) {
+        trace_record_t* rec = &trace_ring[trace_head % TRACE_RING_SIZE];
+        if (copy_to_user(&user_out[copied], rec, sizeof(trace_record_t))) {
+            // Records already copied are consumed, report them
+            return copied ? (int)copied : -EFAULT;
+        }
+
+        trace_head++;
+        copied++;
+    }
+
+    return (int)copied;
+}
@@ -18,4 +18,23 @@ uint16_t inw(uint16_t port) {
     uint16_t ret;
     asm volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
     return ret;
-}
\ No newline at end of file
+}
+
+void outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    asm volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+// Moves count words between the port and memory in one string instruction
+void insw(uint16_t port, void* buf, uint64_t count) {
+    asm volatile ("rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+void outsw(uint16_t port, const void* buf, uint64_t count) {
+    asm volatile ("rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
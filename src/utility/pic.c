@@ -38,6 +38,9 @@ void pic_enable_irq(uint8_t irq) {
     } else {
         port = PIC2_DATA;
         irq -= 8;
+
+        // Slave lines only get through when the cascade line is open
+        outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << 2));
     }
     
     value = inb(port) & ~(1 << irq);
@@ -0,0 +1,19 @@
+#ifndef IDP_BENCH_H
+#define IDP_BENCH_H
+
+// Protocol between ipcbench (driver) and ipcecho (peer)
+#define MSG_BENCH_PING 900   // Peer answers with MSG_BENCH_PONG, d1 echoed
+#define MSG_BENCH_PONG 901
+#define MSG_BENCH_CALL 902   // Through sys_ipc_call, answered with the same message
+#define MSG_BENCH_DATA 903   // One-way payload, counted by the peer
+#define MSG_BENCH_SYNC 904   // Through sys_ipc_call. The peer drains its channel and
+                             // replies d1 = DATA messages, d2 = channel bytes since the last sync
+#define MSG_BENCH_QUIT 905
+
+#define BENCH_ECHO_PATH "/bin/ipcecho.elf"
+
+// Largest channel record the peer accepts
+#define BENCH_CHAN_MAX   4096
+#define BENCH_CHAN_RING  16384
+
+#endif
@@ -0,0 +1,271 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+#include "../libc/time.h"
+#include "../libc/chan.h"
+#include "bench.h"
+
+// IPC micro-benchmarks against the ipcecho peer, timed with the TSC.
+// Every result is one serial line (and the same on stdout):
+//
+//   BENCH v1 name=<test> size=<bytes> n=<samples> min=<ns> p50=<ns> p90=<ns> p99=<ns> max=<ns> [mbps=<MB/s>]
+//
+// Fields only ever get appended, so scripts can diff two builds by name+size.
+
+#define MAX_SAMPLES     1000
+#define DEFAULT_SAMPLES 500
+#define WARMUP          16
+
+#define BATCH_SIZE      24   // Payload bytes per message, as in the stdout batch path
+#define BATCH_QUEUE_MAX 15   // Leaves a queue slot for the MSG_BENCH_SYNC call
+#define RECORDS_PER_SAMPLE 16
+
+static uint64_t samples[MAX_SAMPLES];
+static uint64_t samples2[MAX_SAMPLES];
+static char payload[BENCH_CHAN_MAX];
+
+static uint64_t hz;
+static int peer;
+static int nr_samples = DEFAULT_SAMPLES;
+
+/* Helpers */
+
+static int parse_int(const char* s) {
+    int v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    return v;
+}
+
+static uint64_t cycles_to_ns(uint64_t cycles) {
+    return cycles * 1000000ULL / (hz / 1000);
+}
+
+static void sort_samples(uint64_t* s, int n) {
+    for (int i = 1; i < n; i++) {
+        uint64_t v = s[i];
+        int j = i - 1;
+        while (j >= 0 && s[j] > v) {
+            s[j + 1] = s[j];
+            j--;
+        }
+        s[j + 1] = v;
+    }
+}
+
+static uint64_t percentile(const uint64_t* sorted, int n, int pct) {
+    return sorted[(n - 1) * pct / 100];
+}
+
+// Samples are in TSC cycles per operation; size is the payload moved by one
+// operation (0 if none), which adds a throughput figure based on the median
+static void report(const char* name, uint64_t size, uint64_t* s, int n) {
+    sort_samples(s, n);
+
+    uint64_t p50 = cycles_to_ns(percentile(s, n, 50));
+    char line[256];
+    int len = snprintf(line, sizeof(line),
+                       "BENCH v1 name=%s size=%lu n=%d min=%lu p50=%lu p90=%lu p99=%lu max=%lu",
+                       name, size, n,
+                       cycles_to_ns(s[0]), p50,
+                       cycles_to_ns(percentile(s, n, 90)),
+                       cycles_to_ns(percentile(s, n, 99)),
+                       cycles_to_ns(s[n - 1]));
+
+    if (size && p50 && len < (int)sizeof(line)) {
+        len += snprintf(line + len, sizeof(line) - len, " mbps=%lu", size * 1000 / p50);
+    }
+    if (len < (int)sizeof(line) - 1) {
+        line[len++] = '\n';
+        line[len] = 0;
+    }
+
+    sys_write(0, line);
+    printf("%s", line);
+}
+
+// Waits for a message of the given type from the peer, dropping others
+static void wait_for(int type, message_t* msg) {
+    while (1) {
+        if (sys_ipc_recv(msg) == 0) {
+            if (msg->type == type && msg->sender_pid == peer) return;
+            continue;
+        }
+        sys_wait_events(EVENT_IPC, 0);
+    }
+}
+
+// Round trip that returns once the peer consumed everything sent before
+static void sync_peer(uint64_t* msgs, uint64_t* bytes) {
+    message_t msg = { 0 };
+    msg.type = MSG_BENCH_SYNC;
+    sys_ipc_call(peer, &msg);
+
+    if (msgs) *msgs = msg.data1;
+    if (bytes) *bytes = msg.data2;
+}
+
+/* Benchmarks */
+
+// Async send + recv in both directions
+static void bench_ping_pong(void) {
+    message_t msg;
+
+    for (int i = 0; i < WARMUP + nr_samples; i++) {
+        uint64_t start = rdtsc();
+        sys_ipc_send(peer, MSG_BENCH_PING, i, 0, 0);
+        wait_for(MSG_BENCH_PONG, &msg);
+        uint64_t end = rdtsc();
+
+        if (i >= WARMUP) samples[i - WARMUP] = end - start;
+    }
+
+    report("ipc_pingpong", 0, samples, nr_samples);
+}
+
+// sys_ipc_call / sys_ipc_reply_wait with the direct switch
+static void bench_call(void) {
+    for (int i = 0; i < WARMUP + nr_samples; i++) {
+        message_t msg = { 0 };
+        msg.type = MSG_BENCH_CALL;
+        msg.data1 = i;
+
+        uint64_t start = rdtsc();
+        sys_ipc_call(peer, &msg);
+        uint64_t end = rdtsc();
+
+        if (i >= WARMUP) samples[i - WARMUP] = end - start;
+    }
+
+    report("ipc_call", 0, samples, nr_samples);
+}
+
+// One-way messages carrying 24 bytes each, like the stdout batch fallback.
+// The queue only holds 16 messages, so the peer is synced whenever it fills.
+static void bench_batch(uint64_t size) {
+    int queued = 0;
+
+    for (int i = 0; i < WARMUP + nr_samples; i++) {
+        uint64_t start = rdtsc();
+
+        for (int r = 0; r < RECORDS_PER_SAMPLE; r++) {
+            for (uint64_t off = 0; off < size; off += BATCH_SIZE) {
+                uint64_t packs[3] = { 0, 0, 0 };
+                uint64_t n = size - off < BATCH_SIZE ? size - off : BATCH_SIZE;
+                memcpy(packs, payload + off, n);
+
+                if (queued == BATCH_QUEUE_MAX) {
+                    sync_peer(NULL, NULL);
+                    queued = 0;
+                }
+                while (sys_ipc_send(peer, MSG_BENCH_DATA, packs[0], packs[1], packs[2]) != 0) {
+                    sync_peer(NULL, NULL);
+                    queued = 0;
+                }
+                queued++;
+            }
+        }
+        sync_peer(NULL, NULL);
+        queued = 0;
+
+        uint64_t end = rdtsc();
+        if (i >= WARMUP) samples[i - WARMUP] = (end - start) / RECORDS_PER_SAMPLE;
+    }
+
+    report("ipc_batch", size, samples, nr_samples);
+}
+
+// One-way records over a channel, the current stdout path
+static void bench_chan(chan_t* ch, uint64_t size) {
+    for (int i = 0; i < WARMUP + nr_samples; i++) {
+        uint64_t start = rdtsc();
+
+        for (int r = 0; r < RECORDS_PER_SAMPLE; r++) {
+            while (chan_send(ch, payload, (uint32_t)size) == CHAN_ERR_FULL) {
+                sync_peer(NULL, NULL);
+            }
+        }
+        sync_peer(NULL, NULL);
+
+        uint64_t end = rdtsc();
+        if (i >= WARMUP) samples[i - WARMUP] = (end - start) / RECORDS_PER_SAMPLE;
+    }
+
+    report("chan_oneway", size, samples, nr_samples);
+}
+
+// The peer keeps its side of every mapping until it exits, so the sample
+// count is capped to keep the memory bounded
+static void bench_share_mem(uint64_t pages) {
+    int n = nr_samples < 100 ? nr_samples : 100;
+    uint64_t size = pages * 4096;
+
+    for (int i = 0; i < n; i++) {
+        uint64_t their_addr;
+
+        uint64_t t0 = rdtsc();
+        void* addr = sys_share_mem(peer, size, &their_addr);
+        uint64_t t1 = rdtsc();
+        sys_unmap(addr, size);
+        uint64_t t2 = rdtsc();
+
+        samples[i] = t1 - t0;
+        samples2[i] = t2 - t1;
+    }
+
+    report("shm_map", size, samples, n);
+    report("shm_unmap", size, samples2, n);
+}
+
+// Usage: ipcbench [samples]
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    if (argc > 2) {
+        nr_samples = parse_int(argv[2]);
+        if (nr_samples <= 0 || nr_samples > MAX_SAMPLES) nr_samples = DEFAULT_SAMPLES;
+    }
+
+    hz = tsc_hz();
+    if (hz < 1000) {
+        printf("ipcbench: TSC frequency unknown\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < BENCH_CHAN_MAX; i++) payload[i] = (char)i;
+
+    char* echo_argv[] = { "/", BENCH_ECHO_PATH, NULL };
+    peer = sys_exec(BENCH_ECHO_PATH, 2, echo_argv);
+    if (peer <= 0) {
+        printf("ipcbench: cannot start %s\n", BENCH_ECHO_PATH);
+        exit(1);
+    }
+
+    bench_ping_pong();
+    bench_call();
+
+    static const uint64_t batch_sizes[] = { 8, 24, 96, 384, 1536 };
+    for (int i = 0; i < (int)(sizeof(batch_sizes) / sizeof(batch_sizes[0])); i++) {
+        bench_batch(batch_sizes[i]);
+    }
+
+    chan_t ch;
+    if (chan_connect(&ch, peer, BENCH_CHAN_RING) == 0) {
+        static const uint64_t chan_sizes[] = { 8, 64, 256, 1024, 4096 };
+        for (int i = 0; i < (int)(sizeof(chan_sizes) / sizeof(chan_sizes[0])); i++) {
+            bench_chan(&ch, chan_sizes[i]);
+        }
+        chan_close(&ch);
+    } else {
+        printf("ipcbench: no free channel, skipping chan_oneway\n");
+    }
+
+    bench_share_mem(1);
+    bench_share_mem(4);
+    bench_share_mem(16);
+
+    sys_ipc_send(peer, MSG_BENCH_QUIT, 0, 0, 0);
+    int status;
+    sys_waitpid(peer, &status);
+
+    exit(0);
+}
@@ -0,0 +1,74 @@
+#include "../openidp.h"
+#include "../libc/chan.h"
+#include "bench.h"
+
+// Peer for ipcbench. Everything is received through sys_ipc_reply_wait, so
+// answers to MSG_BENCH_CALL/SYNC go out with the next wait.
+
+static chan_t chan;
+static int have_chan = 0;
+static char record[BENCH_CHAN_MAX];
+
+static uint64_t data_msgs = 0;
+static uint64_t chan_bytes = 0;
+
+static void drain_chan(void) {
+    if (!have_chan) return;
+
+    int64_t len;
+    while ((len = chan_recv(&chan, record, sizeof(record))) >= 0) {
+        chan_bytes += len;
+    }
+}
+
+void _start(void) {
+    message_t msg = { 0 };
+    int reply_to = 0;
+
+    for (;;) {
+        if (sys_ipc_reply_wait(reply_to, &msg) != 0) {
+            reply_to = 0;
+            continue;
+        }
+        reply_to = 0;
+
+        switch (msg.type) {
+            case MSG_BENCH_PING:
+                sys_ipc_send(msg.sender_pid, MSG_BENCH_PONG, msg.data1, 0, 0);
+                break;
+
+            case MSG_BENCH_CALL:
+                reply_to = msg.sender_pid;
+                break;
+
+            case MSG_BENCH_DATA:
+                data_msgs++;
+                break;
+
+            case MSG_BENCH_SYNC:
+                drain_chan();
+                msg.data1 = data_msgs;
+                msg.data2 = chan_bytes;
+                data_msgs = 0;
+                chan_bytes = 0;
+                reply_to = msg.sender_pid;
+                break;
+
+            case MSG_CHAN_OPEN:
+                if (!have_chan) have_chan = chan_accept(&chan, msg.data1) == 0;
+                break;
+
+            case MSG_CHAN_DOORBELL:
+                drain_chan();
+                break;
+
+            case MSG_BENCH_QUIT:
+                if (have_chan) chan_close(&chan);
+                sys_exit(0);
+                break;
+
+            default:
+                break;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/time.h"
+#include "../libc/thread.h"
+
+// Threads increment one counter under a futex mutex. Checks that no
+// increment is lost and reports the cost per contended lock/unlock pair.
+// Only the main thread prints, stdio is not thread-safe.
+
+#define MAX_THREADS     8
+#define DEFAULT_THREADS 4
+#define ITERATIONS      100000
+
+static mutex_t lock = MUTEX_INIT;
+static uint64_t counter = 0;
+static uint32_t finished = 0;
+
+static int parse_int(const char* s) {
+    int v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    return v;
+}
+
+static void worker(void* arg) {
+    (void)arg;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        mutex_lock(&lock);
+        counter++;
+        mutex_unlock(&lock);
+    }
+
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+    futex_wake(&finished, 1);
+}
+
+// argv[0] = cwd, argv[1] = "threadbench", argv[2] = thread count
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    int nr = argc > 2 ? parse_int(argv[2]) : DEFAULT_THREADS;
+    if (nr < 1 || nr > MAX_THREADS) nr = DEFAULT_THREADS;
+
+    uint64_t start = clock_ns();
+
+    int started = 0;
+    for (int i = 0; i < nr; i++) {
+        if (thread_create(worker, NULL) < 0) {
+            printf("threadbench: thread %d could not be created\n", i);
+            break;
+        }
+        started++;
+    }
+
+    uint32_t done;
+    while ((done = __atomic_load_n(&finished, __ATOMIC_ACQUIRE)) < (uint32_t)started) {
+        futex_wait(&finished, done);
+    }
+
+    uint64_t elapsed = clock_ns() - start;
+    uint64_t expected = (uint64_t)started * ITERATIONS;
+
+    printf("BENCH v1 name=mutex threads=%d n=%lu ns=%lu per_op=%lu\n",
+           started, expected, elapsed, expected ? elapsed / expected : 0);
+    if (counter != expected) {
+        printf("\033[31mthreadbench: counter is %lu, expected %lu\033[37m\n", counter, expected);
+        exit(1);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,32 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+
+// Ratio in tenths of a percent
+static uint64_t permille(uint64_t part, uint64_t total) {
+    return total ? part * 1000 / total : 0;
+}
+
+void _start(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    stdio_init();
+
+    bcache_stats_t s;
+    if (sys_block_stats(&s) < 0) {
+        printf("\033[31mbcstat: cannot read block cache statistics\033[37m\n");
+        exit(1);
+    }
+
+    uint64_t hit = permille(s.hits, s.hits + s.misses);
+    uint64_t ra = permille(s.readahead_hits, s.readahead);
+
+    printf("\033[36mblock cache\033[37m  %lu / %lu KiB\n\n", s.pages * 4, s.max_pages * 4);
+    printf("hits         %10lu  (%lu.%lu%%)\n", s.hits, hit / 10, hit % 10);
+    printf("misses       %10lu\n", s.misses);
+    printf("read-ahead   %10lu  (%lu.%lu%% used)\n", s.readahead, ra / 10, ra % 10);
+    printf("evictions    %10lu\n", s.evictions);
+    printf("disk reads   %10lu\n", s.dev_reads);
+    printf("disk writes  %10lu\n", s.dev_writes);
+
+    exit(0);
+}
@@ -0,0 +1,49 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+
+#define CHUNK_SIZE 4096
+
+static char chunk[CHUNK_SIZE];
+
+static void copy_fd(int fd) {
+    // Stream in fixed chunks, the file can be larger than memory
+    int64_t n;
+    while ((n = sys_read(fd, chunk, CHUNK_SIZE)) > 0) {
+        for (int64_t j = 0; j < n; j++) putchar(chunk[j]);
+    }
+}
+
+// argv[0] = cwd, argv[1] = "cat", argv[2...] = files, none = stdin
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    if (argc < 3) {
+        copy_fd(0);
+        exit(0);
+    }
+
+    char path[256];
+
+    for (int i = 2; i < argc; i++) {
+        if (argv[i][0] == '/') {
+            strcpy(path, argv[i]);
+        } else {
+            strcpy(path, argv[0]);
+            int len = strlen(path);
+            if (len > 0 && path[len - 1] != '/') strcat(path, "/");
+            strcat(path, argv[i]);
+        }
+
+        int fd = sys_open(path, O_RDONLY);
+        if (fd < 0) {
+            printf("\033[31mcat: %s: not found\033[37m\n", argv[i]);
+            continue;
+        }
+
+        copy_fd(fd);
+        sys_close(fd);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,26 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+
+// Must match SERIAL_LOG_SIZE in include/drivers/com1.h
+#define LOG_SIZE 16384
+
+static char klog[LOG_SIZE];
+
+void _start(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    stdio_init();
+
+    int64_t n = sys_log_read(klog, LOG_SIZE);
+    if (n < 0) {
+        printf("\033[31mdmesg: cannot read kernel log\033[37m\n");
+        exit(1);
+    }
+
+    // The serial log uses CRLF line endings
+    for (int64_t i = 0; i < n; i++) {
+        if (klog[i] != '\r') putchar(klog[i]);
+    }
+
+    exit(0);
+}
@@ -2,6 +2,8 @@
 #include "../libc/stdio.h"
 #include "../libc/string.h"
 
+#define DIRENT_BATCH 32
+
 // The Kernel puts argc in RDI and argv in RSI (Standard System V ABI).
 // Defining _start with these arguments makes the compiler read the registers correctly.
 void _start(int argc, char** argv) {
@@ -38,30 +40,34 @@ void _start(int argc, char** argv) {
         target_path = argv[0];
     }
 
-    struct kdirent entry;
-    int index = 0;
-
     printf("\n\033[36m--- %s ---\033[37m\n", target_path);
 
-    while (1) {
-        int res = sys_dir_read(target_path, index, &entry);
+    int fd = sys_open(target_path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        printf("\033[31mError: Directory not found\033[37m\n");
+    }
 
-        if (res == -2) break; // End of Directory
-        if (res < 0) {
-            printf("\033[31mError: Directory not found\033[37m\n");
-            break;
-        }
+    // Each getdents call returns as many entries as fit in the buffer
+    static struct kdirent entries[DIRENT_BATCH];
+    int64_t bytes;
 
-        str_tolower(entry.name);
-        if (entry.is_dir) {
-            printf("\033[34m%s/\n\033[37m", entry.name);
-        } else {
-            printf("%s\n", entry.name);
+    while (fd >= 0 && (bytes = sys_getdents(fd, entries, sizeof(entries))) > 0) {
+        int count = bytes / sizeof(struct kdirent);
+
+        for (int i = 0; i < count; i++) {
+            struct kdirent* entry = &entries[i];
+
+            str_tolower(entry->name);
+            if (entry->is_dir) {
+                printf("\033[34m%s/\n\033[37m", entry->name);
+            } else {
+                printf("%s\n", entry->name);
+            }
         }
-        
-        index++;
     }
+
+    if (fd >= 0) sys_close(fd);
     printf("\033[36m--- press enter ---\033[37m\n");
 
-    sys_exit(0);
+    exit(0);
 }
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+
+#define RECORD_BATCH 32
+#define READ_TIMEOUT_MS 100
+
+extern int terminal_pid;
+
+static trace_record_t records[RECORD_BATCH];
+static trace_stats_t stats;
+
+static const char* syscall_names[TRACE_MAX_SYSCALLS] = {
+    [SYS_WRITE] = "write",
+    [SYS_EXIT] = "exit",
+    [SYS_READ_KEY] = "read_key",
+    [SYS_EXEC] = "exec",
+    [SYS_GET_FB_INFO] = "get_fb_info",
+    [SYS_SBRK] = "sbrk",
+    [SYS_IPC_SEND] = "ipc_send",
+    [SYS_IPC_RECV] = "ipc_recv",
+    [SYS_SHARE_MEM] = "share_mem",
+    [SYS_FILE_READ] = "file_read",
+    [SYS_UNMAP] = "unmap",
+    [SYS_STAT] = "stat",
+    [SYS_DIR_READ] = "dir_read",
+    [SYS_TASK_STATS] = "task_stats",
+    [SYS_THREAD_CREATE] = "thread_create",
+    [SYS_FUTEX_WAIT] = "futex_wait",
+    [SYS_FUTEX_WAKE] = "futex_wake",
+    [SYS_WAITPID] = "waitpid",
+    [SYS_RING_SETUP] = "ring_setup",
+    [SYS_RING_ENTER] = "ring_enter",
+    [SYS_TRACE_CTL] = "trace_ctl",
+    [SYS_TRACE_READ] = "trace_read",
+    [SYS_OPEN] = "open",
+    [SYS_READ] = "read",
+    [SYS_PREAD] = "pread",
+    [SYS_SEEK] = "seek",
+    [SYS_CLOSE] = "close",
+    [SYS_GETDENTS] = "getdents",
+    [SYS_LOG_READ] = "log_read",
+    [SYS_CHAN_CREATE] = "chan_create",
+    [SYS_CHAN_ACCEPT] = "chan_accept",
+    [SYS_CHAN_NOTIFY] = "chan_notify",
+    [SYS_CHAN_CLOSE] = "chan_close",
+    [SYS_PIPE] = "pipe",
+    [SYS_EXEC_FDS] = "exec_fds",
+    [SYS_FD_WRITE] = "fd_write",
+    [SYS_FSTAT] = "fstat",
+    [SYS_IPC_CALL] = "ipc_call",
+    [SYS_IPC_REPLY_WAIT] = "ipc_reply_wait",
+    [SYS_WAIT_EVENTS] = "wait_events",
+    [SYS_BLOCK_STATS] = "block_stats",
+};
+
+static const char* syscall_name(uint32_t nr) {
+    if (nr < TRACE_MAX_SYSCALLS && syscall_names[nr]) return syscall_names[nr];
+    return "unknown";
+}
+
+static int parse_int(const char* s) {
+    int v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    return v;
+}
+
+static void usage(void) {
+    printf("usage: strace <command> [args]   trace a command's syscalls\n");
+    printf("       strace -c <pid>            syscall counts and latencies (0 = all)\n");
+}
+
+/* Summary mode */
+
+static void print_stats(int pid) {
+    int old_flags = sys_trace_ctl(TRACE_CTL_SET_FLAGS, 0, 0);
+    sys_trace_ctl(TRACE_CTL_SET_FLAGS, old_flags | TRACE_STATS, 0);
+
+    if (!(old_flags & TRACE_STATS)) {
+        printf("syscall statistics enabled, run strace -c again later\n");
+        exit(0);
+    }
+
+    int ret = sys_trace_ctl(TRACE_CTL_GET_STATS, pid, (uint64_t)&stats);
+    if (ret == -1) {
+        printf("strace: no such process %d\n", pid);
+        exit(1);
+    }
+    if (ret < 0) {
+        printf("strace: no syscalls recorded for %d yet\n", pid);
+        exit(0);
+    }
+
+    printf("\033[34m%-14s %8s %10s %10s\033[37m\n", "SYSCALL", "CALLS", "AVG(us)", "MAX(us)");
+
+    for (int nr = 0; nr < TRACE_MAX_SYSCALLS; nr++) {
+        if (stats.count[nr] == 0) continue;
+
+        printf("%-14s %8lu %10lu %10lu\n", syscall_name(nr), stats.count[nr],
+               stats.total_ns[nr] / stats.count[nr] / 1000, stats.max_ns[nr] / 1000);
+
+        // log2 histogram, one line per populated bucket
+        for (int b = 0; b < TRACE_HIST_BUCKETS; b++) {
+            if (stats.hist[nr][b] == 0) continue;
+            printf("    >= %10lu ns  %u\n", 1UL << b, stats.hist[nr][b]);
+        }
+    }
+}
+
+/* Streaming mode */
+
+static void print_record(const trace_record_t* r) {
+    printf("\033[36m[%u]\033[37m %s(0x%lx, 0x%lx, 0x%lx) = %ld  \033[33m<%lu us>\033[37m\n",
+           r->pid, syscall_name(r->nr), r->args[0], r->args[1], r->args[2],
+           r->ret, r->duration_ns / 1000);
+}
+
+static void trace_command(int argc, char** argv) {
+    char path[256];
+    char* command = argv[2];
+
+    if (command[0] == '/') {
+        strcpy(path, command);
+    } else {
+        // Relative to the working directory, like the shell does
+        strcpy(path, argv[0]);
+        int len = strlen(path);
+        if (len > 0 && path[len - 1] != '/') strcat(path, "/");
+        strcat(path, command);
+    }
+
+    // The child sees the shell's layout: argv[0] = cwd, argv[1] = command
+    argv[1] = argv[0];
+
+    // The kernel turns logging on and filters on the child as it is created,
+    // so its first syscall is recorded and nothing older is left in the log
+    int old_flags = sys_trace_ctl(TRACE_CTL_SET_FLAGS, 0, 0);
+    sys_trace_ctl(TRACE_CTL_SET_FLAGS, old_flags, 0);
+    sys_trace_ctl(TRACE_CTL_ON_EXEC, TRACE_LOG, 0);
+
+    int pid = sys_exec(path, argc - 1, &argv[1]);
+    if (pid < 0) {
+        sys_trace_ctl(TRACE_CTL_ON_EXEC, 0, 0);
+        printf("strace: cannot run %s\n", path);
+        exit(1);
+    }
+
+    sys_ipc_send(pid, MSG_HANDSHAKE, terminal_pid, 0, 0);
+
+    int done = 0;
+    while (!done) {
+        int n = sys_trace_read(records, RECORD_BATCH, READ_TIMEOUT_MS);
+        for (int i = 0; i < n; i++) {
+            print_record(&records[i]);
+            if (records[i].nr == SYS_EXIT) done = 1;
+        }
+    }
+
+    int dropped = sys_trace_ctl(TRACE_CTL_DROPPED, 0, 0);
+    sys_trace_ctl(TRACE_CTL_SET_FLAGS, old_flags, 0);
+    sys_trace_ctl(TRACE_CTL_SET_PID, 0, 0);
+
+    int status = 0;
+    sys_waitpid(pid, &status);
+
+    if (dropped > 0) printf("strace: %d records dropped\n", dropped);
+    printf("+++ exited with %d +++\n", status);
+}
+
+// argv[0] = cwd, argv[1] = "strace", argv[2...] = options or command
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    if (argc < 3) {
+        usage();
+        exit(1);
+    }
+
+    if (strcmp(argv[2], "-c") == 0) {
+        print_stats(argc > 3 ? parse_int(argv[3]) : 0);
+    } else {
+        trace_command(argc, argv);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,95 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+#include "../libc/time.h"
+
+#define MAX_TASKS 64
+#define DEFAULT_ITERATIONS 10
+#define INTERVAL_NS 1000000000ULL
+
+static task_stats_t snap_prev[MAX_TASKS];
+static task_stats_t snap_curr[MAX_TASKS];
+
+static const char* state_name(uint32_t state) {
+    switch (state) {
+        case TASK_RUNNING: return "run";
+        case TASK_BLOCKED: return "blocked";
+        case TASK_ZOMBIE:  return "zombie";
+        default:           return "?";
+    }
+}
+
+static int parse_int(const char* s) {
+    int v = 0;
+    while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+    return v;
+}
+
+static int take_snapshot(task_stats_t* out) {
+    int count = sys_task_stats(out, MAX_TASKS);
+    return (count > MAX_TASKS) ? MAX_TASKS : count;
+}
+
+static const task_stats_t* find_prev(const task_stats_t* prev, int prev_count, uint64_t pid) {
+    for (int i = 0; i < prev_count; i++) {
+        if (prev[i].pid == pid) return &prev[i];
+    }
+    return NULL;
+}
+
+static void print_snapshot(int count, int prev_count, uint64_t wall_ns) {
+    uint64_t uptime_s = clock_ns() / 1000000000ULL;
+
+    clear_screen();
+    printf("\033[36mtop\033[37m - up %lus, %d tasks, interval %lums\n\n",
+           uptime_s, count, wall_ns / 1000000ULL);
+    printf("\033[34m  PID  NAME                STATE     CPU%%    TIME(ms)    VCSW    ICSW\033[37m\n");
+
+    for (int i = 0; i < count; i++) {
+        const task_stats_t* t = &snap_curr[i];
+        const task_stats_t* p = find_prev(snap_prev, prev_count, t->pid);
+
+        // CPU share over the interval in tenths of a percent
+        uint64_t delta = p ? t->runtime_ns - p->runtime_ns : t->runtime_ns;
+        uint64_t permille = wall_ns ? (delta * 1000) / wall_ns : 0;
+        if (permille > 1000) permille = 1000;
+
+        printf("%5lu  %-20s%-8s %3lu.%lu  %10lu  %6lu  %6lu\n",
+               t->pid, t->name, state_name(t->state),
+               permille / 10, permille % 10,
+               t->runtime_ns / 1000000ULL,
+               t->nr_voluntary, t->nr_involuntary);
+    }
+}
+
+// Usage: top [iterations]
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc > 2) {
+        iterations = parse_int(argv[2]);
+        if (iterations <= 0) iterations = DEFAULT_ITERATIONS;
+    }
+
+    int prev_count = take_snapshot(snap_prev);
+    uint64_t prev_time = clock_ns();
+
+    for (int iter = 0; iter < iterations; iter++) {
+        uint64_t elapsed;
+        while ((elapsed = clock_ns() - prev_time) < INTERVAL_NS) {
+            sys_wait_events(EVENT_TIMER, INTERVAL_NS - elapsed);
+        }
+
+        int count = take_snapshot(snap_curr);
+        uint64_t now = clock_ns();
+
+        print_snapshot(count, prev_count, now - prev_time);
+
+        memcpy(snap_prev, snap_curr, sizeof(task_stats_t) * count);
+        prev_count = count;
+        prev_time = now;
+    }
+
+    exit(0);
+}
@@ -0,0 +1,82 @@
+#include "../openidp.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+
+#define CHUNK_SIZE 4096
+
+static char chunk[CHUNK_SIZE];
+
+typedef struct {
+    uint64_t lines;
+    uint64_t words;
+    uint64_t bytes;
+} counts_t;
+
+static void count_fd(int fd, counts_t* c) {
+    int in_word = 0;
+    int64_t n;
+
+    while ((n = sys_read(fd, chunk, CHUNK_SIZE)) > 0) {
+        c->bytes += n;
+
+        for (int64_t i = 0; i < n; i++) {
+            char ch = chunk[i];
+            if (ch == '\n') c->lines++;
+
+            if (ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r') {
+                in_word = 0;
+            } else if (!in_word) {
+                in_word = 1;
+                c->words++;
+            }
+        }
+    }
+}
+
+static void print_counts(const counts_t* c, const char* name) {
+    printf("%8lu %8lu %8lu %s\n", c->lines, c->words, c->bytes, name);
+}
+
+// argv[0] = cwd, argv[1] = "wc", argv[2...] = files, none = stdin
+void _start(int argc, char** argv) {
+    stdio_init();
+
+    if (argc < 3) {
+        counts_t c = { 0, 0, 0 };
+        count_fd(0, &c);
+        print_counts(&c, "");
+        exit(0);
+    }
+
+    char path[256];
+    counts_t total = { 0, 0, 0 };
+
+    for (int i = 2; i < argc; i++) {
+        if (argv[i][0] == '/') {
+            strcpy(path, argv[i]);
+        } else {
+            strcpy(path, argv[0]);
+            int len = strlen(path);
+            if (len > 0 && path[len - 1] != '/') strcat(path, "/");
+            strcat(path, argv[i]);
+        }
+
+        int fd = sys_open(path, O_RDONLY);
+        if (fd < 0) {
+            printf("\033[31mwc: %s: not found\033[37m\n", argv[i]);
+            continue;
+        }
+
+        counts_t c = { 0, 0, 0 };
+        count_fd(fd, &c);
+        sys_close(fd);
+
+        print_counts(&c, argv[i]);
+        total.lines += c.lines;
+        total.words += c.words;
+        total.bytes += c.bytes;
+    }
+
+    if (argc > 3) print_counts(&total, "total");
+    exit(0);
+}
@@ -11,5 +11,5 @@ void _start(int argc, char** argv) {
     printf("\n\n\n\n\n\n\n\033[34mKernel\033[36m: \033[37mopenidp-dev\n");
     printf("\033[34mFramebuffer\033[36m: \033[37m1920x1080 32bpp\n");
 
-	sys_exit(0);
+	exit(0);
 }
@@ -537,8 +537,9 @@ void _start() {
             }
         }
 
+        // Sleep until a client message or a key arrives
         if (!work_done) {
-            asm volatile("pause");
+            sys_wait_events(EVENT_IPC | EVENT_KEY, 0);
         }
     }
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#include "chan.h"
+
+#define CHAN_REC_HDR 4
+
+static inline uint32_t rec_size(uint32_t len) {
+    return CHAN_REC_HDR + ((len + 3) & ~3u);
+}
+
+static void chan_bind(chan_t* ch, chan_info_t* info) {
+    uint8_t* base = (uint8_t*)info->base;
+    chan_ring_t* rings = (chan_ring_t*)base;
+
+    ch->id = info->id;
+    ch->peer_pid = (int)info->peer_pid;
+    ch->tx = &rings[info->tx];
+    ch->rx = &rings[info->tx ^ 1];
+    ch->tx_data = base + ch->tx->data_off;
+    ch->rx_data = base + ch->rx->data_off;
+}
+
+// Copies that may wrap around the end of the data area
+static void ring_copy_in(chan_ring_t* r, uint8_t* data, uint32_t pos, const uint8_t* src, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) data[(pos + i) & (r->size - 1)] = src[i];
+}
+
+static void ring_copy_out(chan_ring_t* r, uint8_t* data, uint32_t pos, uint8_t* dst, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) dst[i] = data[(pos + i) & (r->size - 1)];
+}
+
+int chan_connect(chan_t* ch, int peer_pid, uint32_t size) {
+    chan_info_t info;
+    int64_t id = sys_chan_create(peer_pid, size, &info);
+    if (id < 0) return (int)id;
+
+    chan_bind(ch, &info);
+    sys_ipc_send(peer_pid, MSG_CHAN_OPEN, (uint64_t)id, 0, 0);
+    return 0;
+}
+
+int chan_accept(chan_t* ch, uint64_t id) {
+    chan_info_t info;
+    int64_t ret = sys_chan_accept(id, &info);
+    if (ret < 0) return (int)ret;
+
+    chan_bind(ch, &info);
+    return 0;
+}
+
+int chan_write(chan_t* ch, const void* buf, uint32_t len) {
+    chan_ring_t* r = ch->tx;
+    uint32_t need = rec_size(len);
+    if (need > r->size) return CHAN_ERR_SIZE;
+
+    uint32_t head = r->head;
+    if (r->size - (head - r->tail) < need) return CHAN_ERR_FULL;
+
+    // The header never wraps: records are 4-byte aligned in a power-of-two ring
+    *(uint32_t*)(ch->tx_data + (head & (r->size - 1))) = len;
+    ring_copy_in(r, ch->tx_data, head + CHAN_REC_HDR, (const uint8_t*)buf, len);
+
+    // Record contents must be visible before the head moves
+    asm volatile("" ::: "memory");
+    r->head = head + need;
+    return 0;
+}
+
+int chan_notify(chan_t* ch) {
+    return (int)sys_chan_notify(ch->id);
+}
+
+int chan_send(chan_t* ch, const void* buf, uint32_t len) {
+    uint32_t old_head = ch->tx->head;
+
+    int ret = chan_write(ch, buf, len);
+    if (ret < 0) return ret;
+
+    // Only an empty ring can have a sleeping reader. The fence orders the
+    // head store before the tail load, pairing with the one in chan_recv().
+    asm volatile("mfence" ::: "memory");
+    if (ch->tx->tail == old_head) return chan_notify(ch);
+    return 0;
+}
+
+int64_t chan_recv(chan_t* ch, void* buf, uint32_t max) {
+    chan_ring_t* r = ch->rx;
+    uint32_t tail = r->tail;
+
+    if (tail == r->head) {
+        // The peer publishes everything before the kernel marks it closed
+        if (r->closed && tail == r->head) return CHAN_ERR_CLOSED;
+        return CHAN_ERR_EMPTY;
+    }
+
+    asm volatile("" ::: "memory");
+    uint32_t len = *(uint32_t*)(ch->rx_data + (tail & (r->size - 1)));
+    if (len > max) return CHAN_ERR_SIZE;
+
+    ring_copy_out(r, ch->rx_data, tail + CHAN_REC_HDR, (uint8_t*)buf, len);
+
+    // Done reading before the slot is handed back. The fence orders the tail
+    // store before the next head load, pairing with the one in chan_send().
+    asm volatile("" ::: "memory");
+    r->tail = tail + rec_size(len);
+    asm volatile("mfence" ::: "memory");
+
+    // The writer sets waiting before its last look at the tail
+    if (r->waiting) {
+        r->waiting = 0;
+        chan_notify(ch);
+    }
+    return len;
+}
+
+void chan_close(chan_t* ch) {
+    sys_chan_close(ch->id);
+    ch->tx = ch->rx = 0;
+}
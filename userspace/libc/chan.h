@@ -0,0 +1,64 @@
+#ifndef IDP_CHAN_H
+#define IDP_CHAN_H
+
+#include "stdint.h"
+#include "../openidp.h"
+
+// Message channels over memory shared with one peer process.
+// Layout must match include/syscall/channel.h
+//
+// Each direction is a byte ring of length-prefixed records. Writers only
+// ring the peer's doorbell when the ring was empty, so a busy reader gets
+// one MSG_CHAN_DOORBELL per burst and should chan_recv() until it is empty.
+// A writer that finds the ring full sets tx->waiting, and the next
+// chan_recv() on the other side rings the writer's doorbell in turn.
+
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t size;
+    uint32_t data_off;
+    volatile uint32_t closed;
+    volatile uint32_t waiting;
+    uint32_t reserved[10];
+} chan_ring_t;
+
+typedef struct chan_info {
+    uint64_t id;
+    uint64_t base;
+    uint64_t peer_pid;
+    uint32_t tx;
+    uint32_t size;
+} chan_info_t;
+
+typedef struct {
+    uint64_t id;
+    int peer_pid;
+    chan_ring_t* tx;
+    uint8_t* tx_data;
+    chan_ring_t* rx;
+    uint8_t* rx_data;
+} chan_t;
+
+#define CHAN_ERR_EMPTY  -1   // Nothing to receive
+#define CHAN_ERR_FULL   -2   // Not enough room, retry after the peer reads
+#define CHAN_ERR_SIZE   -3   // Message larger than the ring or the buffer
+#define CHAN_ERR_CLOSED -4   // Peer closed its end and everything was read
+
+// Creates a channel with size bytes per direction and sends the peer
+// MSG_CHAN_OPEN with the id, which the peer passes to chan_accept().
+int chan_connect(chan_t* ch, int peer_pid, uint32_t size);
+int chan_accept(chan_t* ch, uint64_t id);
+
+// Queues one message without ringing the doorbell; chan_notify() once for
+// a batch. chan_send() does both.
+int chan_write(chan_t* ch, const void* buf, uint32_t len);
+int chan_send(chan_t* ch, const void* buf, uint32_t len);
+int chan_notify(chan_t* ch);
+
+// Returns the length of the next message, copied to buf, or a CHAN_ERR_*.
+int64_t chan_recv(chan_t* ch, void* buf, uint32_t max);
+
+void chan_close(chan_t* ch);
+
+#endif
@@ -3,6 +3,8 @@
 
 #include "stdint.h"
 
+// Not thread-safe: threads of one process (thread.h) must not call these
+// concurrently without a lock of their own
 void* malloc(uint64_t size);
 void free(void* ptr);
 
@@ -0,0 +1,97 @@
+#include "ring.h"
+
+int ring_init(ring_t* ring) {
+    uint8_t* base = sys_ring_setup();
+    if (!base) return -1;
+
+    ring->hdr = (ring_hdr_t*)base;
+    ring->sq = (ring_sqe_t*)(base + ring->hdr->sq_off);
+    ring->cq = (ring_cqe_t*)(base + ring->hdr->cq_off);
+    ring->sq_local_tail = ring->hdr->sq_tail;
+    return 0;
+}
+
+ring_sqe_t* ring_get_sqe(ring_t* ring) {
+    ring_hdr_t* hdr = ring->hdr;
+    if (ring->sq_local_tail - hdr->sq_head >= hdr->sq_entries) return NULL;
+
+    ring_sqe_t* sqe = &ring->sq[ring->sq_local_tail & (hdr->sq_entries - 1)];
+    ring->sq_local_tail++;
+
+    uint64_t* words = (uint64_t*)sqe;
+    for (uint32_t i = 0; i < sizeof(ring_sqe_t) / 8; i++) words[i] = 0;
+    return sqe;
+}
+
+/* Request helpers */
+
+void ring_prep_ipc_send(ring_sqe_t* sqe, int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3) {
+    sqe->opcode = RING_OP_IPC_SEND;
+    sqe->arg[0] = (uint64_t)dest_pid;
+    sqe->arg[1] = (uint64_t)type;
+    sqe->arg[2] = d1;
+    sqe->arg[3] = d2;
+    sqe->arg[4] = d3;
+}
+
+void ring_prep_ipc_recv(ring_sqe_t* sqe) {
+    sqe->opcode = RING_OP_IPC_RECV;
+}
+
+void ring_prep_file_read(ring_sqe_t* sqe, const char* path, void* buf, uint64_t max_len) {
+    sqe->opcode = RING_OP_FILE_READ;
+    sqe->arg[0] = (uint64_t)path;
+    sqe->arg[1] = (uint64_t)buf;
+    sqe->arg[2] = max_len;
+}
+
+void ring_prep_stat(ring_sqe_t* sqe, const char* path, struct kstat* out) {
+    sqe->opcode = RING_OP_STAT;
+    sqe->arg[0] = (uint64_t)path;
+    sqe->arg[1] = (uint64_t)out;
+}
+
+void ring_prep_dir_read(ring_sqe_t* sqe, const char* path, uint64_t index, struct kdirent* out) {
+    sqe->opcode = RING_OP_DIR_READ;
+    sqe->arg[0] = (uint64_t)path;
+    sqe->arg[1] = index;
+    sqe->arg[2] = (uint64_t)out;
+}
+
+void ring_prep_sleep(ring_sqe_t* sqe, uint64_t ns) {
+    sqe->opcode = RING_OP_SLEEP;
+    sqe->arg[0] = ns;
+}
+
+/* Submission and completion */
+
+static uint32_t ring_publish(ring_t* ring) {
+    // SQE contents must be visible before the tail moves
+    asm volatile("" ::: "memory");
+    uint32_t queued = ring->sq_local_tail - ring->hdr->sq_tail;
+    ring->hdr->sq_tail = ring->sq_local_tail;
+    return queued;
+}
+
+int ring_submit(ring_t* ring) {
+    uint32_t queued = ring_publish(ring);
+    return sys_ring_enter(queued, 0, 0);
+}
+
+int ring_submit_and_wait(ring_t* ring, uint32_t min_complete) {
+    uint32_t queued = ring_publish(ring);
+    return sys_ring_enter(queued, min_complete, RING_ENTER_WAIT);
+}
+
+ring_cqe_t* ring_peek_cqe(ring_t* ring) {
+    ring_hdr_t* hdr = ring->hdr;
+    if (hdr->cq_head == hdr->cq_tail) return NULL;
+
+    asm volatile("" ::: "memory");
+    return &ring->cq[hdr->cq_head & (hdr->cq_entries - 1)];
+}
+
+void ring_cqe_seen(ring_t* ring) {
+    asm volatile("" ::: "memory");
+    ring->hdr->cq_head = ring->hdr->cq_head + 1;
+}
@@ -0,0 +1,80 @@
+#ifndef IDP_RING_H
+#define IDP_RING_H
+
+#include "stdint.h"
+#include "../openidp.h"
+
+// Batched syscalls through rings shared with the kernel.
+// Layout must match include/syscall/ring.h
+
+#define RING_OP_NOP       0
+#define RING_OP_IPC_SEND  1
+#define RING_OP_IPC_RECV  2
+#define RING_OP_FILE_READ 3
+#define RING_OP_STAT      4
+#define RING_OP_DIR_READ  5
+#define RING_OP_SLEEP     6
+
+#define RING_CQE_MSG      (1 << 0)
+#define RING_ENTER_WAIT   (1 << 0)
+
+typedef struct {
+    uint32_t opcode;
+    uint32_t flags;
+    uint64_t user_data;
+    uint64_t arg[5];
+    uint64_t reserved;
+} ring_sqe_t;
+
+typedef struct {
+    uint64_t user_data;
+    int64_t res;
+    uint32_t flags;
+    uint32_t reserved;
+    message_t msg;
+    uint64_t pad;
+} ring_cqe_t;
+
+typedef struct {
+    volatile uint32_t sq_head;
+    volatile uint32_t sq_tail;
+    uint32_t sq_entries;
+    uint32_t sq_off;
+
+    volatile uint32_t cq_head;
+    volatile uint32_t cq_tail;
+    uint32_t cq_entries;
+    uint32_t cq_off;
+
+    uint32_t nr_pending;
+    uint32_t reserved[7];
+} ring_hdr_t;
+
+typedef struct {
+    ring_hdr_t* hdr;
+    ring_sqe_t* sq;
+    ring_cqe_t* cq;
+    uint32_t sq_local_tail;   // Queued but not yet published to the kernel
+} ring_t;
+
+int ring_init(ring_t* ring);
+
+// Returns a zeroed SQE to fill, or NULL if the submission ring is full
+ring_sqe_t* ring_get_sqe(ring_t* ring);
+
+void ring_prep_ipc_send(ring_sqe_t* sqe, int dest_pid, int type, uint64_t d1, uint64_t d2, uint64_t d3);
+void ring_prep_ipc_recv(ring_sqe_t* sqe);
+void ring_prep_file_read(ring_sqe_t* sqe, const char* path, void* buf, uint64_t max_len);
+void ring_prep_stat(ring_sqe_t* sqe, const char* path, struct kstat* out);
+void ring_prep_dir_read(ring_sqe_t* sqe, const char* path, uint64_t index, struct kdirent* out);
+void ring_prep_sleep(ring_sqe_t* sqe, uint64_t ns);
+
+// Publishes queued SQEs in one kernel entry. Returns how many were consumed.
+int ring_submit(ring_t* ring);
+int ring_submit_and_wait(ring_t* ring, uint32_t min_complete);
+
+// Returns the oldest unseen completion, or NULL. Release it with ring_cqe_seen().
+ring_cqe_t* ring_peek_cqe(ring_t* ring);
+void ring_cqe_seen(ring_t* ring);
+
+#endif
@@ -1,4 +1,5 @@
 #include "stdio.h"
+#include "chan.h"
 #include "../openidp.h"
 #include "../libc/string.h"
 #include <stdarg.h>
@@ -7,52 +8,145 @@
 
 int terminal_pid = -1;
 
-static char out_buf[BATCH_SIZE + 1]; // +1 for null terminator safety
+// Output to a pipe is fully buffered in this much
+#define PIPE_BUF_SIZE   4096
+
+// Output goes through a channel to the terminal, one record per flush.
+// Without one (no free channel) it falls back to MSG_STDOUT_BATCH messages.
+// When the shell connected descriptor 1 to a pipe it goes there instead.
+static chan_t out_chan;
+static int have_chan = 0;
+static int out_pipe = 0;
+static int in_pipe = 0;
+
+static char out_buf[PIPE_BUF_SIZE + 1]; // +1 for null terminator safety
 static int buf_idx = 0;
 
+static char in_buf[PIPE_BUF_SIZE];
+static int in_len = 0;
+static int in_pos = 0;
+
+// Messages taken off the queue while waiting for the terminal, handed to
+// getchar() before anything newer
+#define STASH_SIZE      16
+static message_t stash[STASH_SIZE];
+static int stash_head = 0;
+static int stash_count = 0;
+
+// Sleep between retries when there is nothing to wake us (the terminal's
+// message queue is full, or the stash is)
+#define BACKOFF_NS      1000000ULL
+
+static int is_pipe(int fd) {
+    struct kstat st;
+    return sys_fstat(fd, &st) == 0 && st.flags == KSTAT_PIPE;
+}
+
+static void connect_terminal(int pid) {
+    terminal_pid = pid;
+    in_pipe = is_pipe(0);
+    out_pipe = is_pipe(1);
+
+    if (!out_pipe) have_chan = chan_connect(&out_chan, pid, STDOUT_RING_SIZE) == 0;
+}
+
 void stdio_init(void) {
     message_t msg;
     // BLOCK until we receive the handshake from our parent Terminal
     while (1) {
         if (sys_ipc_recv(&msg) == 0) {
             if (msg.type == MSG_HANDSHAKE && msg.data1 == 0) {
-                terminal_pid = msg.sender_pid;
+                connect_terminal(msg.sender_pid);
                 return; // Connection established!
             } else if (msg.type == MSG_HANDSHAKE && msg.data1 != 0) {
-                terminal_pid = msg.data1;
+                connect_terminal((int)msg.data1);
                 return;
             }
+        } else {
+            sys_wait_events(EVENT_IPC, 0);
         }
     }
 }
 
-static void fflush_internal(void) {
-    if (buf_idx == 0) return;
-    if (terminal_pid == -1) return;
+static int next_message(message_t* msg) {
+    if (stash_count > 0) {
+        *msg = stash[stash_head];
+        stash_head = (stash_head + 1) % STASH_SIZE;
+        stash_count--;
+        return 1;
+    }
+    return sys_ipc_recv(msg) == 0;
+}
+
+// Sleeps until the terminal rings the output channel, after it read from a
+// ring we marked as waiting or closed its end. Returns early if the stash
+// fills up, callers check their condition again either way.
+static void wait_for_terminal(void) {
+    message_t msg;
+    while (stash_count < STASH_SIZE) {
+        sys_wait_events(EVENT_IPC, 0);
+        if (sys_ipc_recv(&msg) != 0) continue;
+
+        if (msg.type == MSG_CHAN_DOORBELL) {
+            if (msg.data1 == out_chan.id) return;
+            continue;
+        }
+        stash[(stash_head + stash_count++) % STASH_SIZE] = msg;
+    }
+
+    sys_wait_events(EVENT_TIMER, BACKOFF_NS);
+}
+
+// Old path: at most 24 bytes per message, packed into the data words
+static void flush_batches(const char* buf, int len) {
+    for (int off = 0; off < len; off += BATCH_SIZE) {
+        uint64_t packs[3] = { 0, 0, 0 };
+        int n = len - off < BATCH_SIZE ? len - off : BATCH_SIZE;
+        memcpy(packs, buf + off, n);
 
-    // Zero out the rest of the buffer so we don't send garbage
-    for (int i = buf_idx; i < BATCH_SIZE; i++) {
-        out_buf[i] = 0;
+        // Backpressure: nothing signals room in the terminal's queue, so
+        // sleep a little between attempts
+        while (sys_ipc_send(terminal_pid, MSG_STDOUT_BATCH, packs[0], packs[1], packs[2]) != 0) {
+            sys_wait_events(EVENT_TIMER, BACKOFF_NS);
+        }
     }
+}
 
-    // PACKING: Treat the buffer as 3 uint64_t integers
-    // We cast the char pointer to a uint64_t pointer to read 8 bytes at a time
-    uint64_t* packs = (uint64_t*)out_buf;
-    uint64_t d1 = packs[0];
-    uint64_t d2 = packs[1];
-    uint64_t d3 = packs[2];
+// An empty record asks the terminal to clear the screen
+static void send_record(const char* buf, int len) {
+    if (out_pipe) {
+        if (len > 0) sys_fd_write(1, buf, len);
+        return;
+    }
 
-    // RETRY LOOP (Backpressure)
+    if (terminal_pid == -1) return;
+
+    if (!have_chan) {
+        if (len == 0) sys_ipc_send(terminal_pid, MSG_STDOUT_CLEAR, 0, 0, 0);
+        else flush_batches(buf, len);
+        return;
+    }
+
+    // Backpressure: the terminal was already rung when the ring filled up.
+    // Ask it to ring back once it has read something, then look again in
+    // case it drained the ring before seeing the flag.
     int ret;
-    do {
-        ret = sys_ipc_send(terminal_pid, MSG_STDOUT_BATCH, d1, d2, d3);
-        if (ret != 0) asm volatile("pause");
-    } while (ret != 0);
+    while ((ret = chan_send(&out_chan, buf, len)) == CHAN_ERR_FULL) {
+        out_chan.tx->waiting = 1;
+        asm volatile("mfence" ::: "memory");
+
+        if ((ret = chan_send(&out_chan, buf, len)) != CHAN_ERR_FULL) break;
+        if (out_chan.rx->closed) break;
+        wait_for_terminal();
+    }
+    if (ret < 0) have_chan = 0; // Terminal went away
+}
+
+static void fflush_internal(void) {
+    if (buf_idx == 0) return;
 
-    // Reset buffer
+    send_record(out_buf, buf_idx);
     buf_idx = 0;
-    // Clear buffer again to be safe (optional but good for debugging)
-    memset(out_buf, 0, BATCH_SIZE);
 }
 
 void putchar(char c) {
@@ -60,9 +154,11 @@ void putchar(char c) {
     out_buf[buf_idx++] = c;
 
     // Flush if:
-    // 1. Buffer is FULL (24 chars)
+    // 1. Buffer is FULL
     // 2. Character is NEWLINE (Line buffering is standard for terminals)
-    if (buf_idx >= BATCH_SIZE || c == '\n') {
+    if (out_pipe) {
+        if (buf_idx >= PIPE_BUF_SIZE) fflush_internal();
+    } else if (buf_idx >= STDOUT_RECORD_MAX || c == '\n') {
         fflush_internal();
     }
 }
@@ -71,13 +167,46 @@ void fflush(void) {
     fflush_internal();
 }
 
+// Output sits in the channel until the terminal draws it. Waiting for that
+// before exiting keeps it ahead of whatever the parent prints next.
+void exit(int code) {
+    fflush_internal();
+
+    if (have_chan) {
+        while (out_chan.tx->tail != out_chan.tx->head && !out_chan.rx->closed) {
+            out_chan.tx->waiting = 1;
+            asm volatile("mfence" ::: "memory");
+
+            if (out_chan.tx->tail == out_chan.tx->head) break;
+            wait_for_terminal();
+        }
+    }
+
+    sys_exit(code);
+}
+
 char getchar(void) {
     fflush_internal();
+
+    if (in_pipe) {
+        if (in_pos == in_len) {
+            int64_t n = sys_read(0, in_buf, PIPE_BUF_SIZE);
+            if (n <= 0) return EOF; // Writer closed its end
+            in_len = (int)n;
+            in_pos = 0;
+        }
+        return in_buf[in_pos++];
+    }
+
     message_t msg;
     while (1) {
-        int res = sys_ipc_recv(&msg);
+        if (!next_message(&msg)) {
+            sys_wait_events(EVENT_IPC, 0);
+            continue;
+        }
+
         // Only accept keys from our connected terminal
-        if (res == 0 && msg.type == MSG_KEY_EVENT && msg.sender_pid == terminal_pid) {
+        if (msg.type == MSG_KEY_EVENT && msg.sender_pid == terminal_pid) {
             return (char)msg.data1;
         }
 
@@ -87,26 +216,115 @@ char getchar(void) {
     }
 }
 
-void printf(const char* fmt, ...) {
-    // (Implementation same as previous example, calls putchar)
-    va_list args;
-    va_start(args, fmt);
+// Formatted output goes through an emit callback, so printf and snprintf
+// share the parser
+typedef void (*emit_fn)(char c, void* ctx);
+
+static void emit_uint(emit_fn emit, void* ctx, uint64_t value, int base, int width, char pad) {
+    char buffer[32];
+    int i = 0;
+
+    do {
+        uint64_t digit = value % base;
+        buffer[i++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+        value /= base;
+    } while (value > 0);
+
+    while (width-- > i) emit(pad, ctx);
+    while (i--) emit(buffer[i], ctx);
+}
+
+static void format(emit_fn emit, void* ctx, const char* fmt, va_list args) {
     while (*fmt) {
-        if (*fmt == '%') {
-            fmt++;
-            if (*fmt == 's') {
+        if (*fmt != '%') {
+            emit(*fmt++, ctx);
+            continue;
+        }
+        fmt++;
+
+        // Optional left alignment, zero padding, width and 'l' length modifier
+        char pad = ' ';
+        int width = 0;
+        int left = 0;
+        int is_long = 0;
+        if (*fmt == '-') { left = 1; fmt++; }
+        if (*fmt == '0') { pad = '0'; fmt++; }
+        while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        while (*fmt == 'l') { is_long = 1; fmt++; }
+
+        switch (*fmt) {
+            case 's': {
                 const char* s = va_arg(args, const char*);
-                while (*s) putchar(*s++);
-            } 
-             // Add other formatters...
-        } else {
-            putchar(*fmt);
+                int len = strlen(s);
+                if (!left) while (width-- > len) emit(' ', ctx);
+                while (*s) emit(*s++, ctx);
+                if (left) while (width-- > len) emit(' ', ctx);
+                break;
+            }
+            case 'c':
+                emit((char)va_arg(args, int), ctx);
+                break;
+            case 'd': {
+                int64_t v = is_long ? va_arg(args, int64_t) : va_arg(args, int);
+                if (v < 0) { emit('-', ctx); v = -v; if (width) width--; }
+                emit_uint(emit, ctx, (uint64_t)v, 10, width, pad);
+                break;
+            }
+            case 'u':
+                emit_uint(emit, ctx, is_long ? va_arg(args, uint64_t) : va_arg(args, unsigned int), 10, width, pad);
+                break;
+            case 'x':
+                emit_uint(emit, ctx, is_long ? va_arg(args, uint64_t) : va_arg(args, unsigned int), 16, width, pad);
+                break;
+            case '%':
+                emit('%', ctx);
+                break;
+            case 0:
+                return;
         }
         fmt++;
     }
+}
+
+static void emit_stdout(char c, void* ctx) {
+    (void)ctx;
+    putchar(c);
+}
+
+void printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    format(emit_stdout, NULL, fmt, args);
     va_end(args);
 }
 
+typedef struct {
+    char* buf;
+    int size;
+    int len;
+} str_sink_t;
+
+static void emit_string(char c, void* ctx) {
+    str_sink_t* sink = (str_sink_t*)ctx;
+    if (sink->len + 1 < sink->size) sink->buf[sink->len] = c;
+    sink->len++;
+}
+
+// Always NUL-terminates (if size > 0). Returns the full formatted length,
+// which is >= size when the output was cut short.
+int snprintf(char* buf, int size, const char* fmt, ...) {
+    str_sink_t sink = { buf, size, 0 };
+
+    va_list args;
+    va_start(args, fmt);
+    format(emit_string, &sink, fmt, args);
+    va_end(args);
+
+    if (size > 0) buf[sink.len < size ? sink.len : size - 1] = 0;
+    return sink.len;
+}
+
 void clear_screen() {
-    sys_ipc_send(terminal_pid, MSG_STDOUT_CLEAR, 0, 0, 0);
+    fflush_internal();
+    send_record(out_buf, 0);
 }
\ No newline at end of file
@@ -6,9 +6,11 @@
 extern int terminal_pid;
 
 void stdio_init(void); // Wait for terminal connection
+void exit(int code);   // Flush stdout, wait for the terminal to draw it, exit
 void putchar(char c);
 char getchar(void);
 void printf(const char* fmt, ...);
+int snprintf(char* buf, int size, const char* fmt, ...);
 void clear_screen();
 
 #endif
@@ -0,0 +1,84 @@
+#include "thread.h"
+#include "../openidp.h"
+
+struct thread_start {
+    thread_fn_t fn;
+    void* arg;
+};
+
+// fn and arg reach the new thread through this slot rather than the heap,
+// which has no lock. The creator owns it and waits until the thread has
+// copied it, so one slot serves every thread_create().
+static mutex_t start_lock = MUTEX_INIT;
+static struct thread_start start_slot;
+static uint32_t start_taken;
+
+static void thread_trampoline(void* p) {
+    struct thread_start start = *(struct thread_start*)p;
+    __atomic_store_n(&start_taken, 1, __ATOMIC_RELEASE);
+    futex_wake(&start_taken, 1);
+
+    start.fn(start.arg);
+    sys_exit(0);
+}
+
+int thread_create(thread_fn_t fn, void* arg) {
+    mutex_lock(&start_lock);
+
+    start_slot.fn = fn;
+    start_slot.arg = arg;
+    start_taken = 0;
+
+    int tid = sys_thread_create(thread_trampoline, &start_slot, 0);
+    if (tid >= 0) {
+        while (!__atomic_load_n(&start_taken, __ATOMIC_ACQUIRE)) {
+            futex_wait(&start_taken, 0);
+        }
+    }
+
+    mutex_unlock(&start_lock);
+    return tid;
+}
+
+int futex_wait(uint32_t* addr, uint32_t expected) {
+    return sys_futex_wait(addr, expected);
+}
+
+int futex_wake(uint32_t* addr, uint32_t count) {
+    return sys_futex_wake(addr, count);
+}
+
+/* Mutex functions */
+
+static inline uint32_t cmpxchg(uint32_t* p, uint32_t expected, uint32_t desired) {
+    __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+    return expected;
+}
+
+void mutex_init(mutex_t* m) {
+    m->state = 0;
+}
+
+// Uncontended lock and unlock stay in userspace; only a task that finds
+// the mutex held goes to the kernel, and only then does unlock wake.
+void mutex_lock(mutex_t* m) {
+    uint32_t c = cmpxchg(&m->state, 0, 1);
+    if (c == 0) return;
+
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait(&m->state, 2);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+int mutex_trylock(mutex_t* m) {
+    return cmpxchg(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void mutex_unlock(mutex_t* m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex_wake(&m->state, 1);
+    }
+}
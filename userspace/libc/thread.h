@@ -0,0 +1,28 @@
+#ifndef IDP_THREAD_H
+#define IDP_THREAD_H
+
+#include "stdint.h"
+
+typedef void (*thread_fn_t)(void* arg);
+
+// Runs fn(arg) on a new thread sharing this process' memory. The thread
+// exits when fn returns. Returns the thread id, or -1 on failure.
+// Neither malloc/free nor stdio are thread-safe.
+int thread_create(thread_fn_t fn, void* arg);
+
+int futex_wait(uint32_t* addr, uint32_t expected);
+int futex_wake(uint32_t* addr, uint32_t count);
+
+// 0 = unlocked, 1 = locked, 2 = locked with waiters
+typedef struct {
+    uint32_t state;
+} mutex_t;
+
+#define MUTEX_INIT { 0 }
+
+void mutex_init(mutex_t* m);
+void mutex_lock(mutex_t* m);
+int mutex_trylock(mutex_t* m);
+void mutex_unlock(mutex_t* m);
+
+#endif
@@ -0,0 +1,54 @@
+#include "time.h"
+#include "../openidp.h"
+
+#define KDATA_TIME ((const kdata_time_t*)USER_KDATA_TIME)
+#define KDATA_PROC ((const kdata_proc_t*)USER_KDATA_PROC)
+
+uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint64_t clock_ns(void) {
+    const kdata_time_t* kd = KDATA_TIME;
+    uint32_t seq;
+    uint64_t tsc_base, ns_base, mult, now;
+
+    // Seqlock read: retry if the timer tick updated the page meanwhile
+    do {
+        seq = kd->seq;
+        asm volatile("" ::: "memory");
+
+        tsc_base = kd->tsc_base;
+        ns_base = kd->ns_base;
+        mult = kd->tsc_mult;
+        now = rdtsc();
+
+        asm volatile("" ::: "memory");
+    } while ((seq & 1) || seq != kd->seq);
+
+    if (now < tsc_base) return ns_base;
+    return ns_base + (uint64_t)(((unsigned __int128)(now - tsc_base) * mult) >> KDATA_TSC_SHIFT);
+}
+
+int clock_gettime(int clock_id, struct timespec* ts) {
+    if (clock_id != CLOCK_MONOTONIC || !ts) return -1;
+
+    uint64_t ns = clock_ns();
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+    return 0;
+}
+
+uint64_t clock_ticks(void) {
+    return KDATA_TIME->ticks;
+}
+
+uint64_t tsc_hz(void) {
+    return KDATA_TIME->tsc_hz;
+}
+
+int getpid(void) {
+    return (int)KDATA_PROC->pid;
+}
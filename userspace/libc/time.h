@@ -0,0 +1,21 @@
+#ifndef IDP_TIME_H
+#define IDP_TIME_H
+
+#include "stdint.h"
+
+#define CLOCK_MONOTONIC 1
+
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+// All of these read the kernel data page, no syscall involved
+int clock_gettime(int clock_id, struct timespec* ts);
+uint64_t clock_ns(void);
+uint64_t clock_ticks(void);
+uint64_t rdtsc(void);
+uint64_t tsc_hz(void);
+int getpid(void);
+
+#endif
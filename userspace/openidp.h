@@ -16,6 +16,52 @@
 #define SYS_UNMAP 14
 #define SYS_STAT 15
 #define SYS_DIR_READ 16
+#define SYS_TASK_STATS 17
+#define SYS_THREAD_CREATE 18
+#define SYS_FUTEX_WAIT 19
+#define SYS_FUTEX_WAKE 20
+#define SYS_WAITPID 21
+#define SYS_RING_SETUP 22
+#define SYS_RING_ENTER 23
+#define SYS_TRACE_CTL 24
+#define SYS_TRACE_READ 25
+#define SYS_OPEN 26
+#define SYS_READ 27
+#define SYS_PREAD 28
+#define SYS_SEEK 29
+#define SYS_CLOSE 30
+#define SYS_GETDENTS 31
+#define SYS_LOG_READ 32
+#define SYS_CHAN_CREATE 33
+#define SYS_CHAN_ACCEPT 34
+#define SYS_CHAN_NOTIFY 35
+#define SYS_CHAN_CLOSE 36
+#define SYS_PIPE 37
+#define SYS_EXEC_FDS 38
+#define SYS_FD_WRITE 39
+#define SYS_FSTAT 40
+#define SYS_IPC_CALL 41
+#define SYS_IPC_REPLY_WAIT 42
+#define SYS_WAIT_EVENTS 43
+#define SYS_BLOCK_STATS 44
+
+// sys_wait_events mask bits
+#define EVENT_IPC   0x1   // A message or doorbell is queued
+#define EVENT_KEY   0x2   // sys_read_key has input
+#define EVENT_TIMER 0x4   // timeout_ns has passed
+
+// sys_open flags, must match include/process/file.h
+#define O_RDONLY  0x0
+#define O_WRONLY  0x1
+#define O_RDWR    0x2
+#define O_CREAT   0x40
+#define O_TRUNC   0x200
+#define O_APPEND  0x400
+#define O_DIRECTORY 0x10000
+
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
 
 #define MSG_REQUEST_WINDOW 100 
 #define MSG_HANDSHAKE 0x111
@@ -33,6 +79,36 @@
 #define MSG_STDOUT_BATCH 601
 #define MSG_STDOUT_CLEAR 602
 
+// stdout channel to the terminal (libc/stdio.c), set up after MSG_HANDSHAKE.
+// Each record is one flush; an empty record clears the screen.
+#define STDOUT_RING_SIZE  16384
+#define STDOUT_RECORD_MAX 256
+
+// Channels (libc/chan.h)
+#define MSG_CHAN_DOORBELL 700 // d1=channel id, sent by the kernel
+#define MSG_CHAN_OPEN     701 // d1=channel id, sent by the creator
+
+// Read-only kernel data pages mapped into every process
+#define USER_KDATA_TIME 0x600000000ULL
+#define USER_KDATA_PROC 0x600001000ULL
+#define KDATA_TSC_SHIFT 32
+
+typedef struct {
+    volatile uint32_t seq;
+    uint32_t tick_hz;
+
+    uint64_t tsc_hz;
+    uint64_t tsc_mult;
+
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    uint64_t ticks;
+} kdata_time_t;
+
+typedef struct {
+    uint64_t pid;
+} kdata_proc_t;
+
 struct fb_info {
     uint64_t fb_addr;
     uint64_t fb_width;
@@ -54,12 +130,75 @@ struct kstat {
     uint32_t flags; // 1 = Directory, 0 = File
 };
 
+#define KSTAT_DIR  1
+#define KSTAT_PIPE 2   // Only reported by sys_fstat
+
 struct kdirent {
     char name[128];   
     uint64_t size;    
     uint8_t is_dir;   // 1 if directory, 0 if file
 };
 
+#define TASK_NAME_LEN 32
+
+#define TASK_RUNNING 0
+#define TASK_BLOCKED 1
+#define TASK_ZOMBIE  2
+
+typedef struct {
+    uint64_t pid;
+    char name[TASK_NAME_LEN];
+    uint32_t state;
+    uint32_t is_current;
+    uint64_t runtime_ns;
+    uint64_t nr_voluntary;
+    uint64_t nr_involuntary;
+} task_stats_t;
+
+// Syscall tracing, layout must match include/syscall/trace.h
+#define TRACE_STATS (1 << 0)
+#define TRACE_LOG   (1 << 1)
+
+#define TRACE_MAX_SYSCALLS  64
+#define TRACE_HIST_BUCKETS  32
+
+#define TRACE_CTL_SET_FLAGS 0
+#define TRACE_CTL_SET_PID   1
+#define TRACE_CTL_GET_STATS 2
+#define TRACE_CTL_RESET     3
+#define TRACE_CTL_DROPPED   4
+#define TRACE_CTL_ON_EXEC   5
+
+typedef struct {
+    uint64_t count[TRACE_MAX_SYSCALLS];
+    uint64_t total_ns[TRACE_MAX_SYSCALLS];
+    uint64_t max_ns[TRACE_MAX_SYSCALLS];
+    uint32_t hist[TRACE_MAX_SYSCALLS][TRACE_HIST_BUCKETS];
+} trace_stats_t;
+
+typedef struct {
+    uint64_t timestamp_ns;
+    uint64_t duration_ns;
+    uint32_t pid;
+    uint32_t nr;
+    uint64_t args[3];
+    int64_t ret;
+    uint64_t reserved;
+} trace_record_t;
+
+// Block cache counters in blocks, layout must match include/drivers/bcache.h
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;
+    uint64_t readahead_hits;
+    uint64_t evictions;
+    uint64_t dev_reads;
+    uint64_t dev_writes;
+    uint64_t pages;
+    uint64_t max_pages;
+} bcache_stats_t;
+
 static inline int sys_write(int fd, const char* buf) {
     int ret;
     asm volatile (
@@ -82,6 +221,19 @@ static inline void sys_exit(int code) {
     );
 }
 
+// Blocks until the child exits. pid -1 waits for any child.
+// Returns the child's pid, or -1 if there is no such child.
+static inline int sys_waitpid(int pid, int* status) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_WAITPID), "D" ((uint64_t)pid), "S" ((uint64_t)status)
+        : "memory"
+    );
+    return ret;
+}
+
 static inline uint16_t sys_read_key(void) {
     uint64_t ret; // Use 64-bit storage for the syscall result
     asm volatile (
@@ -93,6 +245,17 @@ static inline uint16_t sys_read_key(void) {
     return (uint16_t)ret; // Cast back to the actual packet size
 }
 
+static inline int64_t sys_log_read(char* buf, uint64_t len) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_LOG_READ), "D" ((uint64_t)buf), "S" (len)
+        : "memory"
+    );
+    return ret;
+}
+
 static inline int sys_exec(const char* path, int argc, char** argv) {
     int ret;
     asm volatile (
@@ -107,6 +270,22 @@ static inline int sys_exec(const char* path, int argc, char** argv) {
     return ret;
 }
 
+// The child's descriptors 0-2 start as our fd_map[0..2], -1 leaves one closed
+static inline int sys_exec_fds(const char* path, int argc, char** argv, const int fd_map[3]) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_EXEC_FDS),
+          "D" ((uint64_t)path),
+          "S" ((uint64_t)argc),
+          "d" ((uint64_t)argv),
+          "c" ((uint64_t)fd_map)
+        : "memory"
+    );
+    return ret;
+}
+
 static inline int sys_get_framebuffer_info(struct fb_info* out) {
     int ret;
 
@@ -161,6 +340,45 @@ static inline int sys_ipc_recv(message_t* msg_out) {
     return ret;
 }
 
+// Sends *msg to dest_pid and blocks until it replies, the reply
+// overwrites *msg. Returns -1 if the receiver is gone.
+static inline int sys_ipc_call(int dest_pid, message_t* msg) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_IPC_CALL), "D" ((uint64_t)dest_pid), "S" (msg)
+        : "memory"
+    );
+    return ret;
+}
+
+// Replies to reply_pid's sys_ipc_call with *msg (reply_pid 0 skips the
+// reply), then blocks for the next message and stores it in *msg
+static inline int sys_ipc_reply_wait(int reply_pid, message_t* msg) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_IPC_REPLY_WAIT), "D" ((uint64_t)reply_pid), "S" (msg)
+        : "memory"
+    );
+    return ret;
+}
+
+// Blocks until one of the events in mask is pending, returns the pending
+// ones. timeout_ns only applies with EVENT_TIMER.
+static inline int sys_wait_events(uint32_t mask, uint64_t timeout_ns) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_WAIT_EVENTS), "D" ((uint64_t)mask), "S" (timeout_ns)
+        : "memory"
+    );
+    return ret;
+}
+
 // Returns: Local Virtual Address of the shared buffer
 // Output: *target_vaddr_out gets the address valid in the Target Process
 static inline void* sys_share_mem(int target_pid, uint64_t size, uint64_t* target_vaddr_out) {
@@ -220,4 +438,262 @@ static inline int sys_dir_read(const char* path, uint64_t index, struct kdirent*
     return ret;
 }
 
+// Returns the total number of tasks, fills up to max entries
+static inline int sys_task_stats(task_stats_t* out, uint64_t max) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_TASK_STATS), "D" ((uint64_t)out), "S" (max)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int sys_block_stats(bcache_stats_t* out) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_BLOCK_STATS), "D" ((uint64_t)out)
+        : "memory"
+    );
+    return ret;
+}
+
+// Starts entry(arg) on a new thread in this process. Returns the thread's pid.
+static inline int sys_thread_create(void (*entry)(void*), void* arg, void* tls) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_THREAD_CREATE), "D" ((uint64_t)entry), "S" ((uint64_t)arg), "d" ((uint64_t)tls)
+        : "memory"
+    );
+    return ret;
+}
+
+// Sleeps while *uaddr == expected. Returns -1 straight away if it is not.
+static inline int sys_futex_wait(uint32_t* uaddr, uint32_t expected) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_FUTEX_WAIT), "D" ((uint64_t)uaddr), "S" ((uint64_t)expected)
+        : "memory"
+    );
+    return ret;
+}
+
+// Returns the number of waiters woken
+static inline int sys_futex_wake(uint32_t* uaddr, uint32_t count) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_FUTEX_WAKE), "D" ((uint64_t)uaddr), "S" ((uint64_t)count)
+        : "memory"
+    );
+    return ret;
+}
+
+// Maps this task's submission/completion rings, see libc/ring.h
+static inline void* sys_ring_setup(void) {
+    void* ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_RING_SETUP)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int sys_ring_enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_RING_ENTER), "D" ((uint64_t)to_submit), "S" ((uint64_t)min_complete), "d" ((uint64_t)flags)
+        : "memory"
+    );
+    return ret;
+}
+
+struct chan_info;
+
+static inline int64_t sys_chan_create(int peer_pid, uint64_t size, struct chan_info* info) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_CHAN_CREATE), "D" ((uint64_t)peer_pid), "S" (size), "d" (info)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int64_t sys_chan_accept(uint64_t id, struct chan_info* info) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_CHAN_ACCEPT), "D" (id), "S" (info)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int64_t sys_chan_notify(uint64_t id) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_CHAN_NOTIFY), "D" (id)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int64_t sys_chan_close(uint64_t id) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_CHAN_CLOSE), "D" (id)
+        : "memory"
+    );
+    return ret;
+}
+
+// Returns a file descriptor, or a negative error
+static inline int sys_open(const char* path, uint32_t flags) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_OPEN), "D" ((uint64_t)path), "S" ((uint64_t)flags)
+        : "memory"
+    );
+    return ret;
+}
+
+// Returns bytes read, 0 at end of file
+static inline int64_t sys_read(int fd, void* buf, uint64_t len) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_READ), "D" ((uint64_t)fd), "S" ((uint64_t)buf), "d" (len)
+        : "memory"
+    );
+    return ret;
+}
+
+// Reads at offset without moving the file position
+static inline int64_t sys_pread(int fd, void* buf, uint64_t len, uint64_t offset) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_PREAD), "D" ((uint64_t)fd), "S" ((uint64_t)buf), "d" (len), "c" (offset)
+        : "memory"
+    );
+    return ret;
+}
+
+// Returns the new file position
+static inline int64_t sys_seek(int fd, int64_t offset, int whence) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_SEEK), "D" ((uint64_t)fd), "S" ((uint64_t)offset), "d" ((uint64_t)whence)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int sys_close(int fd) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_CLOSE), "D" ((uint64_t)fd)
+        : "memory"
+    );
+    return ret;
+}
+
+// Blocks until len bytes went into a pipe, or writes to a file at its position
+static inline int64_t sys_fd_write(int fd, const void* buf, uint64_t len) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_FD_WRITE), "D" ((uint64_t)fd), "S" ((uint64_t)buf), "d" (len)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int sys_fstat(int fd, struct kstat* st) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_FSTAT), "D" ((uint64_t)fd), "S" ((uint64_t)st)
+        : "memory"
+    );
+    return ret;
+}
+
+// fds[0] receives the read end, fds[1] the write end
+static inline int sys_pipe(int fds[2]) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_PIPE), "D" ((uint64_t)fds)
+        : "memory"
+    );
+    return ret;
+}
+
+// Fills buf with kdirent records from a directory opened with O_DIRECTORY.
+// Returns bytes written, 0 once the directory is exhausted.
+static inline int64_t sys_getdents(int fd, struct kdirent* buf, uint64_t size) {
+    int64_t ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_GETDENTS), "D" ((uint64_t)fd), "S" ((uint64_t)buf), "d" (size)
+        : "memory"
+    );
+    return ret;
+}
+
+static inline int sys_trace_ctl(uint64_t cmd, uint64_t arg0, uint64_t arg1) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_TRACE_CTL), "D" (cmd), "S" (arg0), "d" (arg1)
+        : "memory"
+    );
+    return ret;
+}
+
+// Returns the number of records copied, waits up to timeout_ms if none are queued
+static inline int sys_trace_read(trace_record_t* out, uint64_t max, uint64_t timeout_ms) {
+    int ret;
+    asm volatile (
+        "int $0x80"
+        : "=a" (ret)
+        : "a" (SYS_TRACE_READ), "D" ((uint64_t)out), "S" (max), "d" (timeout_ms)
+        : "memory"
+    );
+    return ret;
+}
+
 #endif
@@ -1,13 +1,17 @@
 #include "../libc/stdio.h"
 #include "../libc/string.h"
+#include "../libc/time.h"
 #include "../openidp.h"
 
 #define MAX_CMD_LEN 256
 #define MAX_PATH_LEN 256
+#define MAX_ARGS 16
+#define MAX_STAGES 8
 
 char current_directory[MAX_PATH_LEN] = "/";
 
 int resolve_path(char* target_buf, const char* base, const char* input);
+int run_external(int argc, char** argv);
 
 // Helper to read a line from our new getchar()
 int shell_readline(char* buf, int max) {
@@ -59,11 +63,11 @@ void _start() {
 
         if (cmd_buffer[0] != 0) {
             // 1. Tokenize (Your existing code)
-            char* argv[16];
+            char* argv[MAX_ARGS + 1];
             argv[0] = current_directory; 
             int argc = 1;
             char* token = strtok(cmd_buffer, " ");
-            while (token != NULL && argc < 16) {
+            while (token != NULL && argc < MAX_ARGS) {
                 argv[argc++] = token;
                 token = strtok(NULL, " ");
             }
@@ -77,7 +81,7 @@ void _start() {
 
             // 2. Dispatch using tokens instead of raw buffer
             if (strcmp(command, "help") == 0) {
-                printf("Commands: help, clear, echo, cd\n");
+                printf("Commands: help, clear, echo, cd, time, <cmd> | <cmd>\n");
             }
             else if (strcmp(command, "cd") == 0) {
                 // Handle "cd" (go to root)
@@ -110,27 +114,129 @@ void _start() {
             else if (strcmp(command, "clear") == 0) {
                 clear_screen();
             }
-            else {
-                // External Command Execution
-                // Note: We use 'command' (argv[1]) as the executable path
-                if (command[0] == '/') {
-                    // Absolute path
-                    int pid = sys_exec(argv[1], argc, argv);
-                    if (pid < 0) printf("\033[31mCommand failed:\033[37m %s \033[36m(invalid command or path to elf)\033[37m\n", command);
-                    extern int terminal_pid;
-                    sys_ipc_send(pid, MSG_HANDSHAKE, terminal_pid, 0, 0);
-                } else {
-                    // Relative path
-                    resolve_path(temp_path, current_directory, command);
-                    int pid = sys_exec(temp_path, argc, argv); // Execute resolved path
-                    if (pid < 0) printf("\033[31mCommand failed:\033[37m %s \033[36m(invalid command or path to elf)\033[37m\n", command);
-                    extern int terminal_pid;
-                    sys_ipc_send(pid, MSG_HANDSHAKE, terminal_pid, 0, 0);
+            else if (strcmp(command, "time") == 0) {
+                if (argument == NULL) {
+                    printf("usage: time <command> [args]\n");
+                    continue;
                 }
+
+                // Drop "time" and run the rest as its own command line
+                argv[1] = current_directory;
+
+                uint64_t start = clock_ns();
+                run_external(argc - 1, &argv[1]);
+                uint64_t elapsed_us = (clock_ns() - start) / 1000;
+
+                printf("real %lu.%06lus\n", elapsed_us / 1000000, elapsed_us % 1000000);
             }
+            else {
+                run_external(argc, argv);
+            }
+        }
+    }
+    exit(0);
+}
+
+// Starts argv[1] with the shell's argv layout, its descriptors 0-2 taken
+// from fd_map. Returns the PID, or -1 if the command could not be started.
+static int spawn(int argc, char** argv, const int* fd_map) {
+    char temp_path[MAX_PATH_LEN];
+    char* command = argv[1];
+    int pid;
+
+    // Note: We use 'command' (argv[1]) as the executable path
+    if (command[0] == '/') {
+        // Absolute path
+        pid = sys_exec_fds(command, argc, argv, fd_map);
+    } else {
+        // Relative path
+        resolve_path(temp_path, current_directory, command);
+        pid = sys_exec_fds(temp_path, argc, argv, fd_map); // Execute resolved path
+    }
+
+    if (pid < 0) {
+        printf("\033[31mCommand failed:\033[37m %s \033[36m(invalid command or path to elf)\033[37m\n", command);
+        return -1;
+    }
+
+    extern int terminal_pid;
+    sys_ipc_send(pid, MSG_HANDSHAKE, terminal_pid, 0, 0);
+    return pid;
+}
+
+// Runs "a | b | c" with a pipe between each pair of neighbours. All stages
+// run at the same time. Returns the exit code of the last one.
+static int run_pipeline(int argc, char** argv) {
+    char* stage_argv[MAX_STAGES][MAX_ARGS + 1];
+    int stage_argc[MAX_STAGES];
+    int stages = 0;
+    int start = 1;
+
+    // Split at "|", each stage gets the shell's layout with argv[0] = cwd
+    for (int i = 1; i <= argc; i++) {
+        if (i < argc && strcmp(argv[i], "|") != 0) continue;
+
+        if (i == start || stages == MAX_STAGES) {
+            printf("\033[31midpshell:\033[37m invalid pipeline\n");
+            return -1;
         }
+
+        int n = 0;
+        stage_argv[stages][n++] = argv[0];
+        for (int j = start; j < i; j++) stage_argv[stages][n++] = argv[j];
+        stage_argv[stages][n] = NULL;
+        stage_argc[stages++] = n;
+
+        start = i + 1;
     }
-    sys_exit(0);
+
+    int pids[MAX_STAGES];
+    int prev_read = -1;
+
+    for (int s = 0; s < stages; s++) {
+        int fds[2] = { -1, -1 };
+        if (s < stages - 1 && sys_pipe(fds) < 0) {
+            printf("\033[31midpshell:\033[37m cannot create pipe\n");
+            for (; s < stages; s++) pids[s] = -1;
+            break;
+        }
+
+        int fd_map[3] = { prev_read, fds[1], -1 };
+        pids[s] = spawn(stage_argc[s], stage_argv[s], fd_map);
+
+        // The children hold their own references now
+        if (prev_read >= 0) sys_close(prev_read);
+        if (fds[1] >= 0) sys_close(fds[1]);
+        prev_read = fds[0];
+    }
+    if (prev_read >= 0) sys_close(prev_read);
+
+    int status = -1;
+    for (int s = 0; s < stages; s++) {
+        if (pids[s] < 0) continue;
+
+        int code = 0;
+        sys_waitpid(pids[s], &code);
+        if (s == stages - 1) status = code;
+    }
+    return status;
+}
+
+// Runs argv[1] with the shell's argv layout and waits for it to exit.
+// Returns the exit code, or -1 if the command could not be started.
+int run_external(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "|") == 0) return run_pipeline(argc, argv);
+    }
+
+    int no_fds[3] = { -1, -1, -1 };
+    int pid = spawn(argc, argv, no_fds);
+    if (pid < 0) return -1;
+
+    // Keep the prompt from racing the command's output
+    int status = 0;
+    sys_waitpid(pid, &status);
+    return status;
 }
 
 int resolve_path(char* target_buf, const char* base, const char* input) {
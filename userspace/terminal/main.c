@@ -1,6 +1,8 @@
 #include "../openidp.h"
 #include "../libc/heap.h"
 #include "../libc/string.h"
+#include "../libc/chan.h"
+#include "../libc/ring.h"
 #include <stddef.h>         // Fixed: Needed for size_t
 #include "../libgfx/gfx.h"  
 #include "term.h"
@@ -10,12 +12,40 @@
 
 #define FONT_PATH "/fonts/krypton.psf"
 
+// stdout channels from the shell and the programs it runs
+#define MAX_STREAMS 8
+
+// Receives kept armed in the ring, a burst of messages completes in one wait
+#define RECV_DEPTH 4
+
 static gfx_context_t gfx;
 static term_t term;
 static int shell_pid = -1;
 
+static chan_t streams[MAX_STREAMS];
+static int stream_used[MAX_STREAMS];
+
+// Outgoing messages are queued here and go out with the next wait, so a
+// key forward or screen update costs no kernel entry of its own
+static ring_t ring;
+
 /* Helper functions */
 
+static void term_send(int pid, int type, uint64_t d1, uint64_t d2, uint64_t d3) {
+    ring_sqe_t* sqe = ring_get_sqe(&ring);
+    if (!sqe) {
+        sys_ipc_send(pid, type, d1, d2, d3);
+        return;
+    }
+
+    ring_prep_ipc_send(sqe, pid, type, d1, d2, d3);
+}
+
+static void arm_recv(void) {
+    ring_sqe_t* sqe = ring_get_sqe(&ring);
+    if (sqe) ring_prep_ipc_recv(sqe);
+}
+
 // Robust file loader (allocates buffer)
 static void* load_file_to_memory(const char* path) {
     struct kstat stat;
@@ -48,31 +78,88 @@ static void process_term_update(term_t* term) {
         uint64_t pos_data = ((uint64_t)update->x << 32) | (uint32_t)update->y;
         uint64_t size_data = ((uint64_t)update->w << 32) | (uint32_t)update->h;
 
-        sys_ipc_send(1, MSG_BUFFER_UPDATE, pos_data, size_data, 0);
+        term_send(1, MSG_BUFFER_UPDATE, pos_data, size_data, 0);
 
         term->last_update.dirty = 0;
     }
 }
 
+static void open_stream(uint64_t id) {
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (stream_used[i]) continue;
+
+        if (chan_accept(&streams[i], id) == 0) stream_used[i] = 1;
+        return;
+    }
+
+    // No room: closing makes the writer fall back to plain messages
+    chan_t ch;
+    if (chan_accept(&ch, id) == 0) chan_close(&ch);
+}
+
+// Draws everything queued on every stream, then sends the WM one update
+static void drain_streams(void) {
+    char record[STDOUT_RECORD_MAX + 1];
+
+    for (int i = 0; i < MAX_STREAMS; i++) {
+        if (!stream_used[i]) continue;
+
+        int64_t len;
+        while ((len = chan_recv(&streams[i], record, STDOUT_RECORD_MAX)) >= 0) {
+            if (len == 0) {
+                term_clear(&term);
+                continue;
+            }
+
+            record[len] = 0;
+            term_write(&term, record);
+        }
+
+        if (len == CHAN_ERR_CLOSED || len == CHAN_ERR_SIZE) {
+            chan_close(&streams[i]);
+            stream_used[i] = 0;
+        }
+    }
+
+    process_term_update(&term);
+}
+
 void _start() {
     void* font_data = load_file_to_memory(FONT_PATH);
     if (!font_data) sys_exit(1);
+    if (ring_init(&ring) != 0) sys_exit(1);
+
+    for (int i = 0; i < RECV_DEPTH; i++) arm_recv();
 
     // Handshake with window manager
-    sys_ipc_send(1, MSG_REQUEST_WINDOW, 0, 0, 0); 
+    term_send(1, MSG_REQUEST_WINDOW, 0, 0, 0); 
 
     message_t msg;
     int running = 1;
     int initialized = 0;
 
     while (running) {
-        if (sys_ipc_recv(&msg) == 0) {
-            
+        if (initialized) drain_streams();
+
+        // Publishes the queued sends and sleeps until something completes.
+        // Doorbells arrive as messages too, so this covers the streams.
+        ring_submit_and_wait(&ring, 1);
+
+        ring_cqe_t* cqe;
+        while (running && (cqe = ring_peek_cqe(&ring))) {
+            int is_msg = cqe->flags & RING_CQE_MSG;
+            msg = cqe->msg;
+            ring_cqe_seen(&ring);
+
+            // Completed sends need nothing, a used receive is re-armed
+            if (!is_msg) continue;
+            arm_recv();
+
             // Handle regardless of state
             if (msg.type == MSG_QUIT_REQUEST) {
                 if (shell_pid > 0) {
                     // Forward the kill signal to the shell
-                    sys_ipc_send(shell_pid, MSG_QUIT_REQUEST, 0, 0, 0);
+                    term_send(shell_pid, MSG_QUIT_REQUEST, 0, 0, 0);
                 }
 
                 running = 0;
@@ -97,7 +184,7 @@ void _start() {
                 };
                 int shell_argc = 2;
                 shell_pid = sys_exec("/bin/idpshell.elf", shell_argc, shell_argv);
-                sys_ipc_send(shell_pid, MSG_HANDSHAKE, 0, 0, 0);
+                term_send(shell_pid, MSG_HANDSHAKE, 0, 0, 0);
 
                 initialized = 1;
 
@@ -128,13 +215,13 @@ void _start() {
                     // For resize, force manual update
                     rect_t full = {0, 0, w, h, 1};
                     // Manually send this one since it's not in term->last_update
-                    sys_ipc_send(1, MSG_BUFFER_UPDATE, 0, ((uint64_t)w << 32) | h, 0);
+                    term_send(1, MSG_BUFFER_UPDATE, 0, ((uint64_t)w << 32) | h, 0);
                     break;
                 }
 
                 case MSG_KEY_EVENT: {
 		            if (shell_pid > 0) {
-                        sys_ipc_send(shell_pid, MSG_KEY_EVENT, msg.data1, 0, 0);
+                        term_send(shell_pid, MSG_KEY_EVENT, msg.data1, 0, 0);
                     }
                     break;
                 }
@@ -173,6 +260,14 @@ void _start() {
                     term_clear(&term);
                     break;
                 }
+
+                case MSG_CHAN_OPEN:
+                    open_stream(msg.data1);
+                    break;
+
+                case MSG_CHAN_DOORBELL:
+                    // Streams are drained at the top of every iteration
+                    break;
             
                 default:
                     // Ignore unknown messages
@@ -181,6 +276,9 @@ void _start() {
         }
     }
 
+    // Let the queued sends (e.g. the shell's quit request) out
+    ring_submit(&ring);
+
     // Cleanup
     term_destroy(&term);
     free(font_data);